@@ -1,116 +1,126 @@
 /* Functions specific to the Energry Monitoring application*/
 
 #include "E_Mon.h"
+#include "trace_log.h"
 
 #define MS_PER_HR 3600000
+#define SAMPLER_BENCH_RATE_HZ 1000	// Pair rate assumed by benchmarkPipeline()
+
+
+q16_t ADCData::getADCreading() {
+	// Returns the average (or latest filter output) of all samples queued by the sampler since the last call, in channel units.
+	// Never starts a conversion. If nothing new has been queued the previous reading is returned.
+	int32_t sum = 0;	// Offset removed counts. ADC_RING_SIZE * 65535 fits easily.
+	int64_t sum_sq = 0;
+	uint16_t count = 0;
+	uint16_t raw;
+	const bool filtered = _filter.isActive();
+	bool filter_output = false;
+	int32_t filter_out = 0;	// Counts with FILTER_FRAC_BITS fraction
+	// Only take what is there now so a fast ISR can't keep us here.
+	for (uint16_t queued = _ring.available(); queued > 0 && _ring.pop(raw); queued--) {
+		const int32_t counts = (int32_t)raw - _offset_counts;
+		sum += counts;
+		sum_sq += (int64_t)counts * counts;
+		for (uint8_t reader = 0; reader < STATS_READERS; reader++) _stats[reader].add(counts);
+		if (filtered && _filter.process(counts * (1 << FILTER_FRAC_BITS), filter_out)) filter_output = true;
+		count++;
+	}
+	_block_size = count;
+	_block_sum = sum;
+	_block_sum_sq = sum_sq;
+	if (filter_output) {
+		_last_q16 = (q16_t)(((int64_t)filter_out * _gain_q32) >> (16 + FILTER_FRAC_BITS));
+		_has_reading = true;
+	}
+	else if (count && !filtered) {
+		// Scale the sum first so the average keeps the extra resolution averaging gives us
+		_last_q16 = (q16_t)((((int64_t)sum * _gain_q32) / count) >> 16);
+		_has_reading = true;
+	}
+	_getTimeDelta();
+	LOG(LOG_ADC_BLOCK, _channel, count, logFloat(q16ToDouble(_last_q16)));
+	return _last_q16;
+}
 
+double ADCData::getBlockMean() {
+	if (_block_size == 0) return 0;
+	return (double)_block_sum / (double)_block_size * (double)_gain_q32 / Q32_ONE;
+}
 
-uint16_t ADCData::getADCreading() {
-	uint32_t pin_value = _adc->analogRead(_channel,ADC_0);
-	uint32_t max_value = _adc->getMaxValue(ADC_0);
-	uint16_t mV = 3300 * ((double)pin_value/ (double)max_value);
-	_getTimeDelta();
-	/*
-	if (S1DEBUG) {
-		Serial1.print("pin: "); Serial1.print(_channel);
-		Serial1.print(" value: "); Serial1.print(pin_value);
-		Serial1.print("/"); Serial1.print(max_value);
-		Serial1.print(",in mV = "); Serial1.println(mV);
-	}
-	*/
-	return mV;
+double ADCData::getBlockStdDev() {
+	if (_block_size == 0) return 0;
+	const double mean = (double)_block_sum / (double)_block_size;
+	const double variance = (double)_block_sum_sq / (double)_block_size - mean * mean;
+	if (variance <= 0) return 0;
+	return sqrt(variance) * fabs((double)_gain_q32 / Q32_ONE);
+}
+
+bool ADCData::takeStats(StatsSnapshot &stats, uint8_t reader) {
+	// Covers every sample consumed since the last call for this reader
+	const bool have_stats = _stats[reader].snapshot(_gain_q32, stats);
+	_stats[reader].reset();
+	return have_stats;
+}
+
+
+bool ADCData::setParam(const char *param, double value) {
+	// Configures the filter chain. Each stage restarts when changed.
+	if (value < 0 || value > 255) return false;
+	const uint8_t setting = (uint8_t)value;
+	bool success = false;
+	if (!strcmp(param, "median")) success = _filter.first().setWindow(setting);
+	else if (!strcmp(param, "decimation")) success = _filter.rest().first().setDecimation(setting);
+	else if (!strcmp(param, "lowpass")) success = _filter.rest().rest().first().setShift(setting);
+	return success;
+}
+
+void ADCData::paramsToJson(JsonWriter &out) {
+	out.key("median").value(_filter.first().getWindow());
+	out.key("decimation").value(_filter.rest().first().getDecimation());
+	out.key("lowpass").value(_filter.rest().rest().first().getShift());
 }
 
 
 double	CurrentData::getData() {
-	// Returns current in Amps. Assumes Vcc = 3.3volts
-	// Vout = (Sensitivity * i + Vcc/2)
-	uint16_t adc_mV = getADCreading();
-	//Serial1.printf("ADC current reading is: %d mV, offset is %d and sens is %d\n", adc_mV, _offset_mV, _mV_per_A);
-	double current_A = (double)(adc_mV  - _offset_mV) / (double)_mV_per_A;
+	// Returns current in Amps.
+	// Vout = (Sensitivity * i + Vcc/2), already folded into _offset_counts and _gain_q32
+	const q16_t current_A = getADCreading();
+	if (!hasReading()) return _data_value; // Sampler hasn't delivered anything yet
 	// May want to check if data seems valid 
-	_setDataValue(current_A);
+	_setDataValue(q16ToDouble(current_A));
 	_getTimeDelta();
-	_checkMinMax();
 	return _data_value;
 }
 
-uint16_t CurrentData::lookupACSsens(ACS_MODELS model) {
-	// Returns mV/A for this IC.
-	switch (model) {
-		case ACS711_12B: return 110;
-		case ACS711_25B: return 55;
-		case ACS715_20A: return 185;
-		case ACS715_30A: return 133;
-		case ACS722_05B: 
-		case ACS722_10U: return 264;
-		case ACS722_10B: 
-		case ACS722_20U: return 132;
-		case ACS722_20B: 
-		case ACS722_40U: return 66;
-		case ACS722_40B: return 33;
-		default: return 0;
-	}
-	return 0;
-}
-
-uint16_t CurrentData::lookupACSoffset(ACS_MODELS model, uint16_t Vcc_mV) {
-	// Returns mV offset for this IC.
-	uint16_t offset_mV = 0;
-	switch (model) {
-		case ACS711_12B: offset_mV = Vcc_mV / 2; break;
-		case ACS711_25B: offset_mV = Vcc_mV / 2; break;
-		case ACS715_20A: Vcc_mV * 0.1; break;
-		case ACS715_30A: Vcc_mV * 0.1; break;
-		case ACS722_05B: offset_mV = Vcc_mV / 2; break;
-		case ACS722_10U: offset_mV = Vcc_mV * 0.1; break;
-		case ACS722_10B: offset_mV = Vcc_mV / 2; break;
-		case ACS722_20U: offset_mV = Vcc_mV * 0.1; break;
-		case ACS722_20B: offset_mV = Vcc_mV / 2; break;
-		case ACS722_40U: offset_mV = Vcc_mV * 0.1; break;
-		case ACS722_40B: offset_mV = Vcc_mV / 2; break;
-	}
-	if (true) Serial1.printf("Offset = %d\n",offset_mV);
-	return offset_mV;
-}
-
-int8_t CurrentData::lookupACSfunction(ACS_MODELS model) {
-	// returns 0 if function is input, 1 if it is an output, -1 if unused or unknown
-	switch (model) {
-		// Pin indicates current FAULT when low
-		case ACS711_12B:
-		case ACS711_25B: return 0;
-		// Pin is used passivly as FILTER
-		case ACS715_20A:
-		case ACS715_30A: return -1;
-		// this chip has BW_SEL (bandwidth selection). Ground = 80kHz, Vcc = 20 kHz.
-		case ACS722_05B:
-		case ACS722_10U:
-		case ACS722_10B:
-		case ACS722_20U:
-		case ACS722_20B:
-		case ACS722_40U:
-		case ACS722_40B: return 1;
-	}
-	return -1;
-}
-
 double VoltageData::getData() {
 	//method returns voltage in volts
-	uint16_t voltage_mV = getADCreading();
-	voltage_mV *= _v_div();
+	const q16_t voltage_V = getADCreading(); // Divider already folded into _gain_q32
+	if (!hasReading()) return _data_value; // Sampler hasn't delivered anything yet
 	// May want to check if data seems valid 
-	_setDataValue((double)voltage_mV / 1000.0);
-	_checkMinMax();
+	_setDataValue(q16ToDouble(voltage_V));
 	return _data_value;
 }
 
 
 double PowerData::getData() {
 	// Power is voltage times current. We have _voltage and _current.
-	// MAYT WANT TO MAKE SURE VOLTAGE AND CURRENT DATA ISN'T TOO OLD.
-	_setDataValue(_voltage->getValue() * _current->getValue());
-	_checkMinMax();
+	if (_paired) {
+		// Average of instantaneous power over every pair converted since the last call.
+		// Unlike the product of the averages this is right when current and voltage move together.
+		PairSample pair;
+		int64_t power_sum_W = 0;	// Q16.16
+		uint16_t count = 0;
+		for (uint16_t queued = _pairs.available(); queued > 0 && _pairs.pop(pair); queued--) {
+			power_sum_W += q16Mul(_voltage->rawToQ16(pair.v_raw), _current->rawToQ16(pair.i_raw));
+			count++;
+		}
+		if (count) _setDataValue(q16ToDouble((q16_t)(power_sum_W / count)));
+	}
+	else {
+		// MAYT WANT TO MAKE SURE VOLTAGE AND CURRENT DATA ISN'T TOO OLD.
+		_setDataValue(_voltage->getValue() * _current->getValue());
+	}
 	_getTimeDelta();
 	return _data_value;
 }
@@ -126,12 +136,16 @@ bool PowerData::setData(double set_value) {
 
 void PowerData::resetData() {
 	_data_value = 0;
-	resetMin();
-	resetMax();
+	resetMinMax();
 }
 
 double EnergyData::getData() {
 	// Returns Energy in Wh.
+	if (_power->isPaired()) {
+		// Integrated per sample in the sampler ISR
+		_setDataValue(_power->getIntegrator()->getWattHours());
+		return _data_value;
+	}
 	// First see what our current power is
 	const double power_W = _power->getValue();
 	// Assume it's constant since last sample and get new energy value
@@ -142,42 +156,70 @@ double EnergyData::getData() {
 }
 bool EnergyData::setData(double energy_Wh) {
 	// In certain instances, like after a reboot, _data_value should be initialized to a non-zero value.
+	if (_power->isPaired()) _power->getIntegrator()->setWattHours(energy_Wh);
 	_setDataValue(energy_Wh);
 	_getTimeDelta();
 	return true;
 }
 
-
-
-
-/*
-
-FOUND CODE:
-
-double calcIrms(uint8_t NUMBER_OF_SAMPLES, uint8_t Channel, double supply_voltage) {
-int ADC_COUNTS = 65536 / 2; //15bit due to single ended.
-int ICAL = 100; //current constant = (100 / 0.050) / 20 = 100
-
-for (uint8_t n = 0; n < NUMBER_OF_SAMPLES; n++) {
-lastSampleI = sampleI;
-sampleI = ads.readADC_SingleEnded(Channel);
-lastFilteredI = filteredI;
-filteredI = 0.996 * (lastFilteredI + sampleI - lastSampleI);
-
-// Root-mean-square method current
-// 1) square current values
-sqI = filteredI * filteredI;
-// 2) sum
-sumI += sqI;
+double ChargeData::getData() {
+	// Returns charge in Ah.
+	if (!_power->isPaired()) return _data_value; // Nothing integrates current without a pair
+	_setDataValue(_power->getIntegrator()->getAmpHours());
+	return _data_value;
+}
+bool ChargeData::setData(double charge_Ah) {
+	if (!_power->isPaired()) return false;
+	_power->getIntegrator()->setAmpHours(charge_Ah);
+	_setDataValue(charge_Ah);
+	return true;
 }
 
-double I_RATIO = ICAL * ((supply_voltage) / (ADC_COUNTS));
-double Irms = I_RATIO * sqrt(sumI / NUMBER_OF_SAMPLES);
-
-//Reset accumulators
-sumI = 0;
 
-return Irms;
+void benchmarkPipeline(PowerData &power, Print &out) {
+	/* Times one sample pair through the per sample path with the DWT cycle counter:
+	the double math this code used to do (counts -> mV -> A and V -> W -> trapezoid) against the fixed point path.
+	Call with the sampler stopped so the ISR doesn't land in the timed loops.
+	*/
+	const uint16_t BENCH_PAIRS = 256;
+	const uint32_t BENCH_DT_CYCLES = F_CPU / SAMPLER_BENCH_RATE_HZ;
+	CurrentData *current = power.getCurrent();
+	VoltageData *voltage = power.getVoltage();
+	// Double path constants, recovered from the fixed point gains
+	const double mV_per_count = (double)ADC_VREF_MV / (double)ADC_FULL_SCALE_COUNTS;
+	const double offset_mV = (double)current->getOffsetCounts() * mV_per_count;
+	const double mV_per_A = mV_per_count * Q32_ONE / (double)current->getGainQ32();
+	const double v_div = (double)voltage->getGainQ32() / Q32_ONE * 1000.0 / mV_per_count;
+	MicroTicker ticker;
+	double last_W = 0;
+	volatile double energy_Wus = 0;
+	uint32_t cycles = 0;
+	uint32_t start = cycleCount();
+	for (uint16_t n = 0; n < BENCH_PAIRS; n++) {
+		const uint16_t i_raw = 20000 + n;
+		const uint16_t v_raw = 40000 - n;
+		const double current_A = ((double)i_raw * mV_per_count - offset_mV) / mV_per_A;
+		const double voltage_V = (double)v_raw * mV_per_count * v_div / 1000.0;
+		const double power_W = current_A * voltage_V;
+		cycles += BENCH_DT_CYCLES;
+		energy_Wus = energy_Wus + 0.5 * (last_W + power_W) * (double)ticker.elapsedUs(cycles);
+		last_W = power_W;
+	}
+	const uint32_t double_cycles = cycleCount() - start;
+	PairIntegrator integrator;
+	cycles = 0;
+	start = cycleCount();
+	for (uint16_t n = 0; n < BENCH_PAIRS; n++) {
+		const uint16_t i_raw = 20000 + n;
+		const uint16_t v_raw = 40000 - n;
+		cycles += BENCH_DT_CYCLES;
+		integrator.addSample(current->rawToQ16(i_raw), voltage->rawToQ16(v_raw), cycles);
+	}
+	const uint32_t fixed_cycles = cycleCount() - start;
+	out.printf("Pipeline cycles/pair: double %lu, fixed %lu (%lu pairs)\n", double_cycles / BENCH_PAIRS, fixed_cycles / BENCH_PAIRS, (uint32_t)BENCH_PAIRS);
+	out.print("Energy check: double ");
+	out.print(energy_Wus / US_PER_HR, 6);
+	out.print(" Wh, fixed ");
+	out.print(integrator.getWattHours(), 6);
+	out.println(" Wh");
 }
-
-*/
\ No newline at end of file
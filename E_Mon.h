@@ -4,43 +4,77 @@
 #define _E_MON_h
 
 #include "broker_data.h"
+#include "sample_ring.h"
+#include "integrator.h"
+#include "fixed_point.h"
+#include "current_sensors.h"
+#include "filters.h"
 #include <ADC_Module.h>
 #include <ADC.h>
 
-enum ACS_MODELS
-	// List of supported ACS7xx current sensors.
-{
-	ACS711_12B,	// -12 to 12 amps
-	ACS711_25B,	// -25 to 25 amps
-	ACS715_20A,	//   0 to 20 amps
-	ACS715_30A,	//   0 to 30 amps
-	ACS722_05B,	//  -5 to  5 amps
-	ACS722_10U,	//   0 to 10 amps
-	ACS722_10B,	// -10 to 10 amps
-	ACS722_20U,	//   0 to 20 amps
-	ACS722_20B,	// -20 to 20 amps
-	ACS722_40U,	//   0 to 40 amps
-	ACS722_40B	// -40 to 40 amps
+#define ADC_RING_SIZE 256 // Raw samples queued per channel between acquire task runs. Must be a power of two.
+
+typedef FilterChain<MedianFilter<FILTER_MAX_MEDIAN>, CICDecimator<FILTER_CIC_ORDER>, IIRLowPass> ChannelFilter;
+
+struct PairSample {
+	// One current and one voltage conversion started by the same PDB trigger on ADC_0 and ADC_1
+	uint16_t	i_raw;
+	uint16_t	v_raw;
 };
 
 /*
 class ADCData is an abstract intermediate class for all data objects which get their data from the Teensy's built in ADC
 Always Read Only
+Raw samples are pushed in by ADCSampler's ISR and consumed in blocks by getADCreading(), so loop() never waits on a conversion.
+Counts become channel units (V or A) with one multiply by _gain_q32 after removing _offset_counts. Derived classes set both.
+Every sample also goes into _stats, one interval per reader, which is reported and restarted each time that reader reports the channel.
+With no filter stage active the reading is the block average. Otherwise every sample runs through _filter
+(median -> CIC decimator -> IIR low pass) and the reading is the latest filter output.
 */
 class ADCData : public DynamicData {
 public:
 	ADCData(const char *name, const char *unit, ADC &adc, uint8_t ADCchannel, uint8_t resp_width, uint8_t resp_dec) : DynamicData(name, unit, true, resp_width, resp_dec) {
 		_channel = ADCchannel; // should be 0-4
 		_adc = &adc;
+		_gain_q32 = 0;
+		_offset_counts = 0;
+		_last_q16 = 0;
+		_block_size = 0;
+		_block_sum = 0;
+		_block_sum_sq = 0;
+		_has_reading = false;
+		_trackMinMax();
 	}
-	uint16_t getADCreading();
+	q16_t	getADCreading();	// Average of the queued block in channel units
 	uint8_t	getChannel() { return _channel; }
 	double	getValue() { return _data_value; }
 	void	setFunction(bool function_value);
+	bool	pushSample(uint16_t raw) { return _ring.push(raw); } // Only called from ADCSampler::isr()
+	q16_t	rawToQ16(uint16_t raw) { return countsToQ16(raw, _offset_counts, _gain_q32); }
+	int32_t	getGainQ32() { return _gain_q32; }
+	int32_t	getOffsetCounts() { return _offset_counts; }
+	bool	hasReading() { return _has_reading; }
+	uint16_t	getBlockSize() { return _block_size; }	// Samples averaged into the last reading
+	double	getBlockMean();	// Unfiltered mean of the last block in channel units
+	double	getBlockStdDev();	// Unfiltered standard deviation of the last block in channel units
+	uint32_t	getOverruns() { return _ring.getOverruns(); }
+	bool	takeStats(StatsSnapshot &stats, uint8_t reader);
+	bool	setParam(const char *param, double value);	// "median", "decimation" or "lowpass"
+	void	paramsToJson(JsonWriter &out);
 protected:
 	ADC	*_adc;
+	int32_t	_gain_q32;	// Channel units per count * 2^32
+	int32_t	_offset_counts;	// Count that reads as 0 units
 private:
 	uint8_t	_channel;	// Analog read pin number
+	SampleRing<uint16_t, ADC_RING_SIZE>	_ring;	// Raw ADC counts from the sampler
+	ChannelStats	_stats[STATS_READERS];	// Since each reader last reported the channel
+	ChannelFilter	_filter;
+	q16_t	_last_q16;	// Most recent block average
+	uint16_t	_block_size;
+	int32_t	_block_sum;	// Offset removed counts in the last block
+	int64_t	_block_sum_sq;
+	bool	_has_reading;	// false until the sampler has delivered at least one sample
 };
 
 /*
@@ -49,8 +83,10 @@ class VoltageData is a class for all data objects which represent a voltage obje
 class VoltageData : public ADCData {
 public:
 	VoltageData(const char *name, ADC &adc, uint8_t ADCchannel, uint32_t high_div, uint32_t low_div, uint8_t resp_width, uint8_t resp_dec) : ADCData(name, "V", adc, ADCchannel, resp_width, resp_dec) {
+		_setKind(KIND_VOLTAGE);
 		_high_div = high_div;
 		_low_div = low_div;
+		_gain_q32 = gainToQ32((double)ADC_VREF_MV / (double)ADC_FULL_SCALE_COUNTS / 1000.0 * _v_div());
 	}
 	double getData();
 	bool	setData(double set_value) { return false; }
@@ -62,61 +98,75 @@ private:
 
 /*
 class CurrentData is a class for all data objects which represent a current object
+Sensor offset and gain come precomputed from CurrentSensor<model, Vcc>::params().
 */
 class CurrentData : public ADCData {
 public:
-	CurrentData(const char *name, ADC &adc, uint8_t ADCchannel, ACS_MODELS model, uint8_t f_pin, uint16_t Vcc_mV, uint8_t resp_width, uint8_t resp_dec) : ADCData(name, "A", adc, ADCchannel,  resp_width, resp_dec) {
-		_model = model;
+	CurrentData(const char *name, ADC &adc, uint8_t ADCchannel, CurrentSensorParams sensor, uint8_t f_pin, uint8_t resp_width, uint8_t resp_dec) : ADCData(name, "A", adc, ADCchannel,  resp_width, resp_dec) {
+		_setKind(KIND_CURRENT);
 		_f_pin = f_pin;
-		_mV_per_A = lookupACSsens(_model);
-		_offset_mV = lookupACSoffset(_model, Vcc_mV);
-		_funct = lookupACSfunction(_model);
+		_funct = sensor.funct;
+		// Vout = (Sensitivity * i + offset), so i = (counts - offset counts) * A per count
+		_offset_counts = sensor.offset_counts;
+		_gain_q32 = sensor.gain_q32;
 		switch (_funct) {
-		case 1:	pinMode(_f_pin, OUTPUT);
+		case SENSOR_FUNCT_BW_SEL:	pinMode(_f_pin, OUTPUT);
 			digitalWrite(_f_pin, HIGH); // Set to 80 kHz
 			break;
-		case 0: pinMode(_f_pin, INPUT); break; // Low = current fault
-		case -1: break; // not used
+		case SENSOR_FUNCT_FAULT: pinMode(_f_pin, INPUT); break; // Low = current fault
+		case SENSOR_FUNCT_NONE: break; // not used
 		}
 	}
 	double	getData();
 	bool	setData(double set_value) { return false; }
 private:
 	int8_t	_f_pin; // Function pin number. <0 is unused.
-	int8_t	_funct; 
-	uint16_t	_mV_per_A;
-	uint16_t	_offset_mV;
-	ACS_MODELS	_model;	//ACS7xx variant
-	uint16_t	lookupACSsens(enum ACS_MODELS);
-	uint16_t	lookupACSoffset(enum ACS_MODELS, uint16_t Vcc_mV);
-	int8_t lookupACSfunction(enum ACS_MODELS);
+	int8_t	_funct; // SENSOR_FUNCT
 };
 
 /*
 class PowerData is a class for all data objects which represent a power object
 Always Read Only
+When the sampler converts _current and _voltage as a synchronized pair, power is the mean of the per pair products
+and every pair is also integrated into _integrator for EnergyData and ChargeData.
+Otherwise it falls back to the product of the latest current and voltage values.
 */
 class PowerData : public DynamicData {
 public:
 	PowerData(const char *name, CurrentData &current, VoltageData &voltage, uint8_t resp_width, uint8_t resp_dec) : DynamicData(name, "W", true, resp_width, resp_dec) {
+		_setKind(KIND_POWER);
+		_trackMinMax();
 		_voltage = &voltage;
 		_current = &current;
+		_paired = false;
 	}
 	double	getData();	// Calculates new Power based on most recent current and voltage
 	bool	setData(double set_value);
 	void	resetData();
 	double	getValue() { return _data_value; }
+	CurrentData	*getCurrent() { return _current; }
+	VoltageData	*getVoltage() { return _voltage; }
+	void	setPaired(bool paired) { _paired = paired; }
+	bool	isPaired() { return _paired; }
+	bool	pushPair(uint16_t i_raw, uint16_t v_raw) { PairSample pair = { i_raw, v_raw }; return _pairs.push(pair); } // Only called from ADCSampler::isr()
+	void	integrate(uint16_t i_raw, uint16_t v_raw, uint32_t cycles) { _integrator.addSample(_current->rawToQ16(i_raw), _voltage->rawToQ16(v_raw), cycles); } // Only called from ADCSampler::isr()
+	PairIntegrator	*getIntegrator() { return &_integrator; }
 private:
 	CurrentData	*_current;
 	VoltageData	*_voltage;
+	SampleRing<PairSample, ADC_RING_SIZE>	_pairs;	// Time aligned raw samples from the sampler
+	PairIntegrator	_integrator;	// Energy and charge, updated per pair
+	bool	_paired;
 };
 
 /*
 class EnergyData is a class for all data objects which represent an energy object
+If _power is paired the total comes from its per sample integrator, otherwise power is assumed constant between calls.
 */
 class EnergyData : public DynamicData {
 public:
 	EnergyData(const char *name, PowerData &power, uint8_t resp_width, uint8_t resp_dec) : DynamicData(name, "Wh", false, resp_width, resp_dec) {
+		_setKind(KIND_ENERGY);
 		_power = &power;
 		_data_value = 0; // STARTS AS 0 AND TOTALIZES.
 	}
@@ -128,8 +178,27 @@ private:
 	PowerData	*_power;
 };
 
+/*
+class ChargeData is a class for all data objects which represent a charge (Ah) object
+Needs a paired PowerData, whose integrator totalizes current along with energy.
+*/
+class ChargeData : public DynamicData {
+public:
+	ChargeData(const char *name, PowerData &power, uint8_t resp_width, uint8_t resp_dec) : DynamicData(name, "Ah", false, resp_width, resp_dec) {
+		_setKind(KIND_CHARGE);
+		_power = &power;
+		_data_value = 0; // STARTS AS 0 AND TOTALIZES.
+	}
+	double getData(); // Reads total charge from the integrator
+	bool	setData(double charge_Ah);	// Used for setting value, usually after reboot.
+	bool	resetData() { return setData(0); }
+	double	getValue() { return _data_value; }
+private:
+	PowerData	*_power;
+};
 
 
-#endif
+// Function prototypes
+void	benchmarkPipeline(PowerData &power, Print &out);
 
-// Function prototypes
\ No newline at end of file
+#endif
\ No newline at end of file
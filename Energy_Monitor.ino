@@ -8,6 +8,8 @@ Channel, function
 3, Vcc (nominal 5v)
 
 Commuincates via JSON-RPC
+A request is handled as soon as its closing brace arrives. A line end drops an unfinished request, and one
+that isn't JSON gets a parse error reply. See json_rpc.h.
 
 Data Values:
 Voltage
@@ -25,8 +27,21 @@ Accepts the following inputs:
 {"method:"set","params":{"Energy_charge":<integer>}}
 where integer will usually be 0 and set at the start of every day.
 {"method:"status","params":{"data":[<list of Data Values]}}
-{"method":list_data,"params",{}} - Returns list of data values with units and type (RO or RW)
+{"method:"status","params":{"data":["Load_Current"],"window":3600}} - Adds min, max and mean over the last hour.
+	The shortest configured window at least that long is used. See window_stats.h.
+{"method":"set","params":{"windows":[60,900,86400]}} - Sets the window lengths in seconds. Clears the windows.
+{"method":"history","params":{"channel":"Load_Power","last_s":3600,"step_s":60}} - Returns readings kept on the
+	monitor, here one mean a minute for the last hour. See processHistory().
+{"method":list_data,"params",{}} - Returns list of data values with id, units and type (RO or RW)
+	Anywhere a data value is named, its id number from list_data can be used instead.
 {"method":"initialize","params":{}} - Resets all counters and min/max values. TYpically called once per day.
+{"method":"capture","params":{"channels":["Load_Current","Voltage"],"samples":2000,"rate_hz":10000}} - Records raw
+	samples and streams them back as binary frames. See capture.h.
+{"method":"trigger","params":{"channel":"Load_Current","mode":"level","high":8.0}} - Arms the transient recorder.
+	Each event is announced with an "event" notification and can be fetched with "event". See transient.h.
+{"method":"config","params":{"def":1,"model":"ACS722_20B"}} - Edits the channel definitions. See processConfig().
+{"method":"set_protocol","params":{"protocol":"cobs"}} - Sends subscription updates as compact binary frames until
+	the host disconnects. See binary_protocol.h, and extras/binary_decode for a decoder.
 
 Expects, but ignores the following methods:
 "subscribe" - We assume everything is subscribed
@@ -37,14 +52,14 @@ Expects, but ignores the following methods:
 "restart", "shutdown" - may not apply in this environment
 "broker_status" - no point
 
-TO DO
-	- Make resistor values setable and store them in EEPROM.
-*/
+Channels, including divider resistors and sensor models, are defined in EEPROM and edited with "config".
+DEFAULT_CHANNELS below is used until a set has been saved.
 
-//#include <RingBufferDMA.h>
-//#include <RingBuffer.h>
+Serial1 carries a binary trace log at LOG_BAUD. Decode it with log_decode.py. Set LOG_LEVEL in the build flags
+to change which messages are compiled in. See trace_log.h.
+*/
 
-#define S1DEBUG 1
+#define EM_BENCH 0	// 1 prints cycle count comparisons of the measurement pipeline, reply formatting and subscription encodings on USB Serial at startup, before any JSON
 #define EM_VERSION 0.76
 
 
@@ -56,17 +71,27 @@ TO DO
 #define V_DIV_LOW	 4220.0
 #define V_DIV_HIGH  19100.0
 #define BROKER_MIN_UPDATE_RATE_MS 2000
-#define MAIN_BUFFER_SIZE 1500
 #define TOKEN_OWN_SIZE 40
 
 
 #include "broker_util.h"
 #include "E_Mon.h"
+#include "adc_sampler.h"
 #include "broker_data.h"
+#include "timebase.h"
+#include "power_save.h"
+#include "scheduler.h"
+#include "capture.h"
+#include "transient.h"
+#include "channel_config.h"
+#include "trace_log.h"
+#include "history.h"
+#include "json_rpc.h"
+#include "json_writer.h"
+#include "tx_queue.h"
 #include <ADC_Module.h>
 #include <ADC.h>
 #include <TimeLib.h>
-#include <aJSON.h>
 
 // define constants
 const uint16_t VCC = 3300; // in mV
@@ -75,43 +100,85 @@ const uint8_t ADC_CHANNEL_CHARGE_CURRENT	= PIN_A1;	// (15) ADC0_SE14
 const uint8_t ADC_CHANNEL_VOLTAGE			= PIN_A2;	// (16) ADC0_SE8/ADC1_SE8
 const int8_t F_PIN_LOAD				= 10;
 const int8_t F_PIN_CHARGE			= 9;
-const uint16_t LOOP_DELAY_TIME_MS = 2000;	// Time in ms to wait between sampling loops.
-const uint8_t BROKERDATA_OBJECTS = 11;
+// Task periods. ADC_RING_SIZE must hold TASK_ACQUIRE_MS of samples at the burst rate, twice over for a late acquire task.
+const uint16_t TASK_RX_MS			= 20;	// USB data also makes this due at once
+const uint16_t TASK_EVENTS_MS		= 10;	// Longest delay before a transient event is announced
+const uint16_t TASK_ACQUIRE_MS		= 50;
+static_assert(2UL * TASK_ACQUIRE_MS * ADAPT_BURST_RATE_HZ / 1000 <= ADC_RING_SIZE, "ADC_RING_SIZE is too small for TASK_ACQUIRE_MS");
+const uint16_t TASK_DERIVE_MS		= 100;
+const uint16_t TASK_CAPTURE_MS		= 10;	// One binary frame per run while streaming
+const uint16_t TASK_SUBSCRIBE_MS	= 100;	// Longest wait. Brought forward to the next subscription deadline.
+const uint16_t TASK_HOUSEKEEP_MS	= 1000;
+const uint16_t TASK_LOG_MS			= 20;	// Serial1 at LOG_BAUD sends about 115 bytes in this time
+const uint16_t TASK_DEFER_MS		= 10;	// Retry interval for a subscription held back by the TX queue
+const uint16_t TX_FLUSH_MS			= 500;	// Longest wait for the reply to go before a restart
+// Largest reply: a verbose status of every channel a config can hold, with a window. A measured channel with its window
+// and stats takes up to 360 bytes, any other up to 140, and the envelope 90. Larger than an event and its frames.
+const uint16_t TX_MEASURED_CHANNELS	= POOL_VOLTAGE + POOL_CURRENT + POOL_POWER;
+const uint16_t TX_REPLY_ROOM		= TX_MEASURED_CHANNELS * 360 + (CONFIG_MAX_DEFS - TX_MEASURED_CHANNELS) * 140 + 90;
+static_assert(WINDOW_SLOTS >= TX_MEASURED_CHANNELS, "Every measured channel a config can hold needs a WindowStats slot");
+static_assert(TX_REPLY_ROOM + CAPTURE_FRAME_BYTES <= TX_CHUNKS * TX_CHUNK_SIZE, "TX queue can't hold the largest reply and a capture frame");
 const char TZ[] = "UTC"; // Time zone is forced to UTC for now.
 
 // Define Objects
 ADC adc = ADC(); // Teensy adc object
+ADCSampler sampler(adc); // Keeps the adc converting in the background
+BurstCapture capture(sampler); // Waveform capture on request
+TransientRecorder recorder; // Catches overcurrent and other transients by itself
+IdleManager idle; // Sleeps the core between loops
+Scheduler scheduler; // Runs the loop() tasks
+TxQueue txQueue(TX_REPLY_ROOM); // Everything sent to the host waits here for the USB port
+int8_t task_rx, task_subscribe;
+
+AdaptiveRate	adaptive_rate(sampler); // Watches the current named by the sample rate definition
+HistoryStore	history; // Recent readings of a few channels, kept while the host is away
 
-// Someday we might load all this from EEPROM so that the code can be as generic as possible.
-StaticData	volt_div_low("V_div_low", "Ohms", V_DIV_LOW,7,2);
-StaticData	volt_div_high("V_div_high", "Ohms", V_DIV_HIGH,7,2);
-VoltageData v_batt("Voltage", adc, ADC_CHANNEL_VOLTAGE, volt_div_high.getValue(), volt_div_low.getValue(),6,3);
-CurrentData	current_l("Load_Current", adc, ADC_CHANNEL_LOAD_CURRENT, ACS722_10U, F_PIN_LOAD, VCC,6,3);
-CurrentData	current_c("Charge_Current", adc, ADC_CHANNEL_CHARGE_CURRENT, ACS711_25B, F_PIN_CHARGE, VCC,6,3);
-PowerData	power_l("Load_Power", current_l, v_batt,7,3);
-PowerData	power_c("Charge_Power", current_c, v_batt,7,3);
-EnergyData	energy_l("Load_Energy", power_l,10,3);
-EnergyData	energy_c("Charge_Energy", power_c,10,3);
-TimeData	date_sys("Date_UTC",true,8,0);
-TimeData	time_sys("Time_UTC",false,6,0);
-// Now an array to hold above objects as their base class.
-BrokerData *brokerobjs[BROKERDATA_OBJECTS];
+// Channels used until a set is saved in EEPROM. Each takes the next channel in the ChannelTable, so this is also the
+// order they are listed and updated in. src and src_v are indexes into this list.
+const uint8_t NO_SRC = CONFIG_NO_SRC;
+const ChannelDef DEFAULT_CHANNELS[] = {
+	//type			name				width	dec	pin							model		f_pin			src		src_v	value		value_low	unit
+	{ DEF_VOLTAGE,	"Voltage",			6,	3,	ADC_CHANNEL_VOLTAGE,		0,			-1,				NO_SRC,	NO_SRC,	V_DIV_HIGH,	V_DIV_LOW,	"" },
+	{ DEF_CURRENT,	"Load_Current",		6,	3,	ADC_CHANNEL_LOAD_CURRENT,	ACS722_10U,	F_PIN_LOAD,		NO_SRC,	NO_SRC,	0,			0,			"" },
+	{ DEF_CURRENT,	"Charge_Current",	6,	3,	ADC_CHANNEL_CHARGE_CURRENT,	ACS711_25B,	F_PIN_CHARGE,	NO_SRC,	NO_SRC,	0,			0,			"" },
+	{ DEF_POWER,	"Load_Power",		7,	3,	0,							0,			-1,				1,		0,		0,			0,			"" },
+	{ DEF_POWER,	"Charge_Power",		7,	3,	0,							0,			-1,				2,		0,		0,			0,			"" },
+	{ DEF_ENERGY,	"Load_Energy",		10,	3,	0,							0,			-1,				3,		NO_SRC,	0,			0,			"" },
+	{ DEF_ENERGY,	"Charge_Energy",	10,	3,	0,							0,			-1,				4,		NO_SRC,	0,			0,			"" },
+	{ DEF_STATIC,	"V_div_low",		7,	2,	0,							0,			-1,				NO_SRC,	NO_SRC,	V_DIV_LOW,	0,			"Ohms" },
+	{ DEF_STATIC,	"V_div_high",		7,	2,	0,							0,			-1,				NO_SRC,	NO_SRC,	V_DIV_HIGH,	0,			"Ohms" },
+	{ DEF_DATE,		"Date_UTC",			8,	0,	0,							0,			-1,				NO_SRC,	NO_SRC,	0,			0,			"" },
+	{ DEF_TIME,		"Time_UTC",			6,	0,	0,							0,			-1,				NO_SRC,	NO_SRC,	0,			0,			"" },
+	{ DEF_SAMPLE_RATE,	"Sample_Rate",	5,	0,	0,							0,			-1,				1,		NO_SRC,	0,			0,			"" },	// Load current transients speed up sampling
+	{ DEF_CHARGE,	"Load_Ah",			10,	4,	0,							0,			-1,				3,		NO_SRC,	0,			0,			"" },
+	{ DEF_CHARGE,	"Charge_Ah",		10,	4,	0,							0,			-1,				4,		NO_SRC,	0,			0,			"" },
+};
+ChannelConfig	config(adc, sampler, adaptive_rate, VCC, DEFAULT_CHANNELS, sizeof(DEFAULT_CHANNELS) / sizeof(DEFAULT_CHANNELS[0]));
+
+// The Teensy 3.2 has 64 kB of RAM. About 16 kB is left for the stack, which holds a MAIN_BUFFER_SIZE reply buffer
+// while some requests are handled, the USB buffers and the core libraries. The rest is the budget for the large static
+// objects: channel objects 8.9 kB (mostly their ADC_RING_SIZE rings), capture 8.3 kB, history 8.2 kB, TX queue 6 kB,
+// transient slots 4.6 kB, channel table 4 kB, window stats 4.7 kB, the trace log 1 kB, and the function statics: taskRx's
+// request buffer and its tokens 2.3 kB and processSubscriptions' binary frame 0.5 kB. About 48 kB in all.
+const uint32_t RAM_STATIC_BUDGET = 48UL * 1024;
+static_assert(sizeof(config) + sizeof(capture) + sizeof(txQueue) + sizeof(recorder) + sizeof(history) + sizeof(channels) + sizeof(windows)
+	+ sizeof(traceLog) + sizeof(sampler) + sizeof(adaptive_rate) + MAIN_BUFFER_SIZE + sizeof(JsonMessage) + BIN_MAX_FRAME <= RAM_STATIC_BUDGET,
+	"Static buffers are over RAM_STATIC_BUDGET");
 
 
 // Global variables
 int16_t	json_id = 0;
 bool status_verbose = true; // true is default.
-bool data_map[BROKERDATA_OBJECTS]; // Used to mark broker objects we are interested in.
+int8_t status_window = -1; // WindowStats window to add to status, -1 for none
+bool data_map[CHANNEL_TABLE_SIZE]; // Used to mark broker objects we are interested in.
 char broker_start_time[] = "20000101120000"; // Holds start time
-char in_buffer[MAIN_BUFFER_SIZE]; // Holds incoming data
-uint16_t	in_buffer_idx = 0;
 char token_owner[TOKEN_OWN_SIZE]; // Holds current Token owner
 
 // Constants
 const char ON_NEW[] = "on_new";
 const char ON_CHANGE[] = "on_change";
 
-const uint8_t JSON_REQUEST_COUNT = 12; // How many different request types are there.
+const uint8_t JSON_REQUEST_COUNT = 18; // How many different request types are there.
 enum json_r_t {
 	BROKER_STATUS = 0,
 	BROKER_SUBSCRIBE = 1,
@@ -124,9 +191,24 @@ enum json_r_t {
 	BROKER_TOK_FACK = 8,
 	BROKER_TOK_REL = 9,
 	BROKER_TOK_OWN = 10,
-	BROKER_ERROR = 11
+	BROKER_CAPTURE = 11,
+	BROKER_TRIGGER = 12,
+	BROKER_EVENT = 13,
+	BROKER_CONFIG = 14,
+	BROKER_HISTORY = 15,
+	BROKER_SET_PROTOCOL = 16,
+	BROKER_ERROR = 17
+};
+const char *REQUEST_STRINGS[JSON_REQUEST_COUNT] = { "status","subscribe","unsubscribe","set","list_data","reset","broker_status","tokenAcquire","tokenForceAcquire","tokenRelease","tokenOwner","capture","trigger","event","config","history","set_protocol",""};
+
+// Encodings for subscription updates. Replies are always JSON.
+const uint8_t PROTOCOL_COUNT = 2;
+enum protocol_t {
+	PROTOCOL_JSON = 0,
+	PROTOCOL_COBS = 1	// COBS framed binary. See binary_protocol.h.
 };
-const char *REQUEST_STRINGS[JSON_REQUEST_COUNT] = { "status","subscribe","unsubscribe","set","list_data","reset","broker_status","tokenAcquire","tokenForceAcquire","tokenRelease","tokenOwner",""};
+const char *PROTOCOL_STRINGS[PROTOCOL_COUNT] = { "json","cobs" };
+uint8_t protocol = PROTOCOL_JSON; // Subscription encoding for this session. Back to JSON when the host disconnects.
 
 #ifdef __cplusplus
 extern "C" {
@@ -146,7 +228,7 @@ void setup() {
 	// set the Time library to use Teensy 3.0's RTC to keep time
 	setSyncProvider(getTeensy3Time);
 	Serial.begin(57600);	//USB
-	if (S1DEBUG) Serial1.begin(57600);
+	if (LOG_LEVEL > LOG_LEVEL_NONE) Serial1.begin(LOG_BAUD); // Binary trace log. See log_decode.py.
 	// Some delay when starting up serial.
 	uint32_t ulngStart = millis();
 	while (true) {
@@ -155,209 +237,180 @@ void setup() {
 		delay(100);
 		if (ulngDiff > 5000) break;
 	}
-	if (S1DEBUG) {
-		Serial1.print("UNC-IMS Power Monitor "); Serial1.println(EM_VERSION);
-		Serial.print("UNC-IMS Power Monitor "); Serial.println(EM_VERSION);
-		WatchdogReset();
-		Serial1.print("Reading charge current on pin:"); Serial1.println(ADC_CHANNEL_CHARGE_CURRENT);
-		Serial1.print("Reading load current on pin: "); Serial1.println(ADC_CHANNEL_LOAD_CURRENT);
-		Serial1.print("Reading voltage current on pin: "); Serial1.println(ADC_CHANNEL_VOLTAGE);
-	}
-	//Set up Analog input pins
-	pinMode(ADC_CHANNEL_CHARGE_CURRENT, INPUT);
-	pinMode(ADC_CHANNEL_LOAD_CURRENT, INPUT);
-	pinMode(ADC_CHANNEL_VOLTAGE, INPUT);
+	Serial.print("UNC-IMS Power Monitor "); Serial.println(EM_VERSION);
+	LOG(LOG_BOOT, logFloat(EM_VERSION));
+	WatchdogReset();
 	pinMode(LED_BUILTIN, OUTPUT); // May use this
+	timebaseBegin(); // Cycle counter timestamps every sample pair for integration
+	// Both ADCs need identical settings so paired conversions finish together.
 	adc.setReference(ADC_REFERENCE::REF_3V3, ADC_0);
-	adc.setAveraging(16); //Set the number of averages. Can be 0, 4, 8, 16 or 32.
-	adc.setResolution(16); //the number of bits of resolution. For single-ended measurements: 8, 10, 12 or 16 bits.
-	adc.setConversionSpeed(ADC_CONVERSION_SPEED::HIGH_SPEED_16BITS); // change the conversion speed
-	adc.setSamplingSpeed(ADC_SAMPLING_SPEED::MED_SPEED); // change the sampling speed
+	adc.setAveraging(SAMPLER_HW_AVERAGING, ADC_0); //Set the number of averages. Can be 0, 4, 8, 16 or 32.
+	adc.setResolution(ADC_RESOLUTION_BITS, ADC_0); //the number of bits of resolution. For single-ended measurements: 8, 10, 12 or 16 bits.
+	adc.setConversionSpeed(ADC_CONVERSION_SPEED::HIGH_SPEED_16BITS, ADC_0); // change the conversion speed
+	adc.setSamplingSpeed(ADC_SAMPLING_SPEED::MED_SPEED, ADC_0); // change the sampling speed
+	adc.setReference(ADC_REFERENCE::REF_3V3, ADC_1);
+	adc.setAveraging(SAMPLER_HW_AVERAGING, ADC_1);
+	adc.setResolution(ADC_RESOLUTION_BITS, ADC_1);
+	adc.setConversionSpeed(ADC_CONVERSION_SPEED::HIGH_SPEED_16BITS, ADC_1);
+	adc.setSamplingSpeed(ADC_SAMPLING_SPEED::MED_SPEED, ADC_1);
+	// Create the channels. Each power pairs its current on ADC_0 with its voltage on ADC_1, converted at the same instant.
+	const bool from_eeprom = config.load();
+	if (!config.build()) LOG(LOG_CHANNELS_UNSAMPLED);
+	channels.attachWindows(); // Rolling min, max and mean for measured channels
+	if (config.getVoltage(0)) history.record(config.getVoltage(0)->getIndex());
+	if (config.getPower(0)) history.record(config.getPower(0)->getIndex());
+	LOG(LOG_CHANNELS, config.getDefCount(), from_eeprom);
+	// Start continuous sampling
+	sampler.attachCapture(capture);
+	sampler.addTap(recorder);
+	// Text, so not on Serial1 with the binary trace log. The host reads no JSON until setup() is done.
+	if (EM_BENCH && config.getPower(0)) benchmarkPipeline(*config.getPower(0), Serial);
+	if (EM_BENCH) benchmarkJsonWriter(Serial);
+	if (EM_BENCH) benchmarkProtocols(Serial, TZ);
+	if (!sampler.begin(SAMPLER_DEFAULT_RATE_HZ)) LOG(LOG_SAMPLER_FAIL);
 	WatchdogReset();
-	if (timeStatus() != timeSet) {
-		if (S1DEBUG)  Serial1.println("Unable to sync with the RTC");
-	}
+	if (timeStatus() != timeSet) LOG(LOG_RTC_UNSYNCED);
 	else {
-		// NEED TO SET Date_UTS and Time_UTC here.
-		double date_to_set = (year() * 10000) + (month() * 100) + day();
-		date_sys.setData(date_to_set);
-		date_to_set = (hour() * 10000) + (minute() * 100) + second();
-		time_sys.setData(date_to_set);
-		if (S1DEBUG) {
-			Serial1.println("RTC has set the system time to:");
-			Serial1.print(date_sys.getData()); Serial1.print("    ");
-			Serial1.print(time_sys.getData()); Serial1.println();
-		}
+		channels.updateKinds(KIND_MASK(KIND_TIME)); // Date and time channels
+		LOG(LOG_RTC_TIME, (year() * 10000UL) + (month() * 100) + day(), (hour() * 10000UL) + (minute() * 100) + second());
 	}
-	// Add parameter objects to brokerobjs[]
-	brokerobjs[0] = &v_batt;
-	brokerobjs[1] = &current_l;
-	brokerobjs[2] = &current_c;
-	brokerobjs[3] = &power_l;
-	brokerobjs[4] = &power_c;
-	brokerobjs[5] = &energy_l;
-	brokerobjs[6] = &energy_c;
-	brokerobjs[7] = &volt_div_low;
-	brokerobjs[8] = &volt_div_high;
-	brokerobjs[9] = &date_sys;
-	brokerobjs[10] = &time_sys;
-	if (S1DEBUG) Serial1.println("setup almost done");
+	// Tasks, most urgent first
+	task_rx = scheduler.addTask("rx", taskRx, TASK_RX_MS, 0);
+	scheduler.addTask("events", taskEvents, TASK_EVENTS_MS, 1);
+	scheduler.addTask("acquire", taskAcquire, TASK_ACQUIRE_MS, 2);
+	scheduler.addTask("derive", taskDerive, TASK_DERIVE_MS, 3);
+	scheduler.addTask("capture", taskCapture, TASK_CAPTURE_MS, 4);
+	task_subscribe = scheduler.addTask("subscribe", taskSubscribe, TASK_SUBSCRIBE_MS, 5);
+	scheduler.addTask("housekeep", taskHousekeep, TASK_HOUSEKEEP_MS, 6);
+	if (LOG_LEVEL > LOG_LEVEL_NONE) scheduler.addTask("log", taskLog, TASK_LOG_MS, 7);
 	setSampleTimeStr(broker_start_time);
-	if (S1DEBUG) Serial1.println("setup done");
+	LOG(LOG_SETUP_DONE);
 	WatchdogReset();
 }
 
 void loop()
 {
-	static char in_buffer[MAIN_BUFFER_SIZE]; // Holds incoming data
-	static uint16_t	in_buffer_idx = 0;
-	static int16_t bracket_count = 0; // Keep track of JSON brackets. Beware brackets in quotes.
 	WatchdogReset();
-	// Process incoming messages
-	if (processInput(in_buffer, in_buffer_idx, bracket_count)) {
-		aJsonObject *serial_msg = aJson.parse(in_buffer);
-		processJson(serial_msg);
-		in_buffer_idx = 0;
-		bracket_count = 0;
+	txQueue.drain(Serial); // Every pass. SysTick wakes the core at least once a millisecond.
+	if (Serial.available() && txQueue.hasRoom(TX_REPLY_ROOM)) scheduler.trigger(task_rx);
+	// One task per pass so a pending request never waits behind more than one task
+	if (!scheduler.runNext()) {
+		// Sleep until the next task is due or USB data arrives. Only to the next tick while output waits to be drained.
+		const uint32_t sleep_ms = txQueue.isEmpty() ? scheduler.msUntilNext() : min(scheduler.msUntilNext(), (uint32_t)1);
+		idle.sleepUntil(millis() + sleep_ms, txQueue.hasRoom(TX_REPLY_ROOM));
 	}
-	WatchdogReset();
-	// Retreive new data from RTC
-	date_sys.getData();
-	time_sys.getData();
-	// Retreive new data from ADC
-	v_batt.getData();
-	current_l.getData();
-	current_c.getData();
-	// Integrate new values
-	power_l.getData();
-	power_c.getData();
-	energy_l.getData();
-	energy_c.getData();
-	WatchdogReset();
-	// See what subscriptions are up
-	if (checkSubscriptions(data_map, brokerobjs, BROKERDATA_OBJECTS) > 0) {
-		processSubscriptions(data_map, brokerobjs, BROKERDATA_OBJECTS);
+}
+
+void taskRx() {
+	// Feeds received bytes to the tokenizer, which handles each request as soon as its closing brace arrives
+	static char in_buffer[MAIN_BUFFER_SIZE]; // Holds incoming data. serial_msg's tokens point into it.
+	static JsonMessage serial_msg(in_buffer, MAIN_BUFFER_SIZE);
+	// Requests wait in the USB receive buffer until their reply is sure of room
+	while (Serial.available() && txQueue.hasRoom(TX_REPLY_ROOM)) {
+		const uint8_t rx_state = serial_msg.feed(Serial.read());
+		if (rx_state == JSON_RX_MORE) continue;
+		if (rx_state == JSON_RX_COMPLETE) LOG(LOG_RX, serial_msg.getLength());
+		else LOG(LOG_RX_ERROR);
+		processJson(serial_msg, rx_state == JSON_RX_COMPLETE);
+		break; // One request per run. loop() runs this again while bytes are waiting.
 	}
-	WatchdogReset();
-	delay(LOOP_DELAY_TIME_MS); // MAY BE WORTH LOOKING IN TO LOWERING POWER CONSUMPTION HERE
 }
 
-void processSubscriptions(const bool datamap[], BrokerData *broker_objs[], const uint8_t broker_obj_count) {
-	/* Based on settings in data_map, generates a subscrition message
-	Currently uses aJson to generate message, but this may be un-necessary
-	*/
+void taskEvents() {
+	// Announces transients frozen by the recorder
+	if (!txQueue.hasRoom(TX_REPLY_ROOM)) return;
+	txQueue.begin(TX_RESPONSE);
+	recorder.service(txQueue);
+	txQueue.end();
+}
 
-	char out_buffer[MAIN_BUFFER_SIZE]; // Holds outgoing data
-	uint16_t out_buffer_idx = 0;
-	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "{\"method\":\"subscription\",");
-	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"params\":{");
-	bool first = true;
-	for (uint8_t obj_no = 0; obj_no < broker_obj_count; obj_no++) {
-		if (datamap[obj_no] == true) {
-			broker_objs[obj_no]->getData(); // Update values
-			char dataStr[20];	// HOLDS A STRING REPRESENTING A SINGLE VALUE
-			if (!first) out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",");
-			else first = false;
-			out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"%s\":{", broker_objs[obj_no]->getName());
-			broker_objs[obj_no]->dataToStr(dataStr);
-			out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"value\":%s", dataStr);
-			if (broker_objs[obj_no]->isVerbose()) {
-				out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"units\":\"%s\"", broker_objs[obj_no]->getUnit());
-				// Only report min and max if they exist
-				double min_d = broker_objs[obj_no]->getMin();
-				double max_d = broker_objs[obj_no]->getMax();
-				if (min_d == min_d) out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"min\":\"%f\"", min_d);
-				if (max_d == max_d) out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"max\":\"%f\"", max_d);
-				out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"sample_time\":\"%s\"", broker_objs[obj_no]->getSplTimeStr());
-			}
-			out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "}"); // Close out this parameter
-		}
+void taskAcquire() {
+	// Retreive new data queued by the ADC sampler
+	channels.updateKinds(KIND_MASK(KIND_VOLTAGE) | KIND_MASK(KIND_CURRENT));
+	adaptive_rate.update();
+}
+
+void taskDerive() {
+	// Integrate new values
+	channels.updateKinds(KIND_MASK(KIND_POWER) | KIND_MASK(KIND_ENERGY) | KIND_MASK(KIND_CHARGE));
+}
+
+void taskCapture() {
+	// Restores the sample rate and streams the buffer once a capture finishes. Frames wait for room in the TX queue.
+	if (!txQueue.hasRoom(TX_REPLY_ROOM + CAPTURE_FRAME_BYTES)) return;
+	txQueue.begin(TX_RESPONSE);
+	capture.service(txQueue);
+	txQueue.end();
+}
+
+void taskSubscribe() {
+	// See what subscriptions are up
+	if (!txQueue.begin(TX_PUBLISH)) {
+		// The last one hasn't gone yet. Channels stay due and go out together in the next.
+		scheduler.setNextRun(task_subscribe, TASK_DEFER_MS);
+		return;
 	}
-	out_buffer_idx = addMsgTime(out_buffer, out_buffer_idx, ::TZ,false);
-	Serial.println(out_buffer);
-	if (S1DEBUG) {
-		Serial1.print(out_buffer_idx);
-		Serial1.print(" - ");
-		Serial1.println(out_buffer);
+	if (channels.checkSubscriptions(data_map) > 0) {
+		processSubscriptions(data_map);
 	}
-	//printFreeRam("pSub end");
+	txQueue.end();
+	scheduler.setNextRun(task_subscribe, channels.msUntilNextDue());
+}
+
+void taskHousekeep() {
+	// Retreive new data from RTC
+	channels.updateKinds(KIND_MASK(KIND_TIME));
+	if (!Serial.dtr()) protocol = PROTOCOL_JSON; // A new session starts as JSON
+	history.sample(); // Once a second
+}
+
+void taskLog() {
+	// Sends whatever the UART can take without blocking
+	traceLog.drain(Serial1);
+}
+
+void rtc_seconds_isr() {
+	// Once per RTC second. Keeps timestamps in step with the RTC.
+	rtcSecondEdge();
+}
+
+void adc0_isr() {
+	// ADC_0 conversion complete. Triggered by the PDB through ADCSampler.
+	sampler.isr();
 }
 
-bool processInput(char in_buffer[], uint16_t &in_buffer_idx, int16_t &b_count) {
-	/* Adds characters to in_buffer, increments in_buffer_idx, and keeps track of curly brackets
-	returns true if complete message found. Message is complete when:
-		-found } and bracket count == 0
-		-found CR or LF and in_buffer_idx is > 0 
+void processSubscriptions(const bool datamap[]) {
+	/* Based on settings in data_map, generates a subscrition message, as JSON or as a binary frame if set_protocol asked for one
 	*/
-	bool found_msg_end = false;
-	while (Serial.available() && found_msg_end == false) {
-		char in_char = Serial.read();
-		/*
-		switch (in_char) {
-			case '{':
-				b_count++;
-				in_buffer[in_buffer_idx] = in_char;
-				in_buffer_idx++;
-				break;
-			case '}':
-				b_count--;
-				in_buffer[in_buffer_idx] = in_char;
-				in_buffer_idx++;
-				if ( b_count == 0 ) found_msg_end = true;
-				break;
-			case '\r': // Pass through
-			case '\n':
-				if (in_buffer_idx > 0) found_msg_end = true;
-				break;
-			default:
-				in_buffer[in_buffer_idx] = in_char;
-				in_buffer_idx++;
-		}
-		*/
-		if (in_char == '{') b_count++;
-		if (in_char == '}') {
-			b_count--;
-			if (b_count == 0) found_msg_end = true;
-		}
-		if (in_char == '\r' || in_char == '\n') {
-			if (in_buffer_idx > 0 ) found_msg_end = true;
-			// Don't add CR of LF to in_buffer
-		}
-		else if (in_char) {
-			in_buffer[in_buffer_idx] = in_char;
-			in_buffer_idx++;
-			in_buffer[in_buffer_idx] = 0; // So we end with a null
-		}
+	for (uint8_t obj_no = 0; obj_no < ::channels.getCount(); obj_no++) {
+		if (datamap[obj_no] == true) ::channels.update(obj_no); // Update values
 	}
-	if (found_msg_end ) {
-		if (b_count != 0) {
-			// This is an error
-			if (S1DEBUG) Serial1.println("Error: Bracket Mismatch");
-			in_buffer_idx = 0;
-			b_count = 0;
-			found_msg_end = false;
-		}
-		else if (S1DEBUG) {
-			Serial1.print("Found JSON message:");
-			Serial1.println(in_buffer);
-		}
+	if (::protocol == PROTOCOL_COBS) {
+		static uint8_t frame[BIN_MAX_FRAME]; // Kept off the stack
+		const uint16_t frame_len = subscriptionToFrame(frame, datamap);
+		txQueue.write(frame, frame_len);
+		LOG(LOG_PUBLISH, frame_len);
+		return;
 	}
-	return found_msg_end;
+	char out_buffer[JSON_WRITER_CHUNK]; // Goes to the TX queue as it fills
+	JsonWriter out(out_buffer, sizeof(out_buffer), &txQueue);
+	subscriptionToJson(out, datamap, ::TZ);
+	LOG(LOG_PUBLISH, out.send());
+	//printFreeRam("pSub end");
 }
 
-void processJson(aJsonObject *serial_msg) {
-	/* processes JSON message in serial_msg*/
-	if (serial_msg != NULL) {
-		char *aJsonPtr = aJson.print(serial_msg);
-		free(aJsonPtr); // So we don't have a memory leak
-		// DEBUG END
+void processJson(JsonMessage &serial_msg, const bool parsed) {
+	/* processes JSON message in serial_msg, tokenized in place in the receive buffer. parsed is false if it wasn't JSON.
+	Everything the handler prints to txQueue is queued as one message.*/
+	txQueue.begin(TX_RESPONSE);
+	if (parsed) {
 		uint8_t message_type;
-		message_type = getMessageType(&serial_msg, &json_id, ::JSON_REQUEST_COUNT);
+		message_type = getMessageType(serial_msg, &json_id, ::JSON_REQUEST_COUNT);
 		//printFreeRam("pSer gMT");
 		//printFreeRam("pSer 1");
 		switch (message_type) {
 			case (BROKER_STATUS): // Get status of items listed in jsonrpc_params
-				if (processStatus(serial_msg, &::status_verbose, ::brokerobjs, BROKERDATA_OBJECTS)) {
+				if (processStatus(serial_msg, &::status_verbose)) {
 					//printFreeRam("pSer status");
 					generateStatusMessage();
 				}
@@ -393,89 +446,100 @@ void processJson(aJsonObject *serial_msg) {
 			case (BROKER_TOK_OWN):
 				processBrokerTokenOwn();
 				break;
+			case (BROKER_CAPTURE):
+				processCapture(serial_msg);
+				break;
+			case (BROKER_TRIGGER):
+				processTrigger(serial_msg);
+				break;
+			case (BROKER_EVENT):
+				processEvent(serial_msg);
+				break;
+			case (BROKER_CONFIG):
+				processConfig(serial_msg);
+				break;
+			case (BROKER_HISTORY):
+				processHistory(serial_msg);
+				break;
+			case (BROKER_SET_PROTOCOL):
+				processSetProtocol(serial_msg);
+				break;
 
 
 			default:
 				// NEED TO GENERATE AN ERROR HERE
-				if (S1DEBUG) {
-					Serial1.print(F("ERROR. Cant process: "));
-					Serial1.println(message_type);
-				}
+				LOG(LOG_BAD_REQUEST, message_type);
 				break;
 		}
 	}
 	else {
-		aJsonObject *response = aJson.createObject();
-		aJsonObject *error = aJson.createObject();
-		aJson.addItemToObject(response, "jsonrpc", aJson.createItem("2.0"));
-		aJson.addItemToObject(response, "id", aJson.createNull());
-		aJson.addItemToObject(error, "code", aJson.createItem(-32700));
-		aJson.addItemToObject(error, "message", aJson.createItem("Parse error."));
-		aJson.addItemToObject(response, "error", error);
-		aJson.deleteItem(error);
-		aJson.deleteItem(response);
+		// Not JSON, or more tokens than JSON_MAX_TOKENS
+		char out_buffer[80];
+		uint16_t out_buffer_idx = sprintf(out_buffer, "{\"jsonrpc\":\"2.0\",\"error\":{\"code\":-32700,\"message\":\"Parse error.\"},\"id\":null}");
+		txQueue.println(out_buffer);
+		LOG(LOG_RESPONSE, -1, out_buffer_idx);
 	}
-	//printFreeRam("pSer near end 3");
-	if (serial_msg) {
-		//Serial1.println(F("Deleting serial_msg"));
-		aJson.deleteItem(serial_msg); // done with incoming message
+	txQueue.end();
+	if (txQueue.wasDropped() && txQueue.begin(TX_RESPONSE)) {
+		// The reply didn't fit. A short error instead, so the client isn't left waiting for it.
+		char out_buffer[100];
+		uint16_t out_buffer_idx = sprintf(out_buffer, "{\"jsonrpc\":\"2.0\",\"error\":{\"code\":-32000,\"message\":\"Reply dropped, TX queue full.\"},\"id\":%d}", ::json_id);
+		txQueue.println(out_buffer);
+		txQueue.end();
+		LOG(LOG_RESPONSE, ::json_id, out_buffer_idx);
 	}
 }
 
-uint16_t getMessageType(aJsonObject** json_in_msg,int16_t * json_id, const uint8_t json_req_count) {
+uint16_t getMessageType(JsonMessage &msg, int16_t * json_id, const uint8_t json_req_count) {
 	// Extract method and ID from message.
 	uint8_t json_method = BROKER_ERROR;
-	aJsonObject *jsonrpc_method = aJson.getObjectItem(*json_in_msg, "method");
-	for (uint8_t j_method = 0; j_method < json_req_count; j_method++) {
-		if (!strcmp(jsonrpc_method->valuestring, ::REQUEST_STRINGS[j_method])) {
-			if (S1DEBUG) {
-				Serial1.print(F("JSON request: ")); Serial1.println(REQUEST_STRINGS[j_method]);
-			}
+	const char *jsonrpc_method = msg.getMethod();
+	for (uint8_t j_method = 0; jsonrpc_method && j_method < json_req_count; j_method++) {
+		if (!strcmp(jsonrpc_method, ::REQUEST_STRINGS[j_method])) {
 			json_method = j_method;
 			break;
 		}
 	}
 	// Get ID here
-	aJsonObject *jsonrpc_id = aJson.getObjectItem(*json_in_msg, "id");
-	*json_id = jsonrpc_id->valueint;
+	*json_id = (int16_t)msg.getId();
+	LOG(LOG_REQUEST, json_method, *json_id);
 	return json_method;
 }
 
-uint8_t processStatus(aJsonObject *json_in_msg,bool * statusverbose, BrokerData *broker_objs[], const uint8_t broker_obj_count) {
+uint8_t processStatus(JsonMessage &msg,bool * statusverbose) {
 	//printFreeRam("pBS start");
 	uint8_t status_matches_found = 0;
 	// get params which will contain data and style
 	// First process style
-	aJsonObject *jsonrpc_params = aJson.getObjectItem(json_in_msg, "params");
+	int16_t jsonrpc_params = msg.getParams();
 	// Extract Style from params
-	aJsonObject *jsonrpc_style = aJson.getObjectItem(jsonrpc_params, "style");
-	if (!strcmp(jsonrpc_style->valuestring, "terse")) *statusverbose = false;
+	int16_t jsonrpc_style = msg.getItem(jsonrpc_params, "style");
+	if (msg.isString(jsonrpc_style, "terse")) *statusverbose = false;
 	else *statusverbose = true;
+	// Optional window, in seconds
+	int16_t jsonrpc_window = msg.getItem(jsonrpc_params, "window");
+	const double window_s = msg.getNumber(jsonrpc_window, -1);
+	::status_window = (window_s > 0) ? ::windows.findWindow((uint32_t)window_s) : -1;
 	clearDataMap(); // Sets all data_map array values to false
 	// Now Extract data list
-	aJsonObject *jsonrpc_data = aJson.getObjectItem(jsonrpc_params, "data");
+	int16_t jsonrpc_data = msg.getItem(jsonrpc_params, "data");
 	// data will be list of parameters: ["Voltage","Vcc",Current_Load"]
 	// Now parse data list and set data_map array values
-	aJsonObject *jsonrpc_data_item = jsonrpc_data->child;
-	//Serial1.print(jsonrpc_data_item->valuestring);
+	int16_t jsonrpc_data_item = msg.getChild(jsonrpc_data);
+	//Serial1.print(msg.getString(jsonrpc_data_item));
 	//printFreeRam("pBS data 1");
-	while (jsonrpc_data_item) { 
-		for (uint8_t broker_data_idx = 0; broker_data_idx < BROKERDATA_OBJECTS; broker_data_idx++) {
-			//Serial1.print("Comparing "); Serial1.print(jsonrpc_data_item->valuestring); Serial1.print(" to "); Serial1.println(brokerobjs[broker_data_idx]->getName());
-			if (!strcmp(jsonrpc_data_item->valuestring, broker_objs[broker_data_idx]->getName())) {
-				//Serial1.print(F("B data: ")); Serial1.println(jsonrpc_data_item->valuestring);
-				::data_map[broker_data_idx] = true; 
-				//Serial1.print(broker_data_idx); Serial1.print("="); Serial1.println(::data_map[broker_data_idx]);
-				status_matches_found++;
-				break; // break out of for loop
-			}
+	while (jsonrpc_data_item >= 0) { 
+		int8_t broker_data_idx = findChannel(msg, jsonrpc_data_item);
+		if (broker_data_idx >= 0) {
+			::data_map[broker_data_idx] = true; 
+			status_matches_found++;
 		}
-		jsonrpc_data_item = jsonrpc_data_item->next; // Set pointer for jsonrpc_data_item to next item.
+		jsonrpc_data_item = msg.getNext(jsonrpc_data_item); // Set pointer for jsonrpc_data_item to next item.
 	}
 	return status_matches_found;
 }
 
-uint8_t processBrokerUnubscribe(aJsonObject *json_in_msg) {
+uint8_t processBrokerUnubscribe(JsonMessage &msg) {
 	/*Processes an un-subscribe message
 	For example:
 	{"method" : "unsubscribe",
@@ -484,52 +548,41 @@ uint8_t processBrokerUnubscribe(aJsonObject *json_in_msg) {
 	*/
 
 	uint8_t unsubscribe_matches_found = 0;
-	aJsonObject *jsonrpc_params = aJson.getObjectItem(json_in_msg, "params");
+	int16_t jsonrpc_params = msg.getParams();
 	// Now Extract data list
-	aJsonObject *jsonrpc_data = aJson.getObjectItem(jsonrpc_params, "data");
+	int16_t jsonrpc_data = msg.getItem(jsonrpc_params, "data");
 
 	// Start output
-	char out_buffer[MAIN_BUFFER_SIZE]; // Holds outgoing data
-	uint16_t out_buffer_idx = 0;
-	out_buffer_idx += printResultStr(out_buffer, out_buffer_idx);
-	bool first = true;
+	char out_buffer[JSON_WRITER_CHUNK]; // Goes to the TX queue as it fills
+	JsonWriter out(out_buffer, sizeof(out_buffer), &txQueue);
+	printResultStr(out);
 	// Now parse data list
-	if (jsonrpc_data) {
-		aJsonObject *jsonrpc_data_item = jsonrpc_data->child;
-		//Serial1.print(jsonrpc_data_item->valuestring);
+	if (jsonrpc_data >= 0) {
+		int16_t jsonrpc_data_item = msg.getChild(jsonrpc_data);
+		//Serial1.print(msg.getString(jsonrpc_data_item));
 		//printFreeRam("pBS data 1");
-		while (jsonrpc_data_item) {
-			bool found = false;
-			for (uint8_t broker_data_idx = 0; broker_data_idx < BROKERDATA_OBJECTS; broker_data_idx++) {
-				if (!strcmp(jsonrpc_data_item->valuestring, ::brokerobjs[broker_data_idx]->getName())) {
-					if (!first) out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",");
-					out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"%s\":{", jsonrpc_data_item->valuestring); // even if it's bad data
-					unsubscribe_matches_found++;
-					// Set subscription up
-					::brokerobjs[broker_data_idx]->unsubscribe();
-					out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"status\":\"ok\"}");
-					found = true;
-					first = false;
-					break; // break out of for loop
-				}
+		while (jsonrpc_data_item >= 0) {
+			int8_t broker_data_idx = findChannel(msg, jsonrpc_data_item);
+			beginItem(out, msg, jsonrpc_data_item, broker_data_idx);
+			if (broker_data_idx >= 0) {
+				unsubscribe_matches_found++;
+				// Set subscription up
+				::channels.getObject(broker_data_idx)->unsubscribe();
+				out.key("status").value("ok");
 			}
-			if (found == false) out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"status\":\"error\"},"); // There should be more to this, but that's all for now.
-			jsonrpc_data_item = jsonrpc_data_item->next; // Set pointer for jsonrpc_data_item to next item.
+			else out.key("status").value("error"); // There should be more to this, but that's all for now.
+			out.endObject();
+			jsonrpc_data_item = msg.getNext(jsonrpc_data_item); // Set pointer for jsonrpc_data_item to next item.
 		}
 	}
 	// Now finish output
 	// Should add update rates....
-	out_buffer_idx = addMsgId(out_buffer, out_buffer_idx, json_id);
-	Serial.println(out_buffer);
-	if (S1DEBUG) {
-		Serial1.print(out_buffer_idx);
-		Serial1.print(" - ");
-		Serial1.println(out_buffer);
-	}
+	addMsgId(out, json_id);
+	LOG(LOG_RESPONSE, ::json_id, out.send());
 	return unsubscribe_matches_found;
 }
 
-uint8_t processBrokerSubscribe(aJsonObject *json_in_msg) {
+uint8_t processBrokerSubscribe(JsonMessage &msg) {
 	/*Processes a subscribe message
 	For example:
 	{"method" : "subscribe",
@@ -540,42 +593,36 @@ uint8_t processBrokerSubscribe(aJsonObject *json_in_msg) {
 		"min_update_ms":1000}
 	"id" : 14}
 	*/
-	printFreeRam("pBSub start");
+	LOG(LOG_FREE_RAM, freeRam());
 	uint8_t subscribe_matches_found = 0;
 	bool subscribe_verbose = true;
 	bool subscribe_on_change = true;
 	uint32_t subscribe_min_update_ms = __LONG_MAX__;
 	uint32_t subscribe_max_update_ms = __LONG_MAX__;
 	// First process style
-	aJsonObject *jsonrpc_params = aJson.getObjectItem(json_in_msg, "params");
-
-	//char *aJsonPtr; // For debug prints
-	//Serial1.print("jsonrpc_params: ");	aJsonPtr = aJson.print(jsonrpc_params);	Serial1.println(aJsonPtr); free(aJsonPtr); // So we don't have a memory leak
+	int16_t jsonrpc_params = msg.getParams();
 
 	// Extract Optional Style
-	aJsonObject *jsonrpc_style = aJson.getObjectItem(jsonrpc_params, "style");
-	//Serial1.print("jsonrpc_style: "); aJsonPtr = aJson.print(jsonrpc_style);	Serial1.println(aJsonPtr); free(aJsonPtr); // So we don't have a memory leak
-	if (jsonrpc_style) {
-		if (!strcmp(jsonrpc_style->valuestring, "terse")) subscribe_verbose = false;
+	int16_t jsonrpc_style = msg.getItem(jsonrpc_params, "style");
+	if (jsonrpc_style >= 0) {
+		if (msg.isString(jsonrpc_style, "terse")) subscribe_verbose = false;
 		else subscribe_verbose = true;
 	}
 
 	// Extract Optional Updates
-	aJsonObject *jsonrpc_updates = aJson.getObjectItem(jsonrpc_params, "updates");
-	if (jsonrpc_updates) {
-		if (!strcmp(jsonrpc_updates->valuestring, "on_new")) subscribe_on_change = false;
+	int16_t jsonrpc_updates = msg.getItem(jsonrpc_params, "updates");
+	if (jsonrpc_updates >= 0) {
+		if (msg.isString(jsonrpc_updates, "on_new")) subscribe_on_change = false;
 		else subscribe_on_change = true;
 	}
 
 	// Extract Optional Min Update Rate
-	aJsonObject *jsonrpc_min_rate = aJson.getObjectItem(jsonrpc_params, "min_update_ms");
-	//Serial1.print("jsonrpc_min_rate: ");	aJsonPtr = aJson.print(jsonrpc_min_rate);	Serial1.println(aJsonPtr); free(aJsonPtr); // So we don't have a memory leak
-	if (jsonrpc_min_rate) 	subscribe_min_update_ms = (uint32_t)jsonrpc_min_rate->valueint; 
+	int16_t jsonrpc_min_rate = msg.getItem(jsonrpc_params, "min_update_ms");
+	if (jsonrpc_min_rate >= 0) 	subscribe_min_update_ms = (uint32_t)msg.getInt(jsonrpc_min_rate); 
 
 	// Extract Optional Max Update Rate
-	aJsonObject *jsonrpc_max_rate = aJson.getObjectItem(jsonrpc_params, "max_update_ms");
-	//Serial1.print("jsonrpc_max_rate: "); aJsonPtr = aJson.print(jsonrpc_max_rate);	Serial1.println(aJsonPtr); free(aJsonPtr); // So we don't have a memory leak
-	if (jsonrpc_max_rate) subscribe_max_update_ms = (uint32_t)jsonrpc_max_rate->valueint;
+	int16_t jsonrpc_max_rate = msg.getItem(jsonrpc_params, "max_update_ms");
+	if (jsonrpc_max_rate >= 0) subscribe_max_update_ms = (uint32_t)msg.getInt(jsonrpc_max_rate);
 
 	// Now some calculations based on https://sites.google.com/site/verticalprofilerupgrade/home/ControllerSoftware/ipc-specification
 	//
@@ -604,165 +651,161 @@ uint8_t processBrokerSubscribe(aJsonObject *json_in_msg) {
 		}
 	}
 
-	// Now Extract data list
-	aJsonObject *jsonrpc_data = aJson.getObjectItem(jsonrpc_params, "data");
-	if (S1DEBUG) {
-		char *aJsonPtr = aJson.print(jsonrpc_data);
-		Serial1.print(F("Data Items:"));
-		Serial1.println(aJsonPtr);
-		free(aJsonPtr); // So we don't have a memory leak
-	}
-
-	//Serial1.print("jsonrpc_data: ");	aJsonPtr = aJson.print(jsonrpc_data);	Serial1.println(aJsonPtr); free(aJsonPtr); // So we don't have a memory leak
+	LOG(LOG_SUBSCRIBE, subscribe_min_update_ms, subscribe_max_update_ms);
 
+	// Now Extract data list
+	int16_t jsonrpc_data = msg.getItem(jsonrpc_params, "data");
 
 	// Start output
-	bool first = true;
-	char out_buffer[MAIN_BUFFER_SIZE]; // Holds outgoing data
-	uint16_t out_buffer_idx = 0;
-	out_buffer_idx += printResultStr(out_buffer, out_buffer_idx);
+	char out_buffer[JSON_WRITER_CHUNK]; // Goes to the TX queue as it fills
+	JsonWriter out(out_buffer, sizeof(out_buffer), &txQueue);
+	printResultStr(out);
 	// data will be list of parameters: ["Voltage","Vcc",Current_Load"]
 	// Now parse data list
-	if (jsonrpc_data) {
-		aJsonObject *jsonrpc_data_item = jsonrpc_data->child;
-		while (jsonrpc_data_item) {
-			bool found = false;
-			for (uint8_t broker_data_idx = 0; broker_data_idx < BROKERDATA_OBJECTS; broker_data_idx++) {
-				if (!strcmp(jsonrpc_data_item->valuestring, ::brokerobjs[broker_data_idx]->getName())) {
-					if (!first) out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",");
-					out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"%s\":{\"status\":\"ok\"}", jsonrpc_data_item->valuestring); // even if it's bad data
-					subscribe_matches_found++;
-					// Set subscription up
-					::brokerobjs[broker_data_idx]->subscribe(subscribe_min_update_ms, subscribe_max_update_ms);
-					::brokerobjs[broker_data_idx]->setSubOnChange(subscribe_on_change);
-					::brokerobjs[broker_data_idx]->setVerbose(subscribe_verbose);
-					found = true;
-					first = false;
-					break; // break out of for loop
-				}
+	if (jsonrpc_data >= 0) {
+		int16_t jsonrpc_data_item = msg.getChild(jsonrpc_data);
+		while (jsonrpc_data_item >= 0) {
+			int8_t broker_data_idx = findChannel(msg, jsonrpc_data_item);
+			if (broker_data_idx >= 0) {
+				out.beginObject(::channels.getObject(broker_data_idx)->getName());
+				out.key("status").value("ok");
+				out.endObject();
+				subscribe_matches_found++;
+				// Set subscription up
+				::channels.getObject(broker_data_idx)->subscribe(subscribe_min_update_ms, subscribe_max_update_ms);
+				::channels.getObject(broker_data_idx)->setSubOnChange(subscribe_on_change);
+				::channels.getObject(broker_data_idx)->setVerbose(subscribe_verbose);
 			}
-			//if ( found == false ) out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"status\":\"error\"}"); // There should be more to this, but that's all for now.
-			jsonrpc_data_item = jsonrpc_data_item->next; // Set pointer for jsonrpc_data_item to next item.
+			jsonrpc_data_item = msg.getNext(jsonrpc_data_item); // Set pointer for jsonrpc_data_item to next item.
 		}
 	}
 	// Now finish output
 	// Should add update rates....
-	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"max_update_ms\":%lu", subscribe_max_update_ms);
-	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"min_update_ms\":%lu", subscribe_min_update_ms);
-	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"updates\":\"%s\"", subscribe_on_change?ON_CHANGE:ON_NEW); //ON_NEW ON_CHANGE
-	out_buffer_idx = addMsgTime(out_buffer, out_buffer_idx,::TZ,true);
-	out_buffer_idx = addMsgId(out_buffer, out_buffer_idx,json_id);
-	Serial.println(out_buffer);
-	if (S1DEBUG) {
-		Serial1.print(out_buffer_idx);
-		Serial1.print(" - ");
-		Serial1.println(out_buffer);
-	}
+	out.key("max_update_ms").value(subscribe_max_update_ms);
+	out.key("min_update_ms").value(subscribe_min_update_ms);
+	out.key("updates").value(subscribe_on_change ? ON_CHANGE : ON_NEW);
+	addMsgTime(out, ::TZ, true);
+	addMsgId(out, json_id);
+	LOG(LOG_RESPONSE, ::json_id, out.send());
 	return subscribe_matches_found;
 }
 
-uint8_t processSet(aJsonObject *json_in_msg) {
+uint8_t processSet(JsonMessage &msg) {
 	/* process set message
 	{"method" : "set", "params" : {"Load_Energy":0,"Charge_Energy":0},"id" : 17}
+	An object instead of a value sets configuration parameters, even on RO data:
+	{"method" : "set", "params" : {"Load_Current":{"median":5,"decimation":8,"lowpass":2}},"id" : 18}
+	"windows" sets the WindowStats window lengths, unless a channel has that name:
+	{"method" : "set", "params" : {"windows":[60,900,86400]},"id" : 19}
 	*/
-	aJsonObject *jsonrpc_params = aJson.getObjectItem(json_in_msg, "params");
-	if (S1DEBUG) {
-		Serial1.print("set params:");
-		char *aJsonPtr = aJson.print(jsonrpc_params);
-		Serial1.println(aJsonPtr);
-		free(aJsonPtr); // So we don't have a memory leak
-	}
+	int16_t jsonrpc_params = msg.getParams();
 	uint8_t parameters_set = 0;
 	// Start output
-	char out_buffer[MAIN_BUFFER_SIZE]; // Holds outgoing data
-	uint16_t out_buffer_idx = 0;
-	out_buffer_idx += printResultStr(out_buffer, out_buffer_idx);
-	// So now we have 1 to n items of unknown name. Will have to iterate, and check existance.
-	bool first = true;
-	for (uint8_t broker_data_idx = 0; broker_data_idx < BROKERDATA_OBJECTS; broker_data_idx++) {
-		aJsonObject *jsonrpc_set_param = aJson.getObjectItem(jsonrpc_params, ::brokerobjs[broker_data_idx]->getName());
-		if (jsonrpc_set_param) {
+	char out_buffer[JSON_WRITER_CHUNK]; // Goes to the TX queue as it fills
+	JsonWriter out(out_buffer, sizeof(out_buffer), &txQueue);
+	printResultStr(out);
+	// So now we have 1 to n items, named by channel name or number. Unknown names are skipped.
+	for (int16_t jsonrpc_set_param = msg.getChild(jsonrpc_params); jsonrpc_set_param >= 0; jsonrpc_set_param = msg.getNext(jsonrpc_set_param)) {
+		int8_t broker_data_idx = ::channels.find(msg.getName(jsonrpc_set_param));
+		if (broker_data_idx >= 0) {
 			// Found one!
-			if (!first) out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ","); // preceding comma
-			out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"%s\":{\"status\":", ::brokerobjs[broker_data_idx]->getName()); // name of parameter and status...
-			if (!::brokerobjs[broker_data_idx]->isRO()) {
-				// Settable
-				double setValue = -999;
-				if (jsonrpc_set_param->type == aJson_Int) {
-					setValue = (double)jsonrpc_set_param->valueint;
-				}
-				else if (jsonrpc_set_param->type == aJson_Long) {
-					setValue = (double)jsonrpc_set_param->valuelong;
-				}
-				else if (jsonrpc_set_param->type == aJson_Float) {
-					setValue = (double)jsonrpc_set_param->valuefloat;
-				}
-				bool success = ::brokerobjs[broker_data_idx]->setData((double)setValue);
-				if (S1DEBUG) {
-					Serial1.print("Setting ");
-					Serial1.print(::brokerobjs[broker_data_idx]->getName());
-					Serial1.print(" to ");
-					Serial1.println(setValue);
+			out.beginObject(::channels.getObject(broker_data_idx)->getName()); // name of parameter and status...
+			out.key("status");
+			if (msg.getType(jsonrpc_set_param) == JSON_OBJECT) {
+				// Configuration parameters
+				bool success = true;
+				int16_t jsonrpc_config_item = msg.getChild(jsonrpc_set_param);
+				while (jsonrpc_config_item >= 0) {
+					if (!::channels.getObject(broker_data_idx)->setParam(msg.getName(jsonrpc_config_item), msg.getNumber(jsonrpc_config_item))) success = false;
+					jsonrpc_config_item = msg.getNext(jsonrpc_config_item);
 				}
 				if (success) {
-					out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"ok\"}");
+					out.value("ok");
 					parameters_set++;
 				}
-				else {
-					// couldn't set
-					out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"error, couldn't set\"}");
+				else out.value("error, couldn't set");
+				::channels.getObject(broker_data_idx)->paramsToJson(out);
+			}
+			else if (!::channels.getObject(broker_data_idx)->isRO()) {
+				// Settable
+				double setValue = msg.getNumber(jsonrpc_set_param);
+				bool success = ::channels.getObject(broker_data_idx)->setData((double)setValue);
+				LOG(LOG_SET, broker_data_idx, logFloat(setValue));
+				if (success) {
+					out.value("ok");
+					parameters_set++;
 				}
+				else out.value("error, couldn't set");
+			}
+			else out.value("error, RO");
+			out.endObject();
+		}
+		else if (!strcmp(msg.getName(jsonrpc_set_param), "windows") && msg.getType(jsonrpc_set_param) == JSON_ARRAY) {
+			bool success = true;
+			uint8_t w = 0;
+			for (int16_t jsonrpc_window = msg.getChild(jsonrpc_set_param); jsonrpc_window >= 0; jsonrpc_window = msg.getNext(jsonrpc_window)) {
+				const double window_s = msg.getNumber(jsonrpc_window);
+				if (window_s < 0 || !::windows.setWindow(w++, (uint32_t)window_s)) success = false;
 			}
-			else out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"error, RO\"}");
-			first = false;
+			out.beginObject("windows");
+			out.key("status").value(success ? "ok" : "error, couldn't set");
+			::windows.windowsToJson(out);
+			out.endObject();
+			if (success) parameters_set++;
 		}
 	}
 	// Now finish output
-	// Should add update rates....
-	out_buffer_idx = addMsgTime(out_buffer, out_buffer_idx,::TZ,true);
-	out_buffer_idx = addMsgId(out_buffer, out_buffer_idx,json_id);
-	Serial.println(out_buffer);
-	if (S1DEBUG) {
-		Serial1.print(out_buffer_idx);
-		Serial1.print(" - ");
-		Serial1.println(out_buffer);
-	}
+	addMsgTime(out, ::TZ, true);
+	addMsgId(out, json_id);
+	LOG(LOG_RESPONSE, ::json_id, out.send());
 	return parameters_set;
 }
 
+int8_t findChannel(JsonMessage &msg, int16_t json_item) {
+	// Returns the channel number for a name or a channel number (as listed by list_data), or -1
+	if (msg.getType(json_item) == JSON_STRING) return ::channels.find(msg.getString(json_item));
+	if (msg.isInteger(json_item)) return ::channels.findId(msg.getInt(json_item));
+	return -1;
+}
+
+void beginItem(JsonWriter &out, JsonMessage &msg, int16_t json_item, int8_t broker_data_idx) {
+	// Opens the reply object for one item of a "data" list: the channel's name, or the item as sent if there's no such channel
+	if (broker_data_idx >= 0) out.beginObject(::channels.getObject(broker_data_idx)->getName());
+	else if (msg.getType(json_item) == JSON_STRING) out.beginObject(msg.getString(json_item));
+	else {
+		char itemStr[12];
+		sprintf(itemStr, "%ld", (long)msg.getInt(json_item, 0));
+		out.beginObject(itemStr);
+	}
+}
+
 void processListData() {
 	/* List data parameters available.
 	{"method" : "list_data","id" : 18}
 	*/
 	// Start output
-	bool first = true;
-	char out_buffer[MAIN_BUFFER_SIZE]; // Holds outgoing data
-	uint16_t out_buffer_idx = 0;
-	out_buffer_idx += printResultStr(out_buffer, out_buffer_idx);
-	char param_type[] = "\"Rx\"";
-	for (uint8_t broker_data_idx = 0; broker_data_idx < BROKERDATA_OBJECTS; broker_data_idx++) {
-		if (::brokerobjs[broker_data_idx]->isRO()) param_type[2] = 'O';
-		else param_type[2] = 'W';
-		// Break this into multiple lines just to make it easier to read.
-		if (!first) out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",");
-		out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"%s\":", ::brokerobjs[broker_data_idx]->getName());
-		out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "{\"units\":\"%s\",", ::brokerobjs[broker_data_idx]->getUnit());
-		out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"type\":%s}", param_type);
-		first = false;
+	char out_buffer[JSON_WRITER_CHUNK]; // Goes to the TX queue as it fills
+	JsonWriter out(out_buffer, sizeof(out_buffer), &txQueue);
+	printResultStr(out);
+	for (uint8_t broker_data_idx = 0; broker_data_idx < ::channels.getCount(); broker_data_idx++) {
+		BrokerData *broker_obj = ::channels.getObject(broker_data_idx);
+		out.beginObject(broker_obj->getName());
+		out.key("id").value(broker_data_idx);
+		out.key("units").value(broker_obj->getUnit());
+		out.key("type").value(broker_obj->isRO() ? "RO" : "RW");
+		broker_obj->paramsToJson(out);
+		out.endObject();
 	}
 	//Add message_time
-	if (!first) out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",");
-	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"message_time\":{\"units\":\"UTC\",\"type\":\"RO\"}");
-	out_buffer_idx = addMsgId(out_buffer, out_buffer_idx, json_id);
-	Serial.println(out_buffer);
-	if (S1DEBUG) {
-		Serial1.print(out_buffer_idx);
-		Serial1.print(" - ");
-		Serial1.println(out_buffer);
-	}
+	out.beginObject("message_time");
+	out.key("units").value("UTC");
+	out.key("type").value("RO");
+	out.endObject();
+	addMsgId(out, json_id);
+	LOG(LOG_RESPONSE, ::json_id, out.send());
 }
 
-uint8_t processReset(aJsonObject *json_in_msg) {
+uint8_t processReset(JsonMessage &msg) {
 	/*Call reset for requested parameters. This will set min and max to 0. if RW, will also set value to 0.
 	Message format is like "status", but no "style". 
 	Response is like "subscribe";
@@ -770,46 +813,33 @@ uint8_t processReset(aJsonObject *json_in_msg) {
 	//printFreeRam("pR start");
 	uint8_t reset_matches_found = 0;
 	// First process style
-	aJsonObject *jsonrpc_params = aJson.getObjectItem(json_in_msg, "params");
+	int16_t jsonrpc_params = msg.getParams();
 	clearDataMap(); // Sets all data_map array values to false
 	// Now Extract data list
-	aJsonObject *jsonrpc_data = aJson.getObjectItem(jsonrpc_params, "data");
-	bool first = true;
-	bool found = false;
-	char out_buffer[MAIN_BUFFER_SIZE]; // Holds outgoing data
-	uint16_t out_buffer_idx = 0;
-	out_buffer_idx += printResultStr(out_buffer, out_buffer_idx);
+	int16_t jsonrpc_data = msg.getItem(jsonrpc_params, "data");
+	char out_buffer[JSON_WRITER_CHUNK]; // Goes to the TX queue as it fills
+	JsonWriter out(out_buffer, sizeof(out_buffer), &txQueue);
+	printResultStr(out);
 	// data will be list of parameters: ["Voltage","Vcc",Current_Load"]
 	// Now parse data list
-	aJsonObject *jsonrpc_data_item = jsonrpc_data->child;
-	while (jsonrpc_data_item) {
-		found = false;
-		if (!first) out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",");
-		first = false;
-		out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"%s\":{", jsonrpc_data_item->valuestring); // even if it's bad data
-		for (uint8_t broker_data_idx = 0; broker_data_idx < BROKERDATA_OBJECTS; broker_data_idx++) {
-			if (!strcmp(jsonrpc_data_item->valuestring, ::brokerobjs[broker_data_idx]->getName())) {
-				// got a match
-				found = true;
-				out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"status\":\"ok\"}");
-				::brokerobjs[broker_data_idx]->resetMin();
-				::brokerobjs[broker_data_idx]->resetMax();
-				if (!brokerobjs[broker_data_idx]->isRO()) ::brokerobjs[broker_data_idx]->setData(0); // only for "RW" parameters
-				reset_matches_found++;
-				break; // break out of for loop
-			}
+	int16_t jsonrpc_data_item = msg.getChild(jsonrpc_data);
+	while (jsonrpc_data_item >= 0) {
+		int8_t broker_data_idx = findChannel(msg, jsonrpc_data_item);
+		beginItem(out, msg, jsonrpc_data_item, broker_data_idx); // even if it's bad data
+		if (broker_data_idx >= 0) {
+			// got a match
+			out.key("status").value("ok");
+			::channels.resetMinMax(broker_data_idx);
+			if (!::channels.getObject(broker_data_idx)->isRO()) ::channels.getObject(broker_data_idx)->setData(0); // only for "RW" parameters
+			reset_matches_found++;
 		}
-		if (found == false) out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"status\":\"error\"}"); // There should be more to this, but that's all for now.
-		jsonrpc_data_item = jsonrpc_data_item->next; // Set pointer for jsonrpc_data_item to next item.
-	}
-	out_buffer_idx = addMsgTime(out_buffer, out_buffer_idx,::TZ,true);
-	out_buffer_idx = addMsgId(out_buffer, out_buffer_idx,::json_id);
-	Serial.println(out_buffer);
-	if (S1DEBUG) {
-		Serial1.print(out_buffer_idx);
-		Serial1.print(" - ");
-		Serial1.println(out_buffer);
+		else out.key("status").value("error"); // There should be more to this, but that's all for now.
+		out.endObject();
+		jsonrpc_data_item = msg.getNext(jsonrpc_data_item); // Set pointer for jsonrpc_data_item to next item.
 	}
+	addMsgTime(out, ::TZ, true);
+	addMsgId(out, ::json_id);
+	LOG(LOG_RESPONSE, ::json_id, out.send());
 	return reset_matches_found;
 }
 
@@ -842,16 +872,34 @@ void processBrokerStatus() {
 	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"db_connected\":\"False\"");
 	// Now non-constant
 	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"start_time\":%s", ::broker_start_time);
-	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"last_data_time\":%s", ::v_batt.getSplTimeStr());
+	VoltageData *v_batt = ::config.getVoltage(0); // Battery
+	char timeStr[TIMESTAMP_STR_LEN] = "\"None\"";
+	if (v_batt) v_batt->sampleTimeToStr(timeStr);
+	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"last_data_time\":%s", timeStr);
 	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"last_db_time\":\"None\"");
+	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"sample_rate_hz\":%lu", ::sampler.getRate());
+	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"sample_mode\":\"%s\"", ::adaptive_rate.isEnabled() ? "adaptive" : "fixed");
+	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"rate_bursts\":%lu", ::adaptive_rate.getBursts());
+	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"adc_overruns\":%lu", ::sampler.getOverruns());
+	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"us_per_rtc_s\":%lu", getMicrosPerRtcSecond()); // Core clock against the RTC
+	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"log_dropped\":%lu", traceLog.getDropped());
+	out_buffer_idx = ::txQueue.statusToStr(out_buffer, out_buffer_idx);
+	out_buffer_idx = ::windows.windowsToStr(out_buffer, out_buffer_idx);
+	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"windowed_channels\":%u", ::windows.getSlotCount());
+	out_buffer_idx = ::history.statusToStr(out_buffer, out_buffer_idx);
+	char valueStr[FORMAT_MAX_LEN];
+	formatFixed(valueStr, ::idle.getDutyCycle() * 100.0, 1, 1);
+	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"duty_cycle_pct\":%s", valueStr);
+	const double self_mA = ::idle.getSelfCurrentmA();
+	formatFixed(valueStr, self_mA, 1, 1);
+	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"self_mA\":%s", valueStr);
+	formatFixed(valueStr, self_mA * (v_batt ? v_batt->getValue() : 0), 1, 1); // Linear regulator, so battery current is board current
+	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"self_mW\":%s", valueStr);
+	out_buffer_idx = ::scheduler.tasksToStr(out_buffer, out_buffer_idx);
 	out_buffer_idx = addMsgTime(out_buffer, out_buffer_idx,::TZ,true);
 	out_buffer_idx = addMsgId(out_buffer, out_buffer_idx,::json_id);
-	Serial.println(out_buffer);
-	if (S1DEBUG) {
-		Serial1.print(out_buffer_idx);
-		Serial1.print(" - ");
-		Serial1.println(out_buffer);
-	}
+	txQueue.println(out_buffer);
+	LOG(LOG_RESPONSE, ::json_id, out_buffer_idx);
 }
 
 void generateStatusMessage() {
@@ -870,94 +918,398 @@ void generateStatusMessage() {
 						  "sample_time":20110801135647605}}
 						  "id" : 1
 						  }*/
-	bool first = true;
-	char out_buffer[MAIN_BUFFER_SIZE]; // Holds outgoing data
-	uint16_t out_buffer_idx = 0;
-	out_buffer_idx += printResultStr(out_buffer, out_buffer_idx);
-	for (uint8_t obj_no = 0; obj_no < BROKERDATA_OBJECTS; obj_no++) {
+	char out_buffer[JSON_WRITER_CHUNK]; // Goes to the TX queue as it fills
+	JsonWriter out(out_buffer, sizeof(out_buffer), &txQueue);
+	printResultStr(out);
+	for (uint8_t obj_no = 0; obj_no < ::channels.getCount(); obj_no++) {
 		if (::data_map[obj_no] == true) {
-			char statusValue[20] = "-999"; // Holds status double value as a string
-			::brokerobjs[obj_no]->dataToStr(statusValue);
-			if (!first) out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ","); // preceding comma
-			out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"%s\":{", ::brokerobjs[obj_no]->getName());
-			out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"value\":%s", statusValue);
+			BrokerData *broker_obj = ::channels.getObject(obj_no);
+			out.beginObject(broker_obj->getName());
+			out.key("value");
+			broker_obj->dataToJson(out);
+			if (::status_window >= 0) addWindow(out, broker_obj, ::status_window);
 			if (::status_verbose == true) {
-				out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"units\":\"%s\"", ::brokerobjs[obj_no]->getUnit());
+				out.key("units").value(broker_obj->getUnit());
 				// Only report min and max if they exist
-				double min_d = ::brokerobjs[obj_no]->getMin();
-				double max_d = ::brokerobjs[obj_no]->getMax();
+				double min_d = ::channels.getMin(obj_no);
+				double max_d = ::channels.getMax(obj_no);
 				if (min_d == min_d) {
-					::brokerobjs[obj_no]->dataToStr(statusValue);
-					out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"min\":%s", statusValue);
+					out.key("min");
+					broker_obj->valueToJson(out, min_d);
 				}
 				if (max_d == max_d) {
-					::brokerobjs[obj_no]->dataToStr(statusValue);
-					out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"max\":%s", statusValue);
+					out.key("max");
+					broker_obj->valueToJson(out, max_d);
 				}
-				out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"sample_time\":%s", ::brokerobjs[obj_no]->getSplTimeStr());
+				addStats(out, broker_obj, STATS_STATUS);
+				char timeStr[TIMESTAMP_STR_LEN];
+				broker_obj->sampleTimeToStr(timeStr);
+				out.key("sample_time").rawValue(timeStr);
+				out.key("sample_ms").value(broker_obj->getSampleTimeMs());
 			}
-			out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "}");
-			first = false;
+			out.endObject();
 		}
 	}
-	out_buffer_idx = addMsgTime(out_buffer, out_buffer_idx, ::TZ,true);
-	out_buffer_idx = addMsgId(out_buffer, out_buffer_idx, json_id);
-	Serial.println(out_buffer);
-	if (S1DEBUG) {
-		Serial1.print(out_buffer_idx);
-		Serial1.print(" - ");
-		Serial1.println(out_buffer);
-	}
+	addMsgTime(out, ::TZ, true);
+	addMsgId(out, json_id);
+	LOG(LOG_RESPONSE, ::json_id, out.send());
 }
 
-void processBrokerTokenAck(aJsonObject *json_in_msg,bool force) {
+void processBrokerTokenAck(JsonMessage &msg,bool force) {
 	/* This is currently the simplest implementation. Ignores Force.
 	Should compare name to current value and deny of they don't match, but due to the nature of this "broker" there can only be one connection at a time.
 	*/
+	int16_t jsonrpc_params = msg.getParams();
+	int16_t jsonrpc_name = msg.getItem(jsonrpc_params, "name");
+	strncpy(token_owner, msg.getString(jsonrpc_name, ""), TOKEN_OWN_SIZE - 1); // Last byte stays 0
+	printTokenResult("ok");
+}
+
+void processBrokerTokenRel() {
+	token_owner[0] = 0; // clears owner
+	printTokenResult("ok");
+}
+
+void processBrokerTokenOwn() {
+	printTokenResult(token_owner);
+}
+
+void printTokenResult(const char *result) {
+	// {"result":"<result>","id":<id>}, the reply to every token request
+	char out_buffer[JSON_WRITER_CHUNK]; // Goes to the TX queue as it fills
+	JsonWriter out(out_buffer, sizeof(out_buffer), &txQueue);
+	out.beginObject();
+	out.key("result").value(result);
+	out.key("id").value(::json_id);
+	out.endObject();
+	LOG(LOG_RESPONSE, ::json_id, out.send());
+}
+
+
+
+bool processCapture(JsonMessage &msg) {
+	/* Arms a burst capture
+	{"method" : "capture", "params" : {"channels":["Load_Current","Voltage"],"samples":2000,"rate_hz":10000},"id" : 30}
+	"samples" is per channel. The result echoes the header that is sent again, with the measured rate, before the data.
+	After a capture has been sent one frame can be asked for again:
+	{"method" : "capture", "params" : {"block":3},"id" : 31}
+	*/
+	int16_t jsonrpc_params = msg.getParams();
+	int16_t jsonrpc_block = msg.getItem(jsonrpc_params, "block");
+	if (jsonrpc_block >= 0) {
+		// The frame goes first, then a reply that says whether it was sent
+		const double block = msg.getNumber(jsonrpc_block, -1);
+		const bool sent = block >= 0 && block < ::capture.getBlocks() && block == floor(block) && ::capture.sendBlock(txQueue, (uint16_t)block);
+		char out_buffer[MAIN_BUFFER_SIZE]; // Holds outgoing data
+		uint16_t out_buffer_idx = 0;
+		out_buffer_idx += printResultStr(out_buffer, out_buffer_idx);
+		if (sent) out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"status\":\"sent\",\"block\":%u", (uint16_t)block);
+		else out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"status\":\"error, no such block\"");
+		out_buffer_idx = addMsgTime(out_buffer, out_buffer_idx,::TZ,true);
+		out_buffer_idx = addMsgId(out_buffer, out_buffer_idx,::json_id);
+		txQueue.println(out_buffer);
+		LOG(LOG_RESPONSE, ::json_id, out_buffer_idx);
+		return sent;
+	}
+	ADCData *channels[CAPTURE_MAX_CHANNELS];
+	uint8_t channel_count = 0;
+	bool success = true;
+	int16_t jsonrpc_channels = msg.getItem(jsonrpc_params, "channels");
+	int16_t jsonrpc_channel = msg.getChild(jsonrpc_channels);
+	while (jsonrpc_channel >= 0) {
+		ADCData *channel = ::sampler.findChannel(msg.getString(jsonrpc_channel, ""));
+		if (channel == NULL || channel_count >= CAPTURE_MAX_CHANNELS) success = false;
+		else channels[channel_count++] = channel;
+		jsonrpc_channel = msg.getNext(jsonrpc_channel);
+	}
+	int16_t jsonrpc_samples = msg.getItem(jsonrpc_params, "samples");
+	int16_t jsonrpc_rate = msg.getItem(jsonrpc_params, "rate_hz");
+	const double samples = msg.getNumber(jsonrpc_samples, -999);
+	const double rate_hz = msg.getNumber(jsonrpc_rate, ::sampler.getRate());
+	if (samples < 0 || samples > CAPTURE_MAX_SAMPLES || rate_hz < 0) success = false;
+	if (success) success = ::capture.arm(channels, channel_count, (uint16_t)samples, (uint32_t)rate_hz);
 	char out_buffer[MAIN_BUFFER_SIZE]; // Holds outgoing data
 	uint16_t out_buffer_idx = 0;
-	aJsonObject *jsonrpc_params = aJson.getObjectItem(json_in_msg, "params");
-	aJsonObject *jsonrpc_name = aJson.getObjectItem(jsonrpc_params, "name");
-	Serial1.println(jsonrpc_name->valuestring);
-	strncpy(token_owner, jsonrpc_name->valuestring, TOKEN_OWN_SIZE);
-	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "{\"result\":\"ok\",\"id\":%u}", ::json_id);
-	Serial.println(out_buffer);
-	if (S1DEBUG) {
-		Serial1.print(out_buffer_idx);
-		Serial1.print(" - ");
-		Serial1.println(out_buffer);
+	out_buffer_idx += printResultStr(out_buffer, out_buffer_idx);
+	if (success) {
+		out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"status\":\"armed\",");
+		out_buffer_idx = ::capture.headerToStr(out_buffer, out_buffer_idx);
 	}
+	else out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"status\":\"error, couldn't arm\"");
+	out_buffer_idx = addMsgTime(out_buffer, out_buffer_idx,::TZ,true);
+	out_buffer_idx = addMsgId(out_buffer, out_buffer_idx,::json_id);
+	txQueue.println(out_buffer);
+	LOG(LOG_RESPONSE, ::json_id, out_buffer_idx);
+	return success;
 }
 
-void processBrokerTokenRel() {
+bool processTrigger(JsonMessage &msg) {
+	/* Sets up the transient recorder
+	{"method" : "trigger", "params" : {"channel":"Load_Current","mode":"level","high":8.0},"id" : 32}
+	{"method" : "trigger", "params" : {"channel":"Voltage","mode":"window","high":14.8,"low":11.5},"id" : 33}
+	{"method" : "trigger", "params" : {"channel":"Load_Current","mode":"slope","slope_per_ms":2.0},"id" : 34}
+	{"method" : "trigger", "params" : {"mode":"off"},"id" : 35}
+	No params just reports the trigger and the stored events.
+	*/
+	int16_t jsonrpc_params = msg.getParams();
+	int16_t jsonrpc_mode = msg.getItem(jsonrpc_params, "mode");
+	bool success = true;
+	if (jsonrpc_mode >= 0) {
+		uint8_t mode = TRIG_WINDOW + 1;
+		for (uint8_t m = TRIG_OFF; m <= TRIG_WINDOW; m++) {
+			if (msg.isString(jsonrpc_mode, TRIG_MODE_STRINGS[m])) mode = m;
+		}
+		int16_t jsonrpc_channel = msg.getItem(jsonrpc_params, "channel");
+		int16_t jsonrpc_high = msg.getItem(jsonrpc_params, "high");
+		int16_t jsonrpc_low = msg.getItem(jsonrpc_params, "low");
+		int16_t jsonrpc_slope = msg.getItem(jsonrpc_params, "slope_per_ms");
+		ADCData *channel = jsonrpc_channel >= 0 ? ::sampler.findChannel(msg.getString(jsonrpc_channel, "")) : ::config.getCurrent(0); // First current by default
+		success = ::recorder.setTrigger(channel, mode,
+			msg.getNumber(jsonrpc_high, 0),
+			msg.getNumber(jsonrpc_low, 0),
+			msg.getNumber(jsonrpc_slope, 0));
+	}
 	char out_buffer[MAIN_BUFFER_SIZE]; // Holds outgoing data
 	uint16_t out_buffer_idx = 0;
-	token_owner[0] = 0; // clears owner
-	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "{\"result\":\"ok\",\"id\":%u}", ::json_id);
-	Serial.println(out_buffer);
-	if (S1DEBUG) {
-		Serial1.print(out_buffer_idx);
-		Serial1.print(" - ");
-		Serial1.println(out_buffer);
-	}
+	out_buffer_idx += printResultStr(out_buffer, out_buffer_idx);
+	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"status\":%s,", success ? "\"ok\"" : "\"error, couldn't set\"");
+	out_buffer_idx = ::recorder.triggerToStr(out_buffer, out_buffer_idx);
+	out_buffer_idx = ::recorder.eventsToStr(out_buffer, out_buffer_idx);
+	out_buffer_idx = addMsgTime(out_buffer, out_buffer_idx,::TZ,true);
+	out_buffer_idx = addMsgId(out_buffer, out_buffer_idx,::json_id);
+	txQueue.println(out_buffer);
+	LOG(LOG_RESPONSE, ::json_id, out_buffer_idx);
+	return success;
 }
 
-void processBrokerTokenOwn() {
+bool processEvent(JsonMessage &msg) {
+	/* Fetches a stored transient event. The reply is followed by its samples as binary frames.
+	{"method" : "event", "params" : {"id":3},"id" : 36}
+	*/
+	int16_t jsonrpc_params = msg.getParams();
+	int16_t jsonrpc_event_id = msg.getItem(jsonrpc_params, "id");
+	int32_t event_id;
+	const bool found = getWhole(msg, jsonrpc_event_id, 0, INT32_MAX, event_id) && ::recorder.hasEvent(event_id);
+	char out_buffer[MAIN_BUFFER_SIZE]; // Holds outgoing data
+	uint16_t out_buffer_idx = 0;
+	out_buffer_idx += printResultStr(out_buffer, out_buffer_idx);
+	if (found) out_buffer_idx = ::recorder.eventToStr(out_buffer, out_buffer_idx, event_id);
+	else out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"status\":\"error, no such event\"");
+	out_buffer_idx = addMsgTime(out_buffer, out_buffer_idx,::TZ,true);
+	out_buffer_idx = addMsgId(out_buffer, out_buffer_idx,::json_id);
+	txQueue.println(out_buffer);
+	if (found) ::recorder.sendEventFrames(txQueue, event_id);
+	LOG(LOG_RESPONSE, ::json_id, out_buffer_idx);
+	return found;
+}
+
+bool processConfig(JsonMessage &msg) {
+	/* Edits the channel definitions kept in EEPROM. Saved changes take effect at the next boot.
+	{"method" : "config","id" : 40} - Lists the staged definitions
+	{"method" : "config", "params" : {"def":1,"model":"ACS722_20B"},"id" : 41} - Changes definition 1. Fields left out keep their value.
+	{"method" : "config", "params" : {"def":14,"type":"current","name":"Aux_Current","pin":17,"model":"ACS722_10B","f_pin":-1},"id" : 42}
+		A def number equal to the number of definitions appends one.
+	{"method" : "config", "params" : {"remove":14},"id" : 43}
+	{"method" : "config", "params" : {"defaults":1},"id" : 44} - Stages the sketch's DEFAULT_CHANNELS
+	{"method" : "config", "params" : {"save":1,"restart":1},"id" : 45} - Writes EEPROM, then reboots into it
+	*/
+	int16_t jsonrpc_params = msg.getParams();
+	const char *status = "ok";
+	bool restart = false;
+	if (jsonrpc_params >= 0) {
+		int16_t jsonrpc_defaults = msg.getItem(jsonrpc_params, "defaults");
+		int16_t jsonrpc_remove = msg.getItem(jsonrpc_params, "remove");
+		int16_t jsonrpc_def = msg.getItem(jsonrpc_params, "def");
+		int16_t jsonrpc_save = msg.getItem(jsonrpc_params, "save");
+		int16_t jsonrpc_restart = msg.getItem(jsonrpc_params, "restart");
+		if (msg.getNumber(jsonrpc_defaults) > 0) ::config.loadDefaults();
+		int32_t remove_idx, def_idx;
+		if (jsonrpc_remove >= 0) {
+			if (!getWhole(msg, jsonrpc_remove, 0, CONFIG_MAX_DEFS - 1, remove_idx)) status = "error, bad def";
+			else if (!::config.removeDef((uint8_t)remove_idx)) status = "error, in use or missing";
+		}
+		if (jsonrpc_def >= 0 && !getWhole(msg, jsonrpc_def, 0, CONFIG_MAX_DEFS - 1, def_idx)) status = "error, bad def";
+		else if (jsonrpc_def >= 0) {
+			ChannelDef def;
+			if (::config.getDef(def_idx)) def = *::config.getDef(def_idx);
+			else {
+				// New definition
+				memset(&def, 0, sizeof(def));
+				def.f_pin = -1;
+				def.src = CONFIG_NO_SRC;
+				def.src_v = CONFIG_NO_SRC;
+				def.width = STAT_VAL_WIDTH;
+				def.dec = STAT_VAL_PREC;
+			}
+			if (!setDefFields(def, msg, jsonrpc_params)) status = "error, bad field";
+			else if (!::config.setDef(def_idx, def)) status = "error, invalid";
+		}
+		if (msg.getNumber(jsonrpc_save) > 0) {
+			if (!::config.save()) status = "error, couldn't save";
+			else restart = msg.getNumber(jsonrpc_restart) > 0;
+		}
+	}
 	char out_buffer[MAIN_BUFFER_SIZE]; // Holds outgoing data
 	uint16_t out_buffer_idx = 0;
-	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "{\"result\":\"%s\",\"id\":%u}", token_owner,::json_id);
-	Serial.println(out_buffer);
-	if (S1DEBUG) {
-		Serial1.print(out_buffer_idx);
-		Serial1.print(" - ");
-		Serial1.println(out_buffer);
+	out_buffer_idx += printResultStr(out_buffer, out_buffer_idx);
+	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"status\":\"%s\"", status);
+	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"saved\":%s", ::config.isSaved() ? "true" : "false");
+	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"running\":\"%s\"", ::config.isFromEeprom() ? "eeprom" : "defaults");
+	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"restart\":%s", restart ? "true" : "false");
+	out_buffer_idx = ::config.defsToStr(out_buffer, out_buffer_idx, MAIN_BUFFER_SIZE - 100);
+	out_buffer_idx = addMsgTime(out_buffer, out_buffer_idx,::TZ,true);
+	out_buffer_idx = addMsgId(out_buffer, out_buffer_idx,::json_id);
+	txQueue.println(out_buffer);
+	LOG(LOG_RESPONSE, ::json_id, out_buffer_idx);
+	if (restart) {
+		txQueue.end(); // Now rather than when processJson() returns
+		txQueue.flush(Serial, TX_FLUSH_MS);
+		Serial.flush();
+		restartCpu();
+	}
+	return strcmp(status, "ok") == 0;
+}
+
+bool getWhole(JsonMessage &msg, int16_t tok, int32_t low, int32_t high, int32_t &whole) {
+	// A whole number from low to high, so it can be cast to a narrower type. false for anything else.
+	const double value = msg.getNumber(tok, low - 1.0);
+	if (!(value >= low && value <= high) || value != floor(value)) return false;
+	whole = (int32_t)value;
+	return true;
+}
+
+bool setDefFields(ChannelDef &def, JsonMessage &msg, int16_t jsonrpc_params) {
+	// Copies any definition fields in params into def. false if a type or model name is unknown, a name isn't a string,
+	// or a number field isn't a whole number that fits.
+	int32_t whole;
+	for (int16_t item = msg.getChild(jsonrpc_params); item >= 0; item = msg.getNext(item)) {
+		const char *name = msg.getName(item);
+		const bool is_str = (msg.getType(item) == JSON_STRING);
+		if ((!strcmp(name, "name") || !strcmp(name, "unit") || !strcmp(name, "type") || !strcmp(name, "model")) && !is_str) return false;
+		if (!strcmp(name, "name")) strncpy(def.name, msg.getString(item), BROKER_DATA_NAME_LENGTH - 1);
+		else if (!strcmp(name, "unit")) strncpy(def.unit, msg.getString(item), BROKER_DATA_UNIT_LENGTH - 1);
+		else if (!strcmp(name, "type")) {
+			const int8_t type = findDefType(msg.getString(item));
+			if (type < 0) return false;
+			def.type = type;
+		}
+		else if (!strcmp(name, "model")) {
+			const int8_t model = findCurrentSensor(msg.getString(item));
+			if (model < 0) return false;
+			def.model = model;
+		}
+		else if (!strcmp(name, "width") || !strcmp(name, "dec") || !strcmp(name, "pin") || !strcmp(name, "src") || !strcmp(name, "src_v")) {
+			if (!getWhole(msg, item, 0, UINT8_MAX, whole)) return false;
+			if (!strcmp(name, "width")) def.width = (uint8_t)whole;
+			else if (!strcmp(name, "dec")) def.dec = (uint8_t)whole;
+			else if (!strcmp(name, "pin")) def.pin = (uint8_t)whole;
+			else if (!strcmp(name, "src")) def.src = (uint8_t)whole;
+			else def.src_v = (uint8_t)whole;
+		}
+		else if (!strcmp(name, "f_pin")) {
+			if (!getWhole(msg, item, INT8_MIN, INT8_MAX, whole)) return false;
+			def.f_pin = (int8_t)whole;
+		}
+		else if (!strcmp(name, "high") || !strcmp(name, "value")) def.value = msg.getNumber(item);
+		else if (!strcmp(name, "low")) def.value_low = msg.getNumber(item);
 	}
+	return true;
 }
 
+bool processHistory(JsonMessage &msg) {
+	/* Returns readings kept in the history store, or changes which channels are recorded.
+	{"method" : "history", "params" : {"channel":"Load_Power","from":1760608800,"to":1760612400},"id" : 50}
+		from and to are UTC seconds since 1970. Either can be left out. from_ms adds milliseconds to from.
+	{"method" : "history", "params" : {"channel":"Voltage","last_s":3600,"step_s":60},"id" : 51}
+		last_s replaces from with that many seconds ago. step_s returns one mean per step.
+	{"method" : "history", "params" : {"record":["Voltage","Load_Current","Load_Power"]},"id" : 52}
+		Drops all history and records these channels from now on.
+	The reply holds "start" and "points", which alternate ms since the previous point and the value. If it didn't all
+	fit there is a "next", to send again as from and from_ms.
+	*/
+	int16_t jsonrpc_params = msg.getParams();
+	const char *status = "ok";
+	int8_t broker_data_idx = -1;
+	uint64_t from_ms = 0;
+	uint64_t to_ms = UINT64_MAX;
+	uint32_t step_ms = 0;
+	if (jsonrpc_params >= 0) {
+		int16_t jsonrpc_record = msg.getItem(jsonrpc_params, "record");
+		int16_t jsonrpc_channel = msg.getItem(jsonrpc_params, "channel");
+		int16_t jsonrpc_from = msg.getItem(jsonrpc_params, "from");
+		int16_t jsonrpc_from_ms = msg.getItem(jsonrpc_params, "from_ms");
+		int16_t jsonrpc_to = msg.getItem(jsonrpc_params, "to");
+		int16_t jsonrpc_last = msg.getItem(jsonrpc_params, "last_s");
+		int16_t jsonrpc_step = msg.getItem(jsonrpc_params, "step_s");
+		if (jsonrpc_record >= 0) {
+			::history.clear();
+			for (int16_t jsonrpc_record_item = msg.getChild(jsonrpc_record); jsonrpc_record_item >= 0; jsonrpc_record_item = msg.getNext(jsonrpc_record_item)) {
+				const int8_t record_idx = findChannel(msg, jsonrpc_record_item);
+				if (record_idx < 0 || !::history.record(record_idx)) status = "error, can't record";
+			}
+		}
+		if (jsonrpc_channel >= 0) {
+			broker_data_idx = findChannel(msg, jsonrpc_channel);
+			if (broker_data_idx < 0 || ::history.findSlot(broker_data_idx) < 0) {
+				broker_data_idx = -1;
+				status = "error, not recorded";
+			}
+		}
+		if (msg.getNumber(jsonrpc_from) > 0) from_ms = (uint64_t)msg.getNumber(jsonrpc_from) * 1000;
+		if (msg.getNumber(jsonrpc_from_ms) > 0) from_ms += (uint64_t)msg.getNumber(jsonrpc_from_ms);
+		if (msg.getNumber(jsonrpc_to) > 0) to_ms = (uint64_t)msg.getNumber(jsonrpc_to) * 1000 + 999;
+		if (msg.getNumber(jsonrpc_last) > 0) from_ms = ((uint64_t)now() - (uint64_t)msg.getNumber(jsonrpc_last)) * 1000;
+		if (msg.getNumber(jsonrpc_step) > 0) step_ms = (uint32_t)(msg.getNumber(jsonrpc_step) * 1000);
+	}
+	char out_buffer[MAIN_BUFFER_SIZE]; // Holds outgoing data
+	uint16_t out_buffer_idx = 0;
+	out_buffer_idx += printResultStr(out_buffer, out_buffer_idx);
+	out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "\"status\":\"%s\"", status);
+	if (broker_data_idx >= 0) {
+		BrokerData *broker_obj = ::channels.getObject(broker_data_idx);
+		out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"channel\":\"%s\",\"units\":\"%s\"", broker_obj->getName(), broker_obj->getUnit());
+		if (step_ms) out_buffer_idx += sprintf(out_buffer + out_buffer_idx, ",\"step_ms\":%lu", step_ms);
+		out_buffer_idx = ::history.query(out_buffer, out_buffer_idx, MAIN_BUFFER_SIZE - 100, broker_data_idx, from_ms, to_ms, step_ms);
+	}
+	else out_buffer_idx = ::history.statusToStr(out_buffer, out_buffer_idx);
+	out_buffer_idx = addMsgTime(out_buffer, out_buffer_idx,::TZ,true);
+	out_buffer_idx = addMsgId(out_buffer, out_buffer_idx,::json_id);
+	txQueue.println(out_buffer);
+	LOG(LOG_RESPONSE, ::json_id, out_buffer_idx);
+	return strcmp(status, "ok") == 0;
+}
 
+bool processSetProtocol(JsonMessage &msg) {
+	/* Chooses how subscription updates are sent for the rest of the session. Replies stay JSON.
+	{"method" : "set_protocol", "params" : {"protocol":"cobs"},"id" : 60}
+	"json" is the default. "cobs" sends each update as a COBS framed binary payload between zero bytes, with
+	channel ids from list_data and values as integers at each channel's decimals. See binary_protocol.h.
+	*/
+	int16_t jsonrpc_params = msg.getParams();
+	const char *requested = msg.getString(msg.getItem(jsonrpc_params, "protocol"), "");
+	const char *status = "error, unknown protocol";
+	for (uint8_t p = 0; p < PROTOCOL_COUNT; p++) {
+		if (!strcmp(requested, PROTOCOL_STRINGS[p])) {
+			::protocol = p;
+			status = "ok";
+		}
+	}
+	char out_buffer[JSON_WRITER_CHUNK]; // Goes to the TX queue as it fills
+	JsonWriter out(out_buffer, sizeof(out_buffer), &txQueue);
+	printResultStr(out);
+	out.key("status").value(status);
+	out.key("protocol").value(PROTOCOL_STRINGS[::protocol]);
+	out.beginArray("protocols");
+	for (uint8_t p = 0; p < PROTOCOL_COUNT; p++) out.value(PROTOCOL_STRINGS[p]);
+	out.endArray();
+	addMsgTime(out, ::TZ, true);
+	addMsgId(out, ::json_id);
+	LOG(LOG_RESPONSE, ::json_id, out.send());
+	return strcmp(status, "ok") == 0;
+}
 
 void clearDataMap() {
-	for (uint8_t i = 0; i < BROKERDATA_OBJECTS; i++) {
+	for (uint8_t i = 0; i < ::channels.getCount(); i++) {
 		::data_map[i] = false;
 	}
 }
@@ -972,13 +1324,3 @@ time_t getTeensy3Time()
 	return Teensy3Clock.get();
 }
 
-void WatchdogReset()
-{
-	// use the following 4 lines to kick the dog
-	noInterrupts();
-	WDOG_REFRESH = 0xA602;
-	WDOG_REFRESH = 0xB480;
-	interrupts();
-	// if you don't refresh the watchdog timer before it runs out, the system will be rebooted
-	delay(1); // the smallest delay needed between each refresh is 1ms. anything faster and it will also reboot.
-}
@@ -0,0 +1,230 @@
+// Continuous ADC acquisition driven by the PDB timer.
+
+#include "adc_sampler.h"
+#include "trace_log.h"
+#include "capture.h"
+
+
+bool ADCSampler::addChannel(ADCData &data) {
+	if (_running || _slots >= SAMPLER_MAX_SLOTS) return false;
+	if (!_adc->adc0->checkPin(data.getChannel())) return false;
+	_slot_list[_slots].adc0_data = &data;
+	_slot_list[_slots].adc1_data = NULL;
+	_slot_list[_slots].power = NULL;
+	_slot_list[_slots].push0 = !_isPushed(&data);
+	_slot_list[_slots].push1 = false;
+	_slots++;
+	return true;
+}
+
+bool ADCSampler::addPair(PowerData &power) {
+	// The voltage pin must be routed to ADC_1, the current pin to ADC_0.
+	CurrentData *current = power.getCurrent();
+	VoltageData *voltage = power.getVoltage();
+	if (_running || _slots >= SAMPLER_MAX_SLOTS) return false;
+	if (!_adc->adc0->checkPin(current->getChannel())) return false;
+	if (!_adc->adc1->checkPin(voltage->getChannel())) return false;
+	_slot_list[_slots].adc0_data = current;
+	_slot_list[_slots].adc1_data = voltage;
+	_slot_list[_slots].power = &power;
+	_slot_list[_slots].push0 = !_isPushed(current);
+	_slot_list[_slots].push1 = !_isPushed(voltage);
+	power.setPaired(true);
+	_paired = true;
+	_slots++;
+	return true;
+}
+
+bool ADCSampler::addTap(SampleTap &tap) {
+	if (_running || _tap_count >= SAMPLER_MAX_TAPS) return false;
+	_taps[_tap_count++] = &tap;
+	return true;
+}
+
+bool ADCSampler::attachCapture(BurstCapture &capture) {
+	if (!addTap(capture)) return false;
+	_capture = &capture;
+	return true;
+}
+
+bool ADCSampler::begin(uint32_t rate_hz) {
+	if (_slots == 0) return false;
+	_running = false;
+	if (!setRate(rate_hz)) _rate_hz = SAMPLER_DEFAULT_RATE_HZ;
+	_slot = 0;
+	_setPeriod();
+	// Integration restarts with the first pair so time spent stopped isn't counted
+	for (uint8_t slot = 0; slot < _slots; slot++) {
+		if (_slot_list[slot].power) _slot_list[slot].power->getIntegrator()->restart();
+	}
+	_adc->enableInterrupts(ADC_0); // ADC_1 finishes with ADC_0 so one interrupt serves both
+	// Select the first pins. From here on conversions are started by the PDB.
+	_selectPins(0);
+	_adc->adc0->startPDB(_rate_hz * _slots);
+	if (_paired) _adc->adc1->startPDB(_rate_hz * _slots); // Same PDB counter triggers both ADCs
+	_running = true;
+	return true;
+}
+
+void ADCSampler::stop() {
+	if (!_running) return;
+	_adc->adc0->stopPDB();
+	if (_paired) _adc->adc1->stopPDB();
+	_adc->disableInterrupts(ADC_0);
+	_running = false;
+}
+
+bool ADCSampler::setRate(uint32_t rate_hz) {
+	// Sets per slot sample rate. Returns false if out of range.
+	if (rate_hz < SAMPLER_MIN_RATE_HZ || rate_hz > getMaxRate()) return false;
+	_rate_hz = rate_hz;
+	if (_running) {
+		// Reloads PDB period
+		noInterrupts();
+		_adc->adc0->startPDB(_rate_hz * _slots);
+		if (_paired) _adc->adc1->startPDB(_rate_hz * _slots);
+		_setPeriod();
+		interrupts();
+	}
+	return true;
+}
+
+void ADCSampler::_setPeriod() {
+	_trigger_hz = _rate_hz * _slots;
+	_period_cycles = F_CPU / _trigger_hz;
+	_period_rem = F_CPU % _trigger_hz;
+	_clock_rem = 0;
+}
+
+uint32_t ADCSampler::getOverruns() {
+	uint32_t overruns = 0;
+	for (uint8_t slot = 0; slot < _slots; slot++) {
+		// Each ring once, however many slots convert its channel
+		if (_slot_list[slot].push0) overruns += _slot_list[slot].adc0_data->getOverruns();
+		if (_slot_list[slot].push1) overruns += _slot_list[slot].adc1_data->getOverruns();
+	}
+	return overruns;
+}
+
+bool ADCSampler::_isPushed(ADCData *data) {
+	for (uint8_t slot = 0; slot < _slots; slot++) {
+		if (_slot_list[slot].adc0_data == data || _slot_list[slot].adc1_data == data) return true;
+	}
+	return false;
+}
+
+ADCData *ADCSampler::findChannel(const char *name) {
+	for (uint8_t slot = 0; slot < _slots; slot++) {
+		if (!strcmp(_slot_list[slot].adc0_data->getName(), name)) return _slot_list[slot].adc0_data;
+		if (_slot_list[slot].adc1_data && !strcmp(_slot_list[slot].adc1_data->getName(), name)) return _slot_list[slot].adc1_data;
+	}
+	return NULL;
+}
+
+bool ADCSampler::isCapturing() {
+	return _capture && _capture->isBusy();
+}
+
+void ADCSampler::isr() {
+	// Called at the end of every ADC_0 conversion. Reading the result clears the interrupt flag.
+	_clock += _period_cycles;
+	_clock_rem += _period_rem;
+	if (_clock_rem >= _trigger_hz) {
+		_clock_rem -= _trigger_hz;
+		_clock++;
+	}
+	const uint32_t cycles = _clock;
+	SamplerSlot &slot = _slot_list[_slot];
+	const uint16_t raw0 = (uint16_t)_adc->readSingle(ADC_0);
+	if (slot.push0) {
+		// Always true for slot 0, so every scan begins
+		slot.adc0_data->pushSample(raw0);
+		for (uint8_t tap = 0; tap < _tap_count; tap++) {
+			if (_slot == 0) _taps[tap]->beginScan(cycles);
+			_taps[tap]->record(slot.adc0_data, raw0, cycles);
+		}
+	}
+	if (slot.adc1_data) {
+		// ADC_1 was started by the same trigger with the same settings, so it is done or about to be.
+		for (uint8_t spin = 0; spin < SAMPLER_SYNC_SPIN && !_adc->adc1->isComplete(); spin++);
+		const uint16_t raw1 = (uint16_t)_adc->readSingle(ADC_1);
+		if (slot.push1) {
+			slot.adc1_data->pushSample(raw1);
+			for (uint8_t tap = 0; tap < _tap_count; tap++) _taps[tap]->record(slot.adc1_data, raw1, cycles);
+		}
+		if (slot.power) {
+			slot.power->pushPair(raw0, raw1);
+			slot.power->integrate(raw0, raw1, cycles);
+		}
+	}
+	if (++_slot >= _slots) _slot = 0;
+	_selectPins(_slot); // Converted on the next PDB trigger
+}
+
+void ADCSampler::_selectPins(uint8_t slot) {
+	_adc->startSingleRead(_slot_list[slot].adc0_data->getChannel(), ADC_0);
+	if (_slot_list[slot].adc1_data) _adc->startSingleRead(_slot_list[slot].adc1_data->getChannel(), ADC_1);
+}
+
+
+void AdaptiveRate::update() {
+	if (!_enabled || !_watch || _watch->getBlockSize() == 0 || _sampler->isCapturing()) return;
+	const uint32_t now_ms = millis();
+	const double mean_A = _watch->getBlockMean();
+	bool transient = _watch->getBlockStdDev() >= _std_dev_A;
+	if (!isnan(_last_mean_A) && now_ms != _last_update_ms) {
+		const double slope_A_per_s = fabs(mean_A - _last_mean_A) * 1000.0 / (double)(now_ms - _last_update_ms);
+		if (slope_A_per_s >= _slope_A_per_s) transient = true;
+	}
+	_last_mean_A = mean_A;
+	_last_update_ms = now_ms;
+	const uint32_t rate_hz = _sampler->getRate();
+	if (transient) {
+		_last_step_ms = now_ms; // Hold off the decay
+		if (rate_hz < _burst_hz && _sampler->setRate(min(_burst_hz, _sampler->getMaxRate()))) {
+			_bursts++;
+			LOG(LOG_RATE_BURST, _sampler->getRate());
+		}
+	}
+	else if (rate_hz > _idle_hz && (now_ms - _last_step_ms) >= _hold_ms) {
+		_last_step_ms = now_ms;
+		_sampler->setRate(max(rate_hz / 2, _idle_hz));
+	}
+}
+
+bool AdaptiveRate::setParam(const char *param, double value) {
+	if (value < 0) return false;
+	if (!strcmp(param, "adaptive")) _enabled = (value != 0);
+	else if (!strcmp(param, "idle_hz")) {
+		if (value < SAMPLER_MIN_RATE_HZ || value > _burst_hz) return false;
+		_idle_hz = (uint32_t)value;
+	}
+	else if (!strcmp(param, "burst_hz")) {
+		if (value < _idle_hz || value > _sampler->getMaxRate()) return false;
+		_burst_hz = (uint32_t)value;
+	}
+	else if (!strcmp(param, "slope_A_per_s")) _slope_A_per_s = value;
+	else if (!strcmp(param, "std_dev_A")) _std_dev_A = value;
+	else if (!strcmp(param, "hold_ms")) _hold_ms = (uint32_t)value;
+	else return false;
+	return true;
+}
+
+void AdaptiveRate::paramsToJson(JsonWriter &out) {
+	out.key("adaptive").value(_enabled ? 1 : 0);
+	out.key("idle_hz").value(_idle_hz);
+	out.key("burst_hz").value(_burst_hz);
+	out.key("slope_A_per_s").fixed(_slope_A_per_s, 1, 3);
+	out.key("std_dev_A").fixed(_std_dev_A, 1, 3);
+	out.key("hold_ms").value(_hold_ms);
+}
+
+
+bool SampleRateData::setData(double rate_hz) {
+	if (_sampler->isCapturing()) return false;
+	if (!_sampler->setRate((uint32_t)rate_hz)) return false;
+	_adaptive->setEnabled(false); // A fixed rate was asked for
+	_data_value = _sampler->getRate();
+	_stampSampleTime();
+	return true;
+}
@@ -0,0 +1,177 @@
+// adc_sampler.h
+
+#ifndef _ADC_SAMPLER_h
+#define _ADC_SAMPLER_h
+
+#include "E_Mon.h"
+#include "broker_data.h"
+#include "timebase.h"
+#include <ADC_Module.h>
+#include <ADC.h>
+
+#define SAMPLER_MAX_SLOTS	4	// Max number of slots (single channels or pairs) scanned by the sampler
+#define SAMPLER_DEFAULT_RATE_HZ	1000	// Per slot sample rate at startup
+#define SAMPLER_MIN_RATE_HZ	100	// Per slot
+#define SAMPLER_HW_AVERAGING	4	// Hardware averaging in setup(). Further smoothing is done per channel by its ChannelFilter.
+#define SAMPLER_MAX_CONVERSION_HZ	50000	// PDB triggers per second across all slots. Set by SAMPLER_HW_AVERAGING and conversion speed in setup().
+#define SAMPLER_SYNC_SPIN	32	// Max polls waiting for ADC_1 to finish a paired conversion
+#define SAMPLER_MAX_TAPS	2	// Max number of SampleTaps
+
+class BurstCapture;
+
+/*
+class SampleTap is an abstract class for anything that wants every raw sample as it is converted.
+Both methods run in ADCSampler's ISR, so they must be short and must not print. cycles is the sampler clock.
+*/
+class SampleTap {
+public:
+	virtual void	beginScan(uint32_t cycles) {}	// Called before the first slot of every scan
+	virtual void	record(ADCData *data, uint16_t raw, uint32_t cycles) = 0;
+};
+
+/*
+One PDB trigger worth of work. adc0_data is converted on ADC_0. If adc1_data is set it is converted on ADC_1 by the
+same trigger, so both samples are taken at the same instant. A channel shared by several slots, such as the voltage of
+two powers, is still converted in each of them for the pair, but only its first slot pushes it to the ring and the taps.
+*/
+struct SamplerSlot {
+	ADCData	*adc0_data;
+	ADCData	*adc1_data;	// NULL for single channel slots
+	PowerData	*power;	// Receives every pair. NULL for single channel slots
+	bool	push0;	// adc0_data isn't pushed by an earlier slot
+	bool	push1;	// adc1_data isn't pushed by an earlier slot
+};
+
+/*
+class ADCSampler runs the ADCs continuously from the PDB timer.
+Every PDB trigger converts one slot. The ADC_0 conversion complete interrupt pushes the result(s) into the channel
+SampleRings (and the PowerData pair ring) and selects the pins for the next slot, so each slot is sampled at getRate() Hz.
+The rings are drained by ADCData::getADCreading() and PowerData::getData() in loop().
+Samples are timed by the sampler clock: a count in CPU cycles that advances by one PDB period per trigger. The DWT
+cycle counter stops while IdleManager has the core in WFI, but the PDB keeps running, so energy integration, capture
+rates and transient slopes stay right however long the core sleeps. Like the cycle counter it wraps every ~60 s.
+*/
+class ADCSampler {
+public:
+	ADCSampler(ADC &adc) {
+		_adc = &adc;
+		_slots = 0;
+		_slot = 0;
+		_rate_hz = SAMPLER_DEFAULT_RATE_HZ;
+		_clock = 0;
+		_clock_rem = 0;
+		_running = false;
+		_paired = false;
+		_capture = NULL;
+		_tap_count = 0;
+	}
+	bool	addChannel(ADCData &data);	// Call before begin()
+	bool	addPair(PowerData &power);	// Current on ADC_0 and voltage on ADC_1 together. Call before begin()
+	bool	begin(uint32_t rate_hz);
+	void	stop();
+	bool	setRate(uint32_t rate_hz);	// Per slot rate. Can be called while running.
+	uint32_t	getRate() { return _rate_hz; }
+	uint32_t	getMaxRate() { return _slots ? SAMPLER_MAX_CONVERSION_HZ / _slots : SAMPLER_MAX_CONVERSION_HZ; }
+	bool	isRunning() { return _running; }
+	uint32_t	getOverruns();	// Total samples dropped by all channel rings
+	ADCData	*findChannel(const char *name);	// Sampled channel with this name, or NULL
+	bool	addTap(SampleTap &tap);	// Call before begin()
+	bool	attachCapture(BurstCapture &capture);	// Adds capture as a tap and lets it own the sample rate while busy
+	bool	isCapturing();	// A capture owns the sample rate
+	void	isr();	// Must be called from adc0_isr()
+private:
+	void	_selectPins(uint8_t slot);
+	bool	_isPushed(ADCData *data);	// An existing slot already pushes data
+	void	_setPeriod();	// Sampler clock step for the current trigger rate
+	ADC	*_adc;
+	SamplerSlot	_slot_list[SAMPLER_MAX_SLOTS];
+	uint8_t	_slots;	// Number of registered slots
+	volatile uint8_t	_slot;	// Slot currently being converted
+	uint32_t	_rate_hz;	// Per slot
+	uint32_t	_clock;	// Sampler clock, in CPU cycles
+	uint32_t	_trigger_hz;	// PDB triggers per second, across all slots
+	uint32_t	_period_cycles;	// Whole CPU cycles per trigger
+	uint32_t	_period_rem;	// F_CPU % _trigger_hz, carried in _clock_rem so the clock doesn't drift
+	uint32_t	_clock_rem;	// Fraction of a cycle, in 1/_trigger_hz
+	bool	_running;
+	bool	_paired;	// true if any slot uses ADC_1
+	BurstCapture	*_capture;
+	SampleTap	*_taps[SAMPLER_MAX_TAPS];
+	uint8_t	_tap_count;
+};
+
+#define ADAPT_IDLE_RATE_HZ	200	// Rate while the load is quiet
+#define ADAPT_BURST_RATE_HZ	2000	// Rate during transients. Rings must hold one acquire task period at this rate.
+#define ADAPT_SLOPE_A_PER_S	5.0	// Change in mean current between blocks that starts a burst
+#define ADAPT_STD_DEV_A	0.5	// Spread of current within a block that starts a burst
+#define ADAPT_HOLD_MS	5000	// Time at a rate after the last trigger before halving it
+
+/*
+class AdaptiveRate raises the sampler to _burst_hz when the watched current moves fast or gets noisy, then steps it
+back down to _idle_hz, halving every _hold_ms once things settle.
+update() runs in the acquire task after the watched channel's getData(). Energy integration is timed by the sampler
+clock, which follows the rate, so the totals stay exact across rate changes.
+*/
+class AdaptiveRate {
+public:
+	AdaptiveRate(ADCSampler &sampler) {
+		_sampler = &sampler;
+		_watch = NULL;
+		_idle_hz = ADAPT_IDLE_RATE_HZ;
+		_burst_hz = ADAPT_BURST_RATE_HZ;
+		_slope_A_per_s = ADAPT_SLOPE_A_PER_S;
+		_std_dev_A = ADAPT_STD_DEV_A;
+		_hold_ms = ADAPT_HOLD_MS;
+		_last_mean_A = NAN;
+		_last_update_ms = 0;
+		_last_step_ms = 0;
+		_bursts = 0;
+		_enabled = true;
+	}
+	void	update();
+	void	setWatch(ADCData &watch) { _watch = &watch; }	// Nothing happens until a channel is watched
+	void	setEnabled(bool enabled) { _enabled = enabled; }
+	bool	isEnabled() { return _enabled; }
+	uint32_t	getBursts() { return _bursts; }	// Times a transient raised the rate
+	bool	setParam(const char *param, double value);
+	void	paramsToJson(JsonWriter &out);
+private:
+	ADCSampler	*_sampler;
+	ADCData	*_watch;
+	uint32_t	_idle_hz;
+	uint32_t	_burst_hz;
+	double	_slope_A_per_s;
+	double	_std_dev_A;
+	uint32_t	_hold_ms;
+	double	_last_mean_A;	// Previous block mean, NAN until the first block
+	uint32_t	_last_update_ms;
+	uint32_t	_last_step_ms;	// Last trigger or rate step
+	uint32_t	_bursts;
+	bool	_enabled;
+};
+
+/*
+class SampleRateData exposes the sampler rate as a RW broker parameter.
+Setting a value fixes the rate and turns adaptive mode off. AdaptiveRate settings, including "adaptive":1 to turn it
+back on, are set by passing an object.
+*/
+class SampleRateData : public BrokerData {
+public:
+	SampleRateData(const char *name, ADCSampler &sampler, AdaptiveRate &adaptive, uint8_t resp_width, uint8_t resp_dec) : BrokerData(name, "Hz", false, resp_width, resp_dec) {
+		_setKind(KIND_SAMPLE_RATE);
+		_sampler = &sampler;
+		_adaptive = &adaptive;
+		_data_value = _sampler->getRate();
+		_stampSampleTime();
+	}
+	double	getData() { _data_value = _sampler->getRate(); return _data_value; }
+	double	getValue() { return getData(); }
+	bool	setData(double rate_hz);
+	bool	setParam(const char *param, double value) { return _adaptive->setParam(param, value); }
+	void	paramsToJson(JsonWriter &out) { _adaptive->paramsToJson(out); }
+private:
+	ADCSampler	*_sampler;
+	AdaptiveRate	*_adaptive;
+};
+
+#endif
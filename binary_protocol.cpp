@@ -0,0 +1,116 @@
+// Binary subscription frames. See binary_protocol.h.
+
+#include "binary_protocol.h"
+#include <string.h>
+
+void BinaryFrame::begin(uint8_t type, uint32_t seconds, uint16_t ms) {
+	_len = 0;
+	_payload[_len++] = type;
+	_payload[_len++] = 0; // Count, filled in by add()
+	_put32(seconds);
+	_put16(ms);
+}
+
+bool BinaryFrame::add(uint8_t channel, uint8_t dec, int32_t value, uint16_t age_ms) {
+	if (_payload[1] >= BIN_MAX_SAMPLES) return false;
+	_payload[_len++] = channel;
+	_payload[_len++] = dec;
+	_put32((uint32_t)value);
+	_put16(age_ms);
+	_payload[1]++;
+	return true;
+}
+
+uint16_t BinaryFrame::finish(uint8_t *out) {
+	const uint16_t crc = crc16Ccitt(_payload, _len);
+	_put16(crc);
+	uint16_t len = 0;
+	out[len++] = 0;
+	len += cobsEncode(_payload, _len, out + len);
+	out[len++] = 0;
+	_len -= BIN_CRC_BYTES; // So finish() can be called again
+	return len;
+}
+
+void BinaryFrame::_put16(uint16_t value) {
+	_payload[_len++] = value & 0xFF;
+	_payload[_len++] = value >> 8;
+}
+
+void BinaryFrame::_put32(uint32_t value) {
+	_put16(value & 0xFFFF);
+	_put16(value >> 16);
+}
+
+int32_t binaryScale(double value, uint8_t dec) {
+	static const double POW10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+	if (dec > 9) dec = 9;
+	const double scaled = value * POW10[dec];
+	// NaN fails both comparisons. BIN_NO_VALUE itself is never produced by a real value.
+	if (!(scaled > (double)INT32_MIN + 0.5 && scaled < (double)INT32_MAX - 0.5)) return BIN_NO_VALUE;
+	return (int32_t)(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+}
+
+uint16_t cobsEncode(const uint8_t *in, uint16_t len, uint8_t *out) {
+	uint16_t code_idx = 0;	// Where the length of the current run goes
+	uint16_t out_idx = 1;
+	uint8_t code = 1;
+	for (uint16_t i = 0; i < len; i++) {
+		if (in[i]) {
+			out[out_idx++] = in[i];
+			code++;
+		}
+		if (!in[i] || code == 0xFF) {
+			out[code_idx] = code;
+			code = 1;
+			code_idx = out_idx++;
+		}
+	}
+	out[code_idx] = code;
+	return out_idx;
+}
+
+uint16_t cobsDecode(const uint8_t *in, uint16_t len, uint8_t *out) {
+	uint16_t out_idx = 0;
+	for (uint16_t i = 0; i < len; ) {
+		const uint8_t code = in[i++];
+		if (code == 0 || i + code - 1 > len) return 0;
+		for (uint8_t n = 1; n < code; n++) {
+			if (in[i] == 0) return 0;
+			out[out_idx++] = in[i++];
+		}
+		if (code < 0xFF && i < len) out[out_idx++] = 0;
+	}
+	return out_idx;
+}
+
+static uint16_t get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static uint32_t get32(const uint8_t *p) { return get16(p) | ((uint32_t)get16(p + 2) << 16); }
+
+bool binaryParse(const uint8_t *payload, uint16_t len, BinHeader &header, BinSample *samples, uint8_t max_samples) {
+	if (len < BIN_HEADER_BYTES + BIN_CRC_BYTES) return false;
+	header.type = payload[0];
+	header.count = payload[1];
+	if (len != BIN_HEADER_BYTES + header.count * BIN_SAMPLE_BYTES + BIN_CRC_BYTES) return false;
+	if (crc16Ccitt(payload, len - BIN_CRC_BYTES) != get16(payload + len - BIN_CRC_BYTES)) return false;
+	header.seconds = get32(payload + 2);
+	header.ms = get16(payload + 6);
+	const uint8_t *sample = payload + BIN_HEADER_BYTES;
+	for (uint8_t n = 0; n < header.count && n < max_samples; n++, sample += BIN_SAMPLE_BYTES) {
+		samples[n].channel = sample[0];
+		samples[n].dec = sample[1];
+		samples[n].value = (int32_t)get32(sample + 2);
+		samples[n].age_ms = get16(sample + 6);
+	}
+	return true;
+}
+
+uint16_t crc16Ccitt(const uint8_t *data, uint16_t len, uint16_t crc) {
+	while (len--) {
+		crc ^= (uint16_t)(*data++) << 8;
+		for (uint8_t bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+		}
+	}
+	return crc;
+}
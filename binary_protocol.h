@@ -0,0 +1,66 @@
+// binary_protocol.h
+
+#ifndef _BINARY_PROTOCOL_h
+#define _BINARY_PROTOCOL_h
+
+#include <stdint.h>
+
+#define BIN_TYPE_PUBLISH	0x01	// Subscription update
+#define BIN_HEADER_BYTES	8	// type, count, seconds, milliseconds
+#define BIN_SAMPLE_BYTES	8	// channel, decimals, value, age
+#define BIN_CRC_BYTES	2
+#define BIN_MAX_SAMPLES	64	// As CHANNEL_TABLE_SIZE
+#define BIN_MAX_PAYLOAD	(BIN_HEADER_BYTES + BIN_MAX_SAMPLES * BIN_SAMPLE_BYTES + BIN_CRC_BYTES)
+#define BIN_MAX_FRAME	(BIN_MAX_PAYLOAD + BIN_MAX_PAYLOAD / 254 + 3)	// COBS overhead and both delimiters
+#define BIN_NO_VALUE	INT32_MIN	// NaN, or a value that doesn't fit at its decimals
+#define BIN_MAX_AGE_MS	0xFFFF	// Ages saturate here
+
+/*
+Compact binary subscription updates, for when JSON text is too verbose for the sample rate. See set_protocol.
+A frame is a payload, COBS encoded so it has no zero bytes, with a zero byte before and after it. JSON text never
+contains a zero, so frames and JSON replies can share the USB stream and a reader can always find the next frame.
+Payload, little endian:
+	type (1) | sample count (1) | message time: UTC seconds (4), milliseconds (2)
+	then for each sample: channel id (1) | decimals (1) | value * 10^decimals (int32) | age in ms (uint16)
+	then crc16Ccitt() of everything before it (2)
+Channel ids are as listed by list_data. age is message time minus the sample's time.
+Like json_rpc, this only uses the C library, so the host decoder in extras/binary_decode builds it as is.
+*/
+struct BinHeader {
+	uint8_t	type;
+	uint8_t	count;
+	uint32_t	seconds;
+	uint16_t	ms;
+};
+
+struct BinSample {
+	uint8_t	channel;
+	uint8_t	dec;
+	int32_t	value;	// Or BIN_NO_VALUE
+	uint16_t	age_ms;
+};
+
+/*
+class BinaryFrame packs one payload at a time into its buffer, then COBS encodes it.
+*/
+class BinaryFrame {
+public:
+	BinaryFrame() { begin(BIN_TYPE_PUBLISH, 0, 0); }
+	void	begin(uint8_t type, uint32_t seconds, uint16_t ms);
+	bool	add(uint8_t channel, uint8_t dec, int32_t value, uint16_t age_ms);	// false once BIN_MAX_SAMPLES are in
+	uint16_t	finish(uint8_t *out);	// Whole frame with delimiters into out, which holds BIN_MAX_FRAME. Returns its length.
+	uint8_t	getCount() { return _payload[1]; }
+private:
+	void	_put16(uint16_t value);
+	void	_put32(uint32_t value);
+	uint8_t	_payload[BIN_MAX_PAYLOAD];
+	uint16_t	_len;
+};
+
+int32_t	binaryScale(double value, uint8_t dec);	// Rounded value * 10^dec, or BIN_NO_VALUE
+uint16_t	cobsEncode(const uint8_t *in, uint16_t len, uint8_t *out);	// out holds len + len / 254 + 1. Returns its length.
+uint16_t	cobsDecode(const uint8_t *in, uint16_t len, uint8_t *out);	// Without the delimiters. 0 if in isn't valid COBS.
+bool	binaryParse(const uint8_t *payload, uint16_t len, BinHeader &header, BinSample *samples, uint8_t max_samples);	// false if the CRC or length is wrong. Fills up to max_samples.
+uint16_t	crc16Ccitt(const uint8_t *data, uint16_t len, uint16_t crc = 0xFFFF);	// Polynomial 0x1021. Pass the last result as crc to continue over another block.
+
+#endif
@@ -4,109 +4,42 @@
 //// Define Objects
 
 
-void BrokerData::dataToStr(char * out_str) {
-	dtostrf(_data_value, _resp_width, _resp_dec, out_str);
-}
-
 
 bool StaticData::setData(double new_value) {
 	_data_value = new_value;
-	setSampleTimeStr(_last_sample_time_str);
+	_stampSampleTime();
 	return true;
 
 }
 
-void DynamicData::subscribe(uint32_t sub_min_rate_ms, uint32_t sub_max_rate_ms) {
-	_subscription_rate_ms = sub_min_rate_ms;
-	_subscription_max_ms = sub_max_rate_ms;
-	_subscription_time = 0; // Should sync items already subscribed.
-}
-
-
-bool DynamicData::subscriptionDue() {
-	/* Used to determine if it's time to report a subscription*/
-	bool report_value = false;
-	if (_subscription_rate_ms == 0) return false; // Not subscribed
-	else { // subscribed
-		if (isOnChange()) {
-			// only report if value has changed or we have exceeded _subscription_max_ms
-			if (_data_changed && ((millis() - _subscription_time) > _subscription_rate_ms)) report_value = true;
-			else if ((millis() - _subscription_time) > _subscription_max_ms) report_value =  true;
-		}
-		else { // it's "on new", so it's purely time based.
-			if ((millis() - _subscription_time) > _subscription_rate_ms) report_value = true;
-		}
-	}
-	if (report_value) _data_changed = false; // indicate that this value has been reported via subscription
-	return report_value;
-}
-
 uint32_t DynamicData::_getTimeDelta() {
 	// Records current sample time, and returns time since last sample in ms.
 	uint32_t current_sample_time = millis();
 	// Works with millis() roll over since we are using unsigned long
-	uint32_t time_delta = current_sample_time - _last_sample_time;
-	_last_sample_time = current_sample_time;
-	setSampleTimeStr(_last_sample_time_str);
+	uint32_t time_delta = current_sample_time - channels.getSampleMs(_ch);
+	channels.setSampleMs(_ch, current_sample_time);
+	_stampSampleTime();
 	return time_delta;
 }
 
 
-uint8_t DynamicData::_checkMinMax() {
-	//Checks if there is a new min and max. Returns:
-	// 0 = no changes
-	// 1 = New min
-	// 2 = new max
-	// 3 = new min & max (usally first value)
-	uint8_t newMinMax = 0;
-	if (!isnan(_data_value)) {
-		// We have a real value
-		if ((_data_value > _data_max) | isnan(_data_max)) {
-			if (true) {
-				Serial1.printf("Setting _data_max to "); Serial1.print(_data_value);
-				Serial1.print(" for "); Serial1.println(getName());
-			}
-			_data_max = _data_value;
-			newMinMax +=2;
-		}
-		if ((_data_value < _data_min) | isnan(_data_min)) {
-			if (true) {
-				Serial1.print("Setting _data_min to "); Serial1.print(_data_value);
-				Serial1.print(" for "); Serial1.println(getName());
-			}
-			_data_min = _data_value;
-			newMinMax +=1;
-		}
-	}
-	return newMinMax;
-}
-
 bool DynamicData::_setDataValue(double new_value) {
-	// See if value has changed.
-	if (new_value == _data_value) {
-		return false;
-	}
-	else {
-		_data_value = new_value;
-		_data_changed = true;
-		setSampleTimeStr(_last_sample_time_str);
-		_last_sample_time = millis();
-		return true;
-	}
-
+	// The table flags the change, stamps the time and tracks min and max
+	return channels.setValue(_ch, new_value);
 }
 
 double TimeData::getData() {
 	double data_out;
+	const tmElements_t &tm = calendar(now()); // Shared with the other date or time and with timestamps
 	if (_is_date) {
-		data_out = (double)year() * 10000;
-		data_out += ((double)month() * 100);
-		data_out += (double)day();
+		data_out = (double)tmYearToCalendar(tm.Year) * 10000;
+		data_out += ((double)tm.Month * 100);
+		data_out += (double)tm.Day;
 	}
 	else {
-		data_out = (double)(hour()) * 10000;
-		data_out += (double)(minute()) * 100;
-		data_out += (double)(second());
+		data_out = (double)(tm.Hour) * 10000;
+		data_out += (double)(tm.Minute) * 100;
+		data_out += (double)(tm.Second);
 	}
 	_data_value = data_out;
 	return _data_value;
@@ -142,7 +75,8 @@ bool TimeData::setData(double date_or_time) {
 	}
 	setTime(Hrs, mins, secs, DD, MM, ccyy); // Sets software clock
 	Teensy3Clock.set(now()); // Sets RTC to software clock.
-	setSampleTimeStr(_last_sample_time_str);
+	rtcResync(); // Setting the RTC moves its second edge
+	_stampSampleTime();
 	 /*
 	 if (S1DEBUG) {
 		Serial1.print("input: "); Serial1.println(_data_value);
@@ -160,10 +94,10 @@ bool TimeData::setData(double date_or_time) {
 
 // 
 
-void setSampleTimeStr(char splTimeStr[15],bool islong) { // CCYYMMDDHHmmss\0
+void setSampleTimeStr(char *splTimeStr,bool islong) { // CCYYMMDDHHmmss\0
 	/* Set date_time string to current date and time
-	long: "2017-09-06 11:24:23.96"
+	long: "2017-09-06 11:24:23.960"
 	*/
-	if (islong) snprintf(splTimeStr, 15, "%4u-%02u-%02u %02u:%02u:%02u.00", year(), month(), day(), hour(), minute(), second());
-	else snprintf(splTimeStr, 15,"%4u%02u%02u%02u%02u%02u", year(), month(), day(), hour(), minute(), second());
+	if (islong) timestampToLongStr(timestampNow(), splTimeStr);
+	else timestampToStr(timestampNow(), splTimeStr);
 }
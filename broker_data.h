@@ -1,6 +1,9 @@
 
 #include <Arduino.h> 
 #include <TimeLib.h>
+#include "channel_stats.h"
+#include "channel_table.h"
+#include "json_writer.h"
 
 #ifndef _BROKER_DATA_h
 #define _BROKER_DATA_h
@@ -15,10 +18,11 @@
 
 /*
 	class BrokerData is an abstract class for all data objects
+	Each object registers itself in the global ChannelTable, which holds its value, min, max and subscription state.
 */
 class BrokerData {
 public:
-	BrokerData(const char *name, const char *unit,bool ro,uint8_t resp_width,uint8_t resp_dec) {
+	BrokerData(const char *name, const char *unit,bool ro,uint8_t resp_width,uint8_t resp_dec) : _ch(channels.add(this)), _data_value(channels.valueRef(_ch)) {
 		strncpy(_data_name, name, BROKER_DATA_NAME_LENGTH);
 		strncpy(_data_unit, unit, BROKER_DATA_UNIT_LENGTH);
 		_ro = ro;
@@ -28,32 +32,39 @@ public:
 	const char	*getName() { return _data_name; }
 	const char	*getUnit() { return _data_unit; }
 	bool		isRO() { return _ro; }
-	char *	getSplTimeStr() { return _last_sample_time_str; }
-	void	dataToStr(char * out_str);
+	void	sampleTimeToStr(char *out_str) { timestampToStr(channels.getSampleTime(_ch), out_str); }	// out_str holds TIMESTAMP_STR_LEN
+	uint16_t	getSampleTimeMs() { return channels.getSampleTime(_ch).ms; }	// Milliseconds past the sampleTimeToStr() second
+	void	dataToJson(JsonWriter &out) { out.fixed(_data_value, _resp_width, _resp_dec); }	// The value with this object's width and decimals, as the next value
+	void	valueToJson(JsonWriter &out, double value) { out.fixed(value, _resp_width, _resp_dec); }	// Formats any value the same way
+	uint8_t	getIndex() { return _ch; }	// Channel number in the ChannelTable
+	uint8_t	getDecimals() { return _resp_dec; }
+	// Hot state kept in the ChannelTable
+	bool	isVerbose() { return channels.hasFlag(_ch, CH_VERBOSE); }
+	double	getMax() { return channels.getMax(_ch); }
+	double	getMin() { return channels.getMin(_ch); }
+	void	resetMinMax() { channels.resetMinMax(_ch); }
+	uint32_t	getSampleTime() { return channels.getSampleMs(_ch); }
+	void	subscribe(uint32_t sub_min_rate_ms, uint32_t sub_max_rate_ms) { channels.subscribe(_ch, sub_min_rate_ms, sub_max_rate_ms); }
+	void	unsubscribe() { channels.unsubscribe(_ch); }
+	bool	isSubscribed() { return channels.isSubscribed(_ch); }
+	void	setSubOnChange(bool on_change) { channels.setFlag(_ch, CH_ON_CHANGE, on_change); }
+	void	setVerbose(bool verbose) { channels.setFlag(_ch, CH_VERBOSE, verbose); }
 	// virtual methods
-	virtual bool	subscriptionDue() { return false; }
-	virtual bool	isVerbose() { return false; }
-	virtual double	getMax() { return getData(); }
-	virtual double	getMin() { return getData(); }
-	virtual uint32_t	getSampleTime() { return 0; }
-	virtual void	unsubscribe() {};
-	virtual void	subscribe(uint32_t, uint32_t) {};
-	virtual void	setSubscriptionTime() {};
-	virtual void	setSubOnChange(bool) {};
-	virtual void	setVerbose(bool) {};
-	virtual void	resetMin() {};
-	virtual void	resetMax() {};
+	virtual bool	takeStats(StatsSnapshot &stats, uint8_t reader) { return false; }	// Returns stats since reader's (STATS_STATUS or STATS_SUBSCRIBE) last call and starts its new interval
+	virtual bool	setParam(const char *param, double value) { return false; }	// Sets a named configuration parameter
+	virtual void	paramsToJson(JsonWriter &out) {}	// Writes "param":value for each parameter
 	// Pure virtual methods
 	virtual double	getValue() = 0;
 	virtual double getData() = 0;
 	virtual bool setData(double set_value) = 0;
 
 protected:
-	bool	_dynamic;
-	double	_data_value;
-	char	_last_sample_time_str[15]; // string representing time of last sample
-	uint8_t	_resp_width;		// dtostrf() width
-	uint8_t	_resp_dec;			// dtostrf() decimal places
+	void	_setKind(uint8_t kind) { channels.setKind(_ch, kind); }
+	void	_stampSampleTime() { channels.stampSampleTime(_ch); }	// For values that don't go through the table's setValue()
+	const uint8_t	_ch;	// Must stay ahead of _data_value, which is bound to it
+	double	&_data_value;	// This object's slot in the ChannelTable
+	uint8_t	_resp_width;		// formatFixed() width
+	uint8_t	_resp_dec;			// formatFixed() decimal places
 private:
 	char	_data_name[BROKER_DATA_NAME_LENGTH];
 	char	_data_unit[BROKER_DATA_UNIT_LENGTH];
@@ -67,7 +78,7 @@ class StaticData is an class for all data objects which only change based on mes
 class StaticData : public BrokerData {
 public:
 	StaticData(const char *name, const char *unit,double initial_value, uint8_t resp_width, uint8_t resp_dec) : BrokerData(name, unit, false, resp_width, resp_dec) {
-		_dynamic = false;
+		_setKind(KIND_STATIC);
 		setData(initial_value);
 	}
 	double	getData() {return getValue();}
@@ -84,47 +95,17 @@ class DynamicData is an abstract intermediate class for all data objects which h
 class DynamicData : public BrokerData {
 public:
 	DynamicData(const char *name, const char *unit, bool ro, uint8_t resp_width, uint8_t resp_dec) : BrokerData(name, unit, ro, resp_width, resp_dec) {
-		_dynamic = true;
-		_subscription_rate_ms = 0; // 0  is not subscribed
-		_last_sample_time = 0;
-		_subscription_time = 0;
-		_sub_verbose = true;
-		_sub_on_change = true;
-		_data_value = NAN;
-		_data_max = NAN;
-		_data_min = NAN;
+		channels.setFlag(_ch, CH_DYNAMIC | CH_VERBOSE | CH_ON_CHANGE, true);
 	}
-	double	getMax() { return _data_max; }
-	double	getMin() { return _data_min; }
-	void	resetMin() { _data_min = NAN; }
-	void	resetMax() { _data_max = NAN; }
-	uint32_t	getSampleTime() { return _last_sample_time; }
-	void	subscribe(uint32_t sub_min_rate_ms, uint32_t sub_max_rate_ms);
-	void	setSubOnChange(bool on_change) { _sub_on_change = on_change; }
-	bool	isOnChange() { return _sub_on_change; }
-	void	subscribe(uint32_t sub_rate_ms) { subscribe(sub_rate_ms, 0); } // _subscription_max_ms defaults to 0 
-	void	unsubscribe() { _subscription_rate_ms = 0; _subscription_time = 0; }
-	bool	isSubscribed() { return (bool)_subscription_rate_ms; }
-	bool	subscriptionDue();
-	uint32_t	getSubscriptionRate() { return _subscription_rate_ms; }
-	void		setSubscriptionTime() { _subscription_time = millis(); } // Called when subscription is generated.
-	bool		hasDataChanged() { return _data_changed; }
-	void		setVerbose(bool verbose) { _sub_verbose = verbose; }
-	bool		isVerbose() { return _sub_verbose; }
+	bool	isOnChange() { return channels.hasFlag(_ch, CH_ON_CHANGE); }
+	using	BrokerData::subscribe;
+	void	subscribe(uint32_t sub_rate_ms) { BrokerData::subscribe(sub_rate_ms, 0); } // _sub_max_ms defaults to 0
+	uint32_t	getSubscriptionRate() { return channels.getSubscriptionRate(_ch); }
+	bool		hasDataChanged() { return channels.hasFlag(_ch, CH_CHANGED); }
 protected:
 	bool	_setDataValue(double new_value) ;
-	uint8_t		_checkMinMax();  	//Checks if there is a new min and max. Returns:
+	void	_trackMinMax() { channels.setFlag(_ch, CH_MIN_MAX, true); }	// Min and max follow every new value
 	uint32_t	_getTimeDelta();	// Records current sample time, and returns time since last sample in ms.
-	double	_data_max;
-	double	_data_min;
-private:
-	uint32_t	_subscription_rate_ms; // in milli-seconds
-	uint32_t	_subscription_max_ms; // Used on-change
-	uint32_t	_subscription_time;	// Time of last subscription message from millis()
-	uint32_t	_last_sample_time;	// Time of last sample from millis()
-	bool		_data_changed;	// Set to true when data changes and to false when new value is reported in subscription
-	bool	_sub_verbose;	// is this parameter's subscription verbose or terse?
-	bool	_sub_on_change; // report only new values when True
 };
 
 
@@ -133,6 +114,7 @@ private:
 class TimeData : public DynamicData{
 public:
 	TimeData(const char *name, bool is_a_date, uint8_t resp_width, uint8_t resp_dec) :DynamicData(name, (is_a_date?"CCYYMMDD":"HHmmss"), false, resp_width, resp_dec) {
+		_setKind(KIND_TIME);
 		_is_date = is_a_date;
 	}
 	double getData();
@@ -143,5 +125,5 @@ private:
 };
 
 
-void setSampleTimeStr(char splTimeStr[15], bool islong = false);
+void setSampleTimeStr(char *splTimeStr, bool islong = false);	// Needs TIMESTAMP_STR_LEN, or TIMESTAMP_LONG_LEN if islong
 #endif
\ No newline at end of file
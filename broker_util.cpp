@@ -12,9 +12,10 @@ uint16_t printResultStr(char *stat_buff, uint16_t  d_idx) {
 }
 
 uint16_t addMsgTime(char *stat_buff, uint16_t  d_idx,const char * tz,bool hasID) {
-	char msgTime[15];
-	setSampleTimeStr(msgTime);
-	d_idx += sprintf(stat_buff + d_idx, ",\"message_time\":{\"value\":%s,\"units\":\"%s\"}", msgTime, tz);
+	char msgTime[TIMESTAMP_STR_LEN];
+	const Timestamp now_ts = timestampNow();
+	timestampToStr(now_ts, msgTime);
+	d_idx += sprintf(stat_buff + d_idx, ",\"message_time\":{\"value\":%s,\"ms\":%u,\"units\":\"%s\"}", msgTime, now_ts.ms, tz);
 	if (!hasID) d_idx += sprintf(stat_buff + d_idx, "}}");
 	return d_idx;
 }
@@ -24,6 +25,145 @@ uint16_t addMsgId(char *stat_buff, uint16_t  d_idx, const int16_t json_id) {
 	return d_idx;
 }
 
+void printResultStr(JsonWriter &out) {
+	out.beginObject().beginObject("result");
+}
+
+void addMsgTime(JsonWriter &out, const char * tz, bool hasID) {
+	char msgTime[TIMESTAMP_STR_LEN];
+	const Timestamp now_ts = timestampNow();
+	timestampToStr(now_ts, msgTime);
+	out.beginObject("message_time");
+	out.key("value").rawValue(msgTime);	// CCYYMMDDHHmmss as a number
+	out.key("ms").value(now_ts.ms);
+	out.key("units").value(tz);
+	out.endObject();
+	if (!hasID) out.endObject().endObject();
+}
+
+void addStats(JsonWriter &out, BrokerData *broker_obj, uint8_t reader) {
+	// Adds statistics since reader last reported this parameter, if it keeps them. Starts reader's new interval.
+	StatsSnapshot stats;
+	if (!broker_obj->takeStats(stats, reader)) return;
+	out.key("mean");
+	broker_obj->valueToJson(out, stats.mean);
+	out.key("rms");
+	broker_obj->valueToJson(out, stats.rms);
+	out.key("std_dev");
+	broker_obj->valueToJson(out, stats.std_dev);
+	out.key("ripple");
+	broker_obj->valueToJson(out, stats.ripple);
+	out.key("samples").value(stats.count);
+}
+
+void addWindow(JsonWriter &out, BrokerData *broker_obj, uint8_t window) {
+	// Adds min, max and mean over one of the WindowStats windows, if this parameter keeps them
+	WindowSnapshot snapshot;
+	if (!channels.getWindow(broker_obj->getIndex(), window, snapshot)) return;
+	out.beginObject("window");
+	out.key("s").value(snapshot.window_s);
+	out.key("min");
+	broker_obj->valueToJson(out, snapshot.min);
+	out.key("max");
+	broker_obj->valueToJson(out, snapshot.max);
+	out.key("mean");
+	broker_obj->valueToJson(out, snapshot.mean);
+	out.key("count").value(snapshot.count);
+	out.key("span_ms").value(snapshot.span_ms);
+	out.endObject();
+}
+
+void addMsgId(JsonWriter &out, const int16_t json_id) {
+	out.endObject();
+	out.key("id").value(json_id);
+	out.endObject();
+}
+
+void subscriptionToJson(JsonWriter &out, const bool datamap[], const char * tz, bool verbose) {
+	out.beginObject();
+	out.key("method").value("subscription");
+	out.beginObject("params");
+	for (uint8_t obj_no = 0; obj_no < channels.getCount(); obj_no++) {
+		if (datamap[obj_no] == true) {
+			BrokerData *broker_obj = channels.getObject(obj_no);
+			out.beginObject(broker_obj->getName());
+			out.key("value");
+			broker_obj->dataToJson(out);
+			if (verbose && channels.hasFlag(obj_no, CH_VERBOSE)) {
+				out.key("units").value(broker_obj->getUnit());
+				// Only report min and max if they exist
+				double min_d = channels.getMin(obj_no);
+				double max_d = channels.getMax(obj_no);
+				if (min_d == min_d) {
+					out.key("min");
+					broker_obj->valueToJson(out, min_d);
+				}
+				if (max_d == max_d) {
+					out.key("max");
+					broker_obj->valueToJson(out, max_d);
+				}
+				addStats(out, broker_obj, STATS_SUBSCRIBE);
+				char timeStr[TIMESTAMP_STR_LEN];
+				broker_obj->sampleTimeToStr(timeStr);
+				out.key("sample_time").value(timeStr);
+				out.key("sample_ms").value(broker_obj->getSampleTimeMs());
+			}
+			out.endObject(); // Close out this parameter
+		}
+	}
+	addMsgTime(out, tz, false);
+}
+
+uint16_t subscriptionToFrame(uint8_t *frame, const bool datamap[]) {
+	// Values and their ages only. Units, decimals and names come from list_data.
+	static BinaryFrame payload; // Kept off the stack
+	const Timestamp now_ts = timestampNow();
+	payload.begin(BIN_TYPE_PUBLISH, now_ts.sec, now_ts.ms);
+	for (uint8_t obj_no = 0; obj_no < channels.getCount(); obj_no++) {
+		if (datamap[obj_no] == true) {
+			const Timestamp &sample_ts = channels.getSampleTime(obj_no);
+			const int32_t age_ms = (int32_t)(now_ts.sec - sample_ts.sec) * 1000 + now_ts.ms - sample_ts.ms;
+			const uint16_t age = (age_ms < 0) ? 0 : (age_ms > BIN_MAX_AGE_MS) ? BIN_MAX_AGE_MS : age_ms;
+			payload.add(obj_no, channels.getObject(obj_no)->getDecimals(), binaryScale(channels.valueRef(obj_no), channels.getObject(obj_no)->getDecimals()), age);
+		}
+	}
+	return payload.finish(frame);
+}
+
+void benchmarkProtocols(Print &out, const char * tz) {
+	/* Encodes a subscription update for every channel, values only as a kHz stream would send, into a RAM buffer,
+	both as JSON and as a binary frame.
+	*/
+	const uint8_t BENCH_MESSAGES = 32;
+	bool datamap[CHANNEL_TABLE_SIZE];
+	for (uint8_t obj_no = 0; obj_no < CHANNEL_TABLE_SIZE; obj_no++) datamap[obj_no] = obj_no < channels.getCount();
+	if (channels.getCount() == 0) return;
+	static char json[MAIN_BUFFER_SIZE];
+	static uint8_t frame[BIN_MAX_FRAME];
+	uint16_t json_len = 0, frame_len = 0;
+	uint32_t start = cycleCount();
+	for (uint8_t n = 0; n < BENCH_MESSAGES; n++) {
+		JsonWriter writer(json, sizeof(json));
+		subscriptionToJson(writer, datamap, tz, false);
+		json_len = writer.getLength();
+	}
+	const uint32_t json_cycles = (cycleCount() - start) / BENCH_MESSAGES;
+	start = cycleCount();
+	for (uint8_t n = 0; n < BENCH_MESSAGES; n++) frame_len = subscriptionToFrame(frame, datamap);
+	const uint32_t frame_cycles = (cycleCount() - start) / BENCH_MESSAGES;
+	out.print("Subscription of ");
+	out.print(channels.getCount());
+	out.println(" channels, bytes/sample and cycles/message:");
+	out.print("  json ");
+	out.print((double)(json_len + 2) / channels.getCount(), 1); // With the line end
+	out.print(" ");
+	out.println(json_cycles);
+	out.print("  cobs ");
+	out.print((double)frame_len / channels.getCount(), 1);
+	out.print(" ");
+	out.println(frame_cycles);
+}
+
 
 uint32_t freeRam() {
 #ifdef __AVR__
@@ -55,15 +195,3 @@ void printFreeRam(const char * msg) {
 	Serial1.print(F("Free RAM ("));Serial1.print(msg);Serial1.print("):");Serial1.println(freeRam());
 }
 
-
-uint8_t checkSubscriptions(bool datamap[], BrokerData *broker_objs[], const uint8_t broker_obj_count) {
-	uint8_t subs = 0;
-	for (uint8_t obj_no = 0; obj_no < broker_obj_count; obj_no++) {
-		if (broker_objs[obj_no]->subscriptionDue()) {
-			datamap[obj_no] = true;
-			subs++;
-		}
-		else datamap[obj_no] = false;
-	}
-	return subs;
-}
@@ -3,24 +3,31 @@
 #ifndef _BROKER_UTIL_h
 #define _BROKER_UTIL_h
 
-#define S1DEBUG 1
 
-#define MAIN_BUFFER_SIZE 1500
+#define MAIN_BUFFER_SIZE 1500	// Request buffer, and reply buffer for the handlers that don't stream
 
 #include <Arduino.h> 
 #include "broker_data.h"
+#include "binary_protocol.h"	// crc16Ccitt()
 
 
 
 uint16_t	printResultStr(char *stat_buff, uint16_t  d_idx);
 uint16_t	addMsgTime(char *stat_buff, uint16_t  d_idx, const char * tz, bool has_id);
 uint16_t	addMsgId(char *stat_buff, uint16_t  d_idx, const int16_t json_id);
+// The same for replies built with a JsonWriter, and the per channel additions they use
+void	printResultStr(JsonWriter &out);
+void	addMsgTime(JsonWriter &out, const char * tz, bool has_id);
+void	addMsgId(JsonWriter &out, const int16_t json_id);
+void	addStats(JsonWriter &out, BrokerData *broker_obj, uint8_t reader);	// reader is STATS_STATUS or STATS_SUBSCRIBE
+void	addWindow(JsonWriter &out, BrokerData *broker_obj, uint8_t window);
+// Subscription updates for the channels set in datamap. Channel values must already be updated.
+void	subscriptionToJson(JsonWriter &out, const bool datamap[], const char * tz, bool verbose = true);	// verbose false leaves out units, min, max, stats and times on every channel
+uint16_t	subscriptionToFrame(uint8_t *frame, const bool datamap[]);	// frame holds BIN_MAX_FRAME. Returns its length.
+void	benchmarkProtocols(Print &out, const char * tz);	// Bytes per sample and cycles per message, JSON against binary frames
 
 void		printFreeRam(const char * msg);
 uint32_t	freeRam();
 
-
-uint8_t checkSubscriptions(bool datamap[], BrokerData *broker_objs[], const uint8_t broker_obj_count);
-
 #endif
 
@@ -0,0 +1,116 @@
+// Burst capture of raw ADC samples
+
+#include "capture.h"
+#include "broker_util.h"
+
+
+bool sendFrame(Print &out, uint16_t block, const uint16_t *samples, uint16_t count) {
+	static uint8_t frame[CAPTURE_FRAME_BYTES];
+	if (count > CAPTURE_BLOCK_SAMPLES) return false;
+	uint16_t idx = 0;
+	frame[idx++] = CAPTURE_FRAME_SYNC & 0xFF;
+	frame[idx++] = CAPTURE_FRAME_SYNC >> 8;
+	frame[idx++] = block & 0xFF;
+	frame[idx++] = block >> 8;
+	frame[idx++] = count & 0xFF;
+	frame[idx++] = count >> 8;
+	for (uint16_t i = 0; i < count; i++) {
+		frame[idx++] = samples[i] & 0xFF;
+		frame[idx++] = samples[i] >> 8;
+	}
+	const uint16_t crc = crc16Ccitt(frame + 2, idx - 2);
+	frame[idx++] = crc & 0xFF;
+	frame[idx++] = crc >> 8;
+	out.write(frame, idx);
+	return true;
+}
+
+bool BurstCapture::arm(ADCData *channels[], uint8_t channel_count, uint16_t samples, uint32_t rate_hz) {
+	if (isBusy() || _state == CAPTURE_SENDING) return false;
+	if (channel_count == 0 || channel_count > CAPTURE_MAX_CHANNELS || samples < 2) return false;
+	if ((uint32_t)channel_count * samples > CAPTURE_MAX_SAMPLES) return false;
+	if (rate_hz == 0 || samples / rate_hz >= CAPTURE_MAX_SECONDS) return false;
+	const uint32_t prev_rate_hz = _sampler->getRate();
+	if (!_sampler->setRate(rate_hz)) return false;
+	_prev_rate_hz = prev_rate_hz;
+	_valid = false;
+	_channel_count = channel_count;
+	_samples = samples;
+	for (uint8_t ch = 0; ch < channel_count; ch++) {
+		_channels[ch] = channels[ch];
+		_counts[ch] = 0;
+	}
+	_remaining = channel_count * samples;
+	_state = CAPTURE_ARMED; // Last, the ISR starts looking once this is set
+	return true;
+}
+
+void BurstCapture::beginScan(uint32_t cycles) {
+	if (_state == CAPTURE_ARMED) {
+		_start_cycles = cycles;
+		_state = CAPTURE_RECORDING;
+	}
+	_seen_mask = 0;
+}
+
+void BurstCapture::record(ADCData *data, uint16_t raw, uint32_t cycles) {
+	if (_state != CAPTURE_RECORDING) return;
+	for (uint8_t ch = 0; ch < _channel_count; ch++) {
+		// A channel shared by two slots, like the battery voltage, is only recorded once per scan
+		if (_channels[ch] != data || (_seen_mask & (1 << ch))) continue;
+		_seen_mask |= (1 << ch);
+		if (_counts[ch] >= _samples) return;
+		_buf[ch * _samples + _counts[ch]++] = raw;
+		if (--_remaining == 0) {
+			_end_cycles = cycles;
+			_state = CAPTURE_DONE;
+		}
+		return;
+	}
+}
+
+void BurstCapture::service(Print &out) {
+	if (_state == CAPTURE_DONE) {
+		_sampler->setRate(_prev_rate_hz);
+		_valid = true;
+		char out_buffer[MAIN_BUFFER_SIZE];
+		uint16_t out_buffer_idx = 0;
+		out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "{\"method\":\"capture\",\"params\":{");
+		out_buffer_idx = headerToStr(out_buffer, out_buffer_idx);
+		out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "}}");
+		out.println(out_buffer);
+		_next_block = 0;
+		_state = CAPTURE_SENDING;
+	}
+	else if (_state == CAPTURE_SENDING) {
+		sendBlock(out, _next_block++);
+		if (_next_block >= getBlocks()) _state = CAPTURE_IDLE;
+	}
+}
+
+bool BurstCapture::sendBlock(Print &out, uint16_t block) {
+	if (!_valid || block >= getBlocks()) return false;
+	const uint16_t first = block * CAPTURE_BLOCK_SAMPLES;
+	const uint16_t count = min((uint16_t)CAPTURE_BLOCK_SAMPLES, (uint16_t)(_channel_count * _samples - first));
+	return sendFrame(out, block, _buf + first, count);
+}
+
+uint16_t BurstCapture::headerToStr(char *out_str, uint16_t idx) {
+	// Channel names with the gain and offset to turn counts into units: (counts - offset) * gain_q32 / 2^32
+	idx += sprintf(out_str + idx, "\"channels\":[");
+	for (uint8_t ch = 0; ch < _channel_count; ch++) {
+		if (ch) idx += sprintf(out_str + idx, ",");
+		idx += sprintf(out_str + idx, "{\"name\":\"%s\",\"units\":\"%s\",\"gain_q32\":%ld,\"offset_counts\":%ld}",
+			_channels[ch]->getName(), _channels[ch]->getUnit(), _channels[ch]->getGainQ32(), _channels[ch]->getOffsetCounts());
+	}
+	idx += sprintf(out_str + idx, "],\"samples\":%u,\"blocks\":%u", _samples, getBlocks());
+	if (_valid) {
+		// Rate by the sampler clock across the capture
+		char valueStr[FORMAT_MAX_LEN];
+		const double rate_hz = (double)F_CPU * (_samples - 1) / (double)(_end_cycles - _start_cycles);
+		formatFixed(valueStr, rate_hz, 1, 2);
+		idx += sprintf(out_str + idx, ",\"rate_hz\":%s", valueStr);
+	}
+	else idx += sprintf(out_str + idx, ",\"rate_hz\":%lu", _sampler->getRate());
+	return idx;
+}
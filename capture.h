@@ -0,0 +1,65 @@
+// capture.h
+
+#ifndef _CAPTURE_h
+#define _CAPTURE_h
+
+#include "adc_sampler.h"
+
+#define CAPTURE_MAX_SAMPLES	4096	// Raw samples across all channels. 8 kB of RAM, allocated once. See RAM_STATIC_BUDGET.
+#define CAPTURE_MAX_CHANNELS	4
+#define CAPTURE_BLOCK_SAMPLES	256	// Samples per binary frame
+#define CAPTURE_FRAME_SYNC	0xA55A	// Sent low byte first
+#define CAPTURE_FRAME_BYTES	(8 + 2 * CAPTURE_BLOCK_SAMPLES)	// Largest frame: sync, block, count, samples and CRC
+#define CAPTURE_MAX_SECONDS	50	// Capture must finish before the sampler clock wraps
+
+bool	sendFrame(Print &out, uint16_t block, const uint16_t *samples, uint16_t count);	// count <= CAPTURE_BLOCK_SAMPLES
+
+enum CAPTURE_STATE { CAPTURE_IDLE = 0, CAPTURE_ARMED = 1, CAPTURE_RECORDING = 2, CAPTURE_DONE = 3, CAPTURE_SENDING = 4 };
+
+/*
+class BurstCapture records raw counts from selected sampler channels into a fixed RAM buffer, then streams them back.
+arm() sets the sampler to the capture rate. Recording starts at the beginning of the next full scan so all channels are
+time aligned. The buffer holds one run of samples per channel, in the order the channels were asked for.
+The sampler's rings, filters and energy integration keep running as normal, and the previous rate comes back when
+recording ends.
+service() runs from a loop() task. It sends a JSON header and then one binary frame per call:
+	sync (0xA55A) | block number | sample count | samples | CRC16-CCITT of block number through samples
+All fields are uint16 little endian.
+*/
+class BurstCapture : public SampleTap {
+public:
+	BurstCapture(ADCSampler &sampler) {
+		_sampler = &sampler;
+		_state = CAPTURE_IDLE;
+		_channel_count = 0;
+		_samples = 0;
+		_valid = false;
+	}
+	bool	arm(ADCData *channels[], uint8_t channel_count, uint16_t samples, uint32_t rate_hz);
+	void	beginScan(uint32_t cycles);
+	void	record(ADCData *data, uint16_t raw, uint32_t cycles);
+	void	service(Print &out);
+	bool	sendBlock(Print &out, uint16_t block);	// Also used to resend a block after a CRC error
+	uint16_t	getBlocks() { return (_channel_count * _samples + CAPTURE_BLOCK_SAMPLES - 1) / CAPTURE_BLOCK_SAMPLES; }
+	bool	isBusy() { return _state == CAPTURE_ARMED || _state == CAPTURE_RECORDING || _state == CAPTURE_DONE; }
+	bool	isValid() { return _valid; }	// A finished capture is in the buffer
+	uint8_t	getState() { return _state; }
+	uint16_t	headerToStr(char *out_str, uint16_t idx);
+private:
+	ADCSampler	*_sampler;
+	ADCData	*_channels[CAPTURE_MAX_CHANNELS];
+	uint16_t	_buf[CAPTURE_MAX_SAMPLES];
+	volatile uint16_t	_counts[CAPTURE_MAX_CHANNELS];	// Samples recorded per channel
+	volatile uint16_t	_remaining;	// Samples still to record across all channels
+	volatile uint8_t	_seen_mask;	// Channels already recorded in this scan
+	volatile uint8_t	_state;
+	uint8_t	_channel_count;
+	uint16_t	_samples;	// Per channel
+	uint32_t	_prev_rate_hz;	// Restored when recording ends
+	uint32_t	_start_cycles;
+	uint32_t	_end_cycles;
+	uint16_t	_next_block;
+	bool	_valid;
+};
+
+#endif
@@ -0,0 +1,266 @@
+// Channel definitions stored in EEPROM. See channel_config.h.
+
+#include "channel_config.h"
+#include "broker_util.h"
+#include <EEPROM.h>
+
+const char *DEF_TYPE_STRINGS[DEF_TYPE_COUNT] = { "none", "voltage", "current", "power", "energy", "charge", "static", "date", "time", "sample_rate" };
+
+int8_t findDefType(const char *name) {
+	for (uint8_t type = DEF_NONE + 1; type < DEF_TYPE_COUNT; type++) {
+		if (!strcmp(DEF_TYPE_STRINGS[type], name)) return type;
+	}
+	return -1;
+}
+
+static const uint8_t POOL_SIZES[DEF_TYPE_COUNT] = { 0, POOL_VOLTAGE, POOL_CURRENT, POOL_POWER, POOL_ENERGY, POOL_CHARGE, POOL_STATIC, POOL_TIME, POOL_TIME, POOL_SAMPLE_RATE };
+
+static void readEeprom(uint16_t addr, void *data, uint16_t len) {
+	uint8_t *bytes = (uint8_t *)data;
+	for (uint16_t i = 0; i < len; i++) bytes[i] = EEPROM.read(addr + i);
+}
+
+static void updateEeprom(uint16_t addr, const void *data, uint16_t len) {
+	// Only bytes that differ are written, to spare the flash
+	const uint8_t *bytes = (const uint8_t *)data;
+	for (uint16_t i = 0; i < len; i++) EEPROM.update(addr + i, bytes[i]);
+}
+
+static uint16_t configCrc(const ConfigHeader &header, const ChannelDef *defs) {
+	// CRC16-CCITT over the header and definitions, as if they were one block
+	const uint16_t crc = crc16Ccitt((const uint8_t *)&header, sizeof(header));
+	return crc16Ccitt((const uint8_t *)defs, header.count * sizeof(ChannelDef), crc);
+}
+
+bool ChannelConfig::load() {
+	ConfigHeader header;
+	uint16_t crc;
+	readEeprom(CONFIG_EEPROM_ADDR, &header, sizeof(header));
+	if (header.magic != CONFIG_MAGIC || header.version != CONFIG_VERSION || header.count == 0 || header.count > CONFIG_MAX_DEFS) {
+		loadDefaults();
+		return false;
+	}
+	readEeprom(CONFIG_EEPROM_ADDR + sizeof(header), _defs, header.count * sizeof(ChannelDef));
+	readEeprom(CONFIG_EEPROM_ADDR + sizeof(header) + header.count * sizeof(ChannelDef), &crc, sizeof(crc));
+	_count = header.count;
+	if (crc != configCrc(header, _defs) || check() >= 0) {
+		loadDefaults();
+		return false;
+	}
+	_from_eeprom = true;
+	_saved = true;
+	return true;
+}
+
+void ChannelConfig::loadDefaults() {
+	memcpy(_defs, _defaults, _default_count * sizeof(ChannelDef));
+	_count = _default_count;
+	_saved = false;
+}
+
+bool ChannelConfig::save() {
+	if (check() >= 0) return false;
+	ConfigHeader header = { CONFIG_MAGIC, CONFIG_VERSION, _count };
+	const uint16_t crc = configCrc(header, _defs);
+	if (CONFIG_EEPROM_ADDR + sizeof(header) + _count * sizeof(ChannelDef) + sizeof(crc) > EEPROM.length()) return false;
+	updateEeprom(CONFIG_EEPROM_ADDR, &header, sizeof(header));
+	updateEeprom(CONFIG_EEPROM_ADDR + sizeof(header), _defs, _count * sizeof(ChannelDef));
+	updateEeprom(CONFIG_EEPROM_ADDR + sizeof(header) + _count * sizeof(ChannelDef), &crc, sizeof(crc));
+	_saved = true;
+	return true;
+}
+
+bool ChannelConfig::setDef(uint8_t i, const ChannelDef &def) {
+	if (i > _count || i >= CONFIG_MAX_DEFS) return false;
+	const ChannelDef old_def = _defs[i];
+	const uint8_t old_count = _count;
+	_defs[i] = def;
+	_defs[i].name[BROKER_DATA_NAME_LENGTH - 1] = '\0';
+	_defs[i].unit[BROKER_DATA_UNIT_LENGTH - 1] = '\0';
+	if (i == _count) _count++;
+	if (check() >= 0) {
+		// Put it back
+		_defs[i] = old_def;
+		_count = old_count;
+		return false;
+	}
+	_saved = false;
+	return true;
+}
+
+bool ChannelConfig::removeDef(uint8_t i) {
+	if (i >= _count) return false;
+	for (uint8_t later = i + 1; later < _count; later++) {
+		if (_defs[later].src == i || _defs[later].src_v == i) return false;
+	}
+	const ChannelDef removed = _defs[i];
+	for (uint8_t later = i + 1; later < _count; later++) {
+		// Sources after the removed one move down with it
+		if (_defs[later].src != CONFIG_NO_SRC && _defs[later].src > i) _defs[later].src--;
+		if (_defs[later].src_v != CONFIG_NO_SRC && _defs[later].src_v > i) _defs[later].src_v--;
+		_defs[later - 1] = _defs[later];
+	}
+	_count--;
+	if (check() >= 0) {
+		// Removing a power can leave its voltage on a pin only ADC_1 reaches. Put it back.
+		for (uint8_t later = _count; later > i; later--) {
+			_defs[later] = _defs[later - 1];
+			if (_defs[later].src != CONFIG_NO_SRC && _defs[later].src >= i) _defs[later].src++;
+			if (_defs[later].src_v != CONFIG_NO_SRC && _defs[later].src_v >= i) _defs[later].src_v++;
+		}
+		_defs[i] = removed;
+		_count++;
+		return false;
+	}
+	_saved = false;
+	return true;
+}
+
+int8_t ChannelConfig::check() {
+	uint8_t used[DEF_TYPE_COUNT] = { 0 };
+	for (uint8_t i = 0; i < _count; i++) {
+		if (!_checkDef(i)) return i;
+		if (++used[_defs[i].type] > POOL_SIZES[_defs[i].type]) return i;
+		if (used[DEF_DATE] + used[DEF_TIME] > POOL_TIME) return i; // Dates and times share a pool
+	}
+	return -1;
+}
+
+bool ChannelConfig::_checkDef(uint8_t i) {
+	const ChannelDef &def = _defs[i];
+	CurrentSensorParams sensor;
+	if (def.type == DEF_NONE || def.type >= DEF_TYPE_COUNT) return false;
+	if (def.name[0] == '\0' || memchr(def.name, '\0', BROKER_DATA_NAME_LENGTH) == NULL) return false;
+	for (uint8_t other = 0; other < i; other++) {
+		if (!strcmp(_defs[other].name, def.name)) return false; // Names must be unique
+	}
+	switch (def.type) {
+	case DEF_VOLTAGE:
+		// Voltage is converted on ADC_1 when paired, ADC_0 otherwise
+		if (!(_isPaired(i) ? _adc->adc1->checkPin(def.pin) : _adc->adc0->checkPin(def.pin))) return false;
+		return def.value >= 0 && def.value_low > 0;
+	case DEF_CURRENT:
+		if (!_adc->adc0->checkPin(def.pin)) return false;
+		return currentSensorParams(def.model, _vcc_mV, sensor);
+	case DEF_POWER:
+		if (!_isSrc(def.src, i, DEF_CURRENT) || !_isSrc(def.src_v, i, DEF_VOLTAGE)) return false;
+		return _adc->adc1->checkPin(_defs[def.src_v].pin); // Pairs convert voltage on ADC_1
+	case DEF_ENERGY:
+	case DEF_CHARGE:
+		return _isSrc(def.src, i, DEF_POWER);
+	case DEF_STATIC:
+		return memchr(def.unit, '\0', BROKER_DATA_UNIT_LENGTH) != NULL;
+	case DEF_SAMPLE_RATE:
+		return _isSrc(def.src, i, DEF_CURRENT);
+	}
+	return true;
+}
+
+bool ChannelConfig::_isPaired(uint8_t i) {
+	for (uint8_t later = i + 1; later < _count; later++) {
+		if (_defs[later].type == DEF_POWER && _defs[later].src_v == i) return true;
+	}
+	return false;
+}
+
+bool ChannelConfig::build() {
+	BrokerData *built[CONFIG_MAX_DEFS]; // By definition index
+	bool sampled[CONFIG_MAX_DEFS];
+	bool success = true;
+	if (_built) return false;
+	if (check() >= 0) loadDefaults(); // Never boot a set that doesn't hang together
+	_built = true;
+	for (uint8_t i = 0; i < _count; i++) {
+		const ChannelDef &def = _defs[i];
+		CurrentSensorParams sensor;
+		built[i] = NULL;
+		sampled[i] = false;
+		switch (def.type) {
+		case DEF_VOLTAGE:
+			pinMode(def.pin, INPUT);
+			built[i] = _voltage.create(def.name, *_adc, def.pin, (uint32_t)def.value, (uint32_t)def.value_low, def.width, def.dec);
+			break;
+		case DEF_CURRENT:
+			pinMode(def.pin, INPUT);
+			currentSensorParams(def.model, _vcc_mV, sensor);
+			if (def.f_pin < 0) sensor.funct = SENSOR_FUNCT_NONE;
+			built[i] = _current.create(def.name, *_adc, def.pin, sensor, def.f_pin, def.width, def.dec);
+			break;
+		case DEF_POWER: {
+			PowerData *power = _power.create(def.name, *static_cast<CurrentData *>(built[def.src]), *static_cast<VoltageData *>(built[def.src_v]), def.width, def.dec);
+			if (_sampler->addPair(*power)) sampled[def.src] = sampled[def.src_v] = true;
+			built[i] = power;
+			break;
+		}
+		case DEF_ENERGY:
+			built[i] = _energy.create(def.name, *static_cast<PowerData *>(built[def.src]), def.width, def.dec);
+			break;
+		case DEF_CHARGE:
+			built[i] = _charge.create(def.name, *static_cast<PowerData *>(built[def.src]), def.width, def.dec);
+			break;
+		case DEF_STATIC:
+			built[i] = _static.create(def.name, def.unit, (double)def.value, def.width, def.dec);
+			break;
+		case DEF_DATE:
+		case DEF_TIME:
+			built[i] = _time.create(def.name, def.type == DEF_DATE, def.width, def.dec);
+			break;
+		case DEF_SAMPLE_RATE:
+			_adaptive->setWatch(*static_cast<ADCData *>(built[def.src]));
+			built[i] = _rate.create(def.name, *_sampler, *_adaptive, def.width, def.dec);
+			break;
+		}
+	}
+	for (uint8_t i = 0; i < _count; i++) {
+		// Analog channels that aren't part of a pair are scanned on their own
+		if ((_defs[i].type == DEF_VOLTAGE || _defs[i].type == DEF_CURRENT) && !sampled[i]) {
+			if (!_sampler->addChannel(*static_cast<ADCData *>(built[i]))) success = false;
+		}
+	}
+	return success;
+}
+
+uint16_t ChannelConfig::defToStr(char *out_str, uint16_t idx, uint8_t i) {
+	// Only the fields the type uses
+	const ChannelDef &def = _defs[i];
+	char valueStr[FORMAT_MAX_LEN];
+	idx += sprintf(out_str + idx, "{\"type\":\"%s\",\"name\":\"%s\"", DEF_TYPE_STRINGS[def.type], def.name);
+	idx += sprintf(out_str + idx, ",\"width\":%u,\"dec\":%u", def.width, def.dec);
+	switch (def.type) {
+	case DEF_VOLTAGE:
+		idx += sprintf(out_str + idx, ",\"pin\":%u", def.pin);
+		formatFixed(valueStr, def.value, 1, 1);
+		idx += sprintf(out_str + idx, ",\"high\":%s", valueStr);
+		formatFixed(valueStr, def.value_low, 1, 1);
+		idx += sprintf(out_str + idx, ",\"low\":%s", valueStr);
+		break;
+	case DEF_CURRENT:
+		idx += sprintf(out_str + idx, ",\"pin\":%u,\"model\":\"%s\",\"f_pin\":%d", def.pin, currentSensorName(def.model), def.f_pin);
+		break;
+	case DEF_POWER:
+		idx += sprintf(out_str + idx, ",\"src\":%u,\"src_v\":%u", def.src, def.src_v);
+		break;
+	case DEF_ENERGY:
+	case DEF_CHARGE:
+	case DEF_SAMPLE_RATE:
+		idx += sprintf(out_str + idx, ",\"src\":%u", def.src);
+		break;
+	case DEF_STATIC:
+		formatFixed(valueStr, def.value, 1, def.dec);
+		idx += sprintf(out_str + idx, ",\"value\":%s,\"unit\":\"%s\"", valueStr, def.unit);
+		break;
+	}
+	idx += sprintf(out_str + idx, "}");
+	return idx;
+}
+
+uint16_t ChannelConfig::defsToStr(char *out_str, uint16_t idx, uint16_t max_idx) {
+	idx += sprintf(out_str + idx, ",\"defs\":[");
+	for (uint8_t i = 0; i < _count; i++) {
+		if (idx + 2 * BROKER_DATA_NAME_LENGTH + 100 > max_idx) break; // Room for the longest definition and the closing bracket
+		if (i) idx += sprintf(out_str + idx, ",");
+		idx = defToStr(out_str, idx, i);
+	}
+	idx += sprintf(out_str + idx, "]");
+	return idx;
+}
@@ -0,0 +1,140 @@
+// channel_config.h
+
+#ifndef _CHANNEL_CONFIG_h
+#define _CHANNEL_CONFIG_h
+
+#include <new>
+#include <utility>
+#include "E_Mon.h"
+#include "adc_sampler.h"
+
+#define CONFIG_EEPROM_ADDR	0	// Start of the blob in EEPROM
+#define CONFIG_MAGIC	0x4D45	// "EM"
+#define CONFIG_VERSION	1	// Bump when ChannelDef changes. A blob with another version is ignored.
+#define CONFIG_MAX_DEFS	20
+#define CONFIG_NO_SRC	0xFF	// src or src_v not used
+// Objects of each class that can be created from a configuration
+#define POOL_VOLTAGE	2
+#define POOL_CURRENT	3
+#define POOL_POWER	3	// Each paired power takes a sampler slot
+#define POOL_ENERGY	3
+#define POOL_CHARGE	3
+#define POOL_STATIC	4
+#define POOL_TIME	2	// Dates and times
+#define POOL_SAMPLE_RATE	1
+
+enum DEF_TYPE { DEF_NONE = 0, DEF_VOLTAGE, DEF_CURRENT, DEF_POWER, DEF_ENERGY, DEF_CHARGE, DEF_STATIC, DEF_DATE, DEF_TIME, DEF_SAMPLE_RATE, DEF_TYPE_COUNT };
+extern const char *DEF_TYPE_STRINGS[DEF_TYPE_COUNT];
+int8_t	findDefType(const char *name);	// DEF_TYPE or -1
+
+/*
+One channel as stored in EEPROM. Fields a type doesn't use are ignored.
+src and src_v are indexes of earlier definitions, so a channel can only be derived from channels built before it.
+*/
+struct ChannelDef {
+	uint8_t	type;	// DEF_TYPE
+	char	name[BROKER_DATA_NAME_LENGTH];
+	uint8_t	width;	// formatFixed() width and decimal places
+	uint8_t	dec;
+	uint8_t	pin;	// Analog pin (voltage, current)
+	uint8_t	model;	// ACS_MODELS (current)
+	int8_t	f_pin;	// Sensor function pin (current). <0 is not connected.
+	uint8_t	src;	// Current for power and sample rate, power for energy and charge
+	uint8_t	src_v;	// Voltage for power
+	float	value;	// High side divider resistor (voltage) or value (static)
+	float	value_low;	// Low side divider resistor (voltage)
+	char	unit[BROKER_DATA_UNIT_LENGTH];	// Static only
+} __attribute__((packed));
+
+struct ConfigHeader {
+	uint16_t	magic;
+	uint8_t	version;
+	uint8_t	count;	// ChannelDefs that follow. A CRC16-CCITT of header and defs comes after them.
+} __attribute__((packed));
+
+/*
+class ObjectPool holds up to N objects of one class in static storage.
+Objects are constructed in place by create() and live until reset, so nothing is ever allocated on the heap.
+*/
+template <typename T, uint8_t N>
+class ObjectPool {
+public:
+	ObjectPool() { _count = 0; }
+	template <typename... Args>
+	T	*create(Args&&... args) {
+		if (_count >= N) return NULL;
+		return new (_store[_count++]) T(std::forward<Args>(args)...);
+	}
+	T	*get(uint8_t i) { return (i < _count) ? reinterpret_cast<T *>(_store[i]) : NULL; }
+	uint8_t	getCount() { return _count; }
+private:
+	alignas(T) uint8_t	_store[N][sizeof(T)];
+	uint8_t	_count;
+};
+
+/*
+class ChannelConfig turns a packed list of ChannelDefs into the broker's channels.
+At boot load() stages the EEPROM copy, falling back to the sketch's defaults, and build() creates one object per
+definition in the pools and registers the ADC channels with the sampler. Objects are created in definition order,
+so that is also their ChannelTable order.
+The staged copy can then be edited and saved. Channels can't be torn down while running, so edits take effect at
+the next boot.
+*/
+class ChannelConfig {
+public:
+	ChannelConfig(ADC &adc, ADCSampler &sampler, AdaptiveRate &adaptive, uint16_t vcc_mV, const ChannelDef *defaults, uint8_t default_count) {
+		_adc = &adc;
+		_sampler = &sampler;
+		_adaptive = &adaptive;
+		_vcc_mV = vcc_mV;
+		_defaults = defaults;
+		_default_count = min(default_count, (uint8_t)CONFIG_MAX_DEFS);
+		_count = 0;
+		_from_eeprom = false;
+		_saved = false;
+		_built = false;
+	}
+	bool	load();	// false, with the defaults staged, if EEPROM is blank, corrupt or invalid
+	void	loadDefaults();
+	bool	save();	// Writes the staged copy if it is valid
+	bool	build();	// Creates the staged channels. Call once from setup(). false if a channel couldn't be sampled.
+	// The staged copy
+	uint8_t	getDefCount() { return _count; }
+	const ChannelDef	*getDef(uint8_t i) { return (i < _count) ? &_defs[i] : NULL; }
+	bool	setDef(uint8_t i, const ChannelDef &def);	// i == getDefCount() appends. Refused if it would make the set invalid.
+	bool	removeDef(uint8_t i);	// Refused if a later channel is derived from it
+	int8_t	check();	// Index of the first invalid definition, or -1
+	bool	isSaved() { return _saved; }	// Staged copy matches EEPROM
+	bool	isFromEeprom() { return _from_eeprom; }	// Running channels came from EEPROM rather than the defaults
+	uint16_t	defToStr(char *out_str, uint16_t idx, uint8_t i);
+	uint16_t	defsToStr(char *out_str, uint16_t idx, uint16_t max_idx);	// Appends ,"defs":[...]
+	// Running channels, in definition order
+	VoltageData	*getVoltage(uint8_t i) { return _voltage.get(i); }
+	CurrentData	*getCurrent(uint8_t i) { return _current.get(i); }
+	PowerData	*getPower(uint8_t i) { return _power.get(i); }
+private:
+	bool	_checkDef(uint8_t i);
+	bool	_isSrc(uint8_t src, uint8_t i, uint8_t type) { return src < i && _defs[src].type == type; }
+	bool	_isPaired(uint8_t i);	// A power definition pairs voltage definition i with a current
+	ADC	*_adc;
+	ADCSampler	*_sampler;
+	AdaptiveRate	*_adaptive;
+	uint16_t	_vcc_mV;	// Current sensor supply
+	const ChannelDef	*_defaults;
+	uint8_t	_default_count;
+	ChannelDef	_defs[CONFIG_MAX_DEFS];
+	uint8_t	_count;
+	bool	_from_eeprom;
+	bool	_saved;
+	bool	_built;
+	ObjectPool<VoltageData, POOL_VOLTAGE>	_voltage;
+	ObjectPool<CurrentData, POOL_CURRENT>	_current;
+	ObjectPool<PowerData, POOL_POWER>	_power;
+	ObjectPool<EnergyData, POOL_ENERGY>	_energy;
+	ObjectPool<ChargeData, POOL_CHARGE>	_charge;
+	ObjectPool<StaticData, POOL_STATIC>	_static;
+	ObjectPool<TimeData, POOL_TIME>	_time;
+	ObjectPool<SampleRateData, POOL_SAMPLE_RATE>	_rate;
+};
+
+#endif
@@ -0,0 +1,23 @@
+// Streaming per channel statistics
+
+#include "channel_stats.h"
+#include <math.h>
+
+#define STATS_Q32_ONE 4294967296.0
+
+
+bool ChannelStats::snapshot(int32_t gain_q32, StatsSnapshot &stats) const {
+	stats.count = _count;
+	if (_count == 0) return false;
+	const double units_per_count = (double)gain_q32 / STATS_Q32_ONE;
+	const double n = (double)_count;
+	const double mean = (double)_sum / n;
+	const double mean_sq = (double)_sum_sq / n;
+	double variance = mean_sq - mean * mean;
+	if (variance < 0) variance = 0; // Rounding when the signal is flat
+	stats.mean = mean * units_per_count;
+	stats.rms = sqrt(mean_sq) * fabs(units_per_count);
+	stats.std_dev = sqrt(variance) * fabs(units_per_count);
+	stats.ripple = (double)(_max - _min) * fabs(units_per_count);
+	return true;
+}
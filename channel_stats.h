@@ -0,0 +1,55 @@
+// channel_stats.h
+
+#ifndef _CHANNEL_STATS_h
+#define _CHANNEL_STATS_h
+
+#include <stdint.h>
+
+#define STATS_STATUS	0	// Interval reported by status
+#define STATS_SUBSCRIBE	1	// Interval reported by subscription updates
+#define STATS_READERS	2	// Each reader has its own interval, so one doesn't restart the other's
+
+/*
+Statistics for one reporting interval, in channel units.
+*/
+struct StatsSnapshot {
+	uint32_t	count;	// Samples in the interval
+	double	mean;
+	double	rms;	// Around the channel's zero, e.g. 0 A for a current
+	double	std_dev;
+	double	ripple;	// Peak to peak
+};
+
+/*
+class ChannelStats accumulates mean, RMS, variance and peak to peak of a channel at the full sample rate.
+add() is O(1) and integer only. Samples are counts with the channel offset already removed, so the sums are exact and
+the cancellation Welford's method guards against in floating point can't happen. Doubles are only used by snapshot().
+*/
+class ChannelStats {
+public:
+	ChannelStats() { reset(); }
+	void	reset() {
+		_count = 0;
+		_sum = 0;
+		_sum_sq = 0;
+		_min = INT32_MAX;
+		_max = INT32_MIN;
+	}
+	void	add(int32_t counts) {
+		_count++;
+		_sum += counts;
+		_sum_sq += (int64_t)counts * counts;
+		if (counts < _min) _min = counts;
+		if (counts > _max) _max = counts;
+	}
+	uint32_t	getCount() const { return _count; }
+	bool	snapshot(int32_t gain_q32, StatsSnapshot &stats) const;	// Converts to channel units. false if no samples.
+private:
+	uint32_t	_count;
+	int64_t	_sum;
+	int64_t	_sum_sq;
+	int32_t	_min;
+	int32_t	_max;
+};
+
+#endif
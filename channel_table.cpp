@@ -0,0 +1,148 @@
+// Structure of arrays state for all BrokerData objects
+
+#include "channel_table.h"
+#include "E_Mon.h"
+#include "adc_sampler.h"
+
+ChannelTable channels; // Zero initialised before any constructor runs
+
+
+uint8_t ChannelTable::add(BrokerData *obj) {
+	const uint8_t ch = (_count < CHANNEL_TABLE_SIZE) ? _count++ : CHANNEL_TABLE_SIZE;
+	_objs[ch] = obj;
+	_value[ch] = NAN;
+	_min[ch] = NAN;
+	_max[ch] = NAN;
+	_sample_ms[ch] = 0;
+	_sub_rate_ms[ch] = 0;
+	_sub_max_ms[ch] = 0;
+	_sub_time_ms[ch] = 0;
+	_kind[ch] = KIND_STATIC;
+	_flags[ch] = 0;
+	_window[ch] = 0;
+	return ch;
+}
+
+static uint32_t hashName(const char *name) {
+	// FNV-1a
+	uint32_t hash = 2166136261UL;
+	while (*name) {
+		hash ^= (uint8_t)*name++;
+		hash *= 16777619UL;
+	}
+	return hash;
+}
+
+void ChannelTable::_buildIndex() {
+	memset(_index, 0, sizeof(_index));
+	for (uint8_t ch = 0; ch < _count; ch++) {
+		uint16_t slot = hashName(_objs[ch]->getName()) & (CHANNEL_INDEX_SIZE - 1);
+		while (_index[slot]) slot = (slot + 1) & (CHANNEL_INDEX_SIZE - 1);
+		_index[slot] = ch + 1;
+	}
+	_indexed = _count;
+}
+
+int8_t ChannelTable::find(const char *name) {
+	if (name == NULL) return -1;
+	if (_indexed != _count) _buildIndex();
+	for (uint16_t slot = hashName(name) & (CHANNEL_INDEX_SIZE - 1); _index[slot]; slot = (slot + 1) & (CHANNEL_INDEX_SIZE - 1)) {
+		const uint8_t ch = _index[slot] - 1;
+		if (!strcmp(_objs[ch]->getName(), name)) return ch; // One compare unless names collide
+	}
+	// Not a name, maybe a channel number as used in object keys
+	if (*name == '\0') return -1;
+	int32_t ch = 0;
+	for (const char *digit = name; *digit; digit++) {
+		if (*digit < '0' || *digit > '9' || ch > CHANNEL_TABLE_SIZE) return -1;
+		ch = ch * 10 + (*digit - '0');
+	}
+	return findId(ch);
+}
+
+void ChannelTable::attachWindows() {
+	for (uint8_t ch = 0; ch < _count; ch++) {
+		if (!(_flags[ch] & CH_MIN_MAX) || _window[ch]) continue;
+		const int8_t slot = windows.attach();
+		if (slot < 0) return;
+		_window[ch] = slot + 1;
+	}
+}
+
+bool ChannelTable::setValue(uint8_t ch, double value) {
+	if (_window[ch]) windows.add(_window[ch] - 1, value); // Repeats count towards the windowed mean
+	if (value == _value[ch]) return false;
+	_value[ch] = value;
+	_flags[ch] |= CH_CHANGED;
+	_sample_ms[ch] = millis();
+	_sample_time[ch] = timestampNow();
+	if ((_flags[ch] & CH_MIN_MAX) && !isnan(value)) {
+		if (value > _max[ch] || isnan(_max[ch])) _max[ch] = value;
+		if (value < _min[ch] || isnan(_min[ch])) _min[ch] = value;
+	}
+	return true;
+}
+
+void ChannelTable::update(uint8_t ch) {
+	// Qualified calls are bound at compile time, so this switch replaces the vtable
+	BrokerData *obj = _objs[ch];
+	switch (_kind[ch]) {
+		case (KIND_TIME):	static_cast<TimeData *>(obj)->TimeData::getData(); break;
+		case (KIND_VOLTAGE):	static_cast<VoltageData *>(obj)->VoltageData::getData(); break;
+		case (KIND_CURRENT):	static_cast<CurrentData *>(obj)->CurrentData::getData(); break;
+		case (KIND_POWER):	static_cast<PowerData *>(obj)->PowerData::getData(); break;
+		case (KIND_ENERGY):	static_cast<EnergyData *>(obj)->EnergyData::getData(); break;
+		case (KIND_CHARGE):	static_cast<ChargeData *>(obj)->ChargeData::getData(); break;
+		case (KIND_SAMPLE_RATE):	static_cast<SampleRateData *>(obj)->SampleRateData::getData(); break;
+		default: break; // KIND_STATIC only changes through set
+	}
+}
+
+void ChannelTable::updateKinds(uint16_t kind_mask) {
+	// Channels are updated in table order, so sources must be constructed before anything derived from them
+	for (uint8_t ch = 0; ch < _count; ch++) {
+		if (kind_mask & KIND_MASK(_kind[ch])) update(ch);
+	}
+}
+
+void ChannelTable::subscribe(uint8_t ch, uint32_t min_rate_ms, uint32_t max_rate_ms) {
+	if (!(_flags[ch] & CH_DYNAMIC)) return;
+	_sub_rate_ms[ch] = min_rate_ms;
+	_sub_max_ms[ch] = max_rate_ms;
+	_sub_time_ms[ch] = 0; // Should sync items already subscribed.
+}
+
+uint8_t ChannelTable::checkSubscriptions(bool datamap[]) {
+	const uint32_t now_ms = millis();
+	uint8_t subs = 0;
+	for (uint8_t ch = 0; ch < _count; ch++) {
+		const uint32_t since_ms = now_ms - _sub_time_ms[ch];
+		bool due;
+		if (_sub_rate_ms[ch] == 0) due = false; // Not subscribed
+		else if (_flags[ch] & CH_ON_CHANGE) {
+			// Changed values at the subscription rate, unchanged ones at the max rate
+			due = ((_flags[ch] & CH_CHANGED) && since_ms > _sub_rate_ms[ch]) || since_ms > _sub_max_ms[ch];
+		}
+		else due = since_ms > _sub_rate_ms[ch]; // "on new" is purely time based
+		if (due) {
+			_flags[ch] &= ~CH_CHANGED; // This value is being reported
+			_sub_time_ms[ch] = now_ms;
+			subs++;
+		}
+		datamap[ch] = due;
+	}
+	return subs;
+}
+
+uint32_t ChannelTable::msUntilNextDue() {
+	// On change subscriptions can become due as soon as the minimum rate has passed, so that is used for both kinds
+	const uint32_t now_ms = millis();
+	uint32_t next_ms = UINT32_MAX;
+	for (uint8_t ch = 0; ch < _count; ch++) {
+		if (_sub_rate_ms[ch] == 0) continue;
+		const uint32_t since_ms = now_ms - _sub_time_ms[ch];
+		if (since_ms > _sub_rate_ms[ch]) return 0;
+		next_ms = min(next_ms, _sub_rate_ms[ch] - since_ms + 1); // checkSubscriptions() wants strictly greater than
+	}
+	return next_ms;
+}
@@ -0,0 +1,92 @@
+// channel_table.h
+
+#ifndef _CHANNEL_TABLE_h
+#define _CHANNEL_TABLE_h
+
+#include <Arduino.h>
+#include "timebase.h"
+#include "window_stats.h"
+
+#define CHANNEL_TABLE_SIZE	64	// Max number of BrokerData objects
+#define CHANNEL_INDEX_SIZE	128	// Name hash slots. Power of two, at least twice CHANNEL_TABLE_SIZE to keep probes short.
+
+// Channel flags
+#define CH_DYNAMIC	0x01	// Value comes from readings or calculations and can be subscribed to
+#define CH_MIN_MAX	0x02	// Track min and max on every new value
+#define CH_CHANGED	0x04	// Value changed since it was last sent in a subscription
+#define CH_VERBOSE	0x08	// Subscription messages include units, min, max and stats
+#define CH_ON_CHANGE	0x10	// Subscription sends changed values, and unchanged ones every _sub_max_ms
+
+// Channel kinds. Select what update() does for a channel.
+enum CHANNEL_KIND { KIND_STATIC = 0, KIND_TIME = 1, KIND_VOLTAGE = 2, KIND_CURRENT = 3, KIND_POWER = 4, KIND_ENERGY = 5, KIND_CHARGE = 6, KIND_SAMPLE_RATE = 7 };
+#define KIND_MASK(kind)	(1 << (kind))
+
+class BrokerData;
+
+/*
+class ChannelTable holds the frequently touched state of every BrokerData object as structure of arrays, indexed by
+the channel number each object gets when it is constructed. Value updates, min/max tracking and subscription scans are
+loops over these arrays. Refreshing a channel is a switch on its kind, with no virtual calls.
+BrokerData keeps only the cold state: name, units, formatting and configuration.
+Objects register from their constructors, which may run before this table's. So the table has no constructor and
+relies on static storage being zero before any constructor runs. Names are looked up through a hash index, which is
+built on first use because names are only filled in after add() returns. Index CHANNEL_TABLE_SIZE is a spare that absorbs
+objects added to a full table and is never scanned.
+*/
+class ChannelTable {
+public:
+	uint8_t	add(BrokerData *obj);	// Returns the channel number
+	void	setKind(uint8_t ch, uint8_t kind) { _kind[ch] = kind; }
+	uint8_t	getCount() { return _count; }
+	BrokerData	*getObject(uint8_t ch) { return _objs[ch]; }
+	uint8_t	getKind(uint8_t ch) { return _kind[ch]; }
+	int8_t	find(const char *name);	// Channel number for a name or a decimal channel number, or -1
+	int8_t	findId(int32_t ch) { return (ch >= 0 && ch < _count) ? ch : -1; }
+	// Values
+	double	&valueRef(uint8_t ch) { return _value[ch]; }
+	bool	setValue(uint8_t ch, double value);	// Returns false if unchanged
+	double	getMin(uint8_t ch) { return (_flags[ch] & CH_DYNAMIC) ? _min[ch] : _value[ch]; }
+	double	getMax(uint8_t ch) { return (_flags[ch] & CH_DYNAMIC) ? _max[ch] : _value[ch]; }
+	void	resetMinMax(uint8_t ch) { _min[ch] = NAN; _max[ch] = NAN; }
+	void	attachWindows();	// Gives each channel that tracks min and max a WindowStats slot, while they last. Call from setup().
+	bool	hasWindows(uint8_t ch) { return _window[ch] != 0; }
+	bool	getWindow(uint8_t ch, uint8_t w, WindowSnapshot &snapshot) { return _window[ch] && windows.get(_window[ch] - 1, w, snapshot); }
+	uint32_t	getSampleMs(uint8_t ch) { return _sample_ms[ch]; }
+	void	setSampleMs(uint8_t ch, uint32_t ms) { _sample_ms[ch] = ms; }
+	const Timestamp	&getSampleTime(uint8_t ch) { return _sample_time[ch]; }
+	void	stampSampleTime(uint8_t ch) { _sample_time[ch] = timestampNow(); }
+	void	update(uint8_t ch);	// Refreshes one channel from its source
+	void	updateKinds(uint16_t kind_mask);	// Refreshes every channel whose KIND_MASK() is in kind_mask
+	// Flags
+	bool	hasFlag(uint8_t ch, uint8_t flag) { return _flags[ch] & flag; }
+	void	setFlag(uint8_t ch, uint8_t flag, bool on) { if (on) _flags[ch] |= flag; else _flags[ch] &= ~flag; }
+	// Subscriptions
+	void	subscribe(uint8_t ch, uint32_t min_rate_ms, uint32_t max_rate_ms);
+	void	unsubscribe(uint8_t ch) { _sub_rate_ms[ch] = 0; _sub_time_ms[ch] = 0; }
+	bool	isSubscribed(uint8_t ch) { return _sub_rate_ms[ch] != 0; }
+	uint32_t	getSubscriptionRate(uint8_t ch) { return _sub_rate_ms[ch]; }
+	void	setSubscriptionTime(uint8_t ch) { _sub_time_ms[ch] = millis(); }	// Called when a subscription is sent
+	uint8_t	checkSubscriptions(bool datamap[]);	// Marks channels due in datamap and returns how many
+	uint32_t	msUntilNextDue();	// UINT32_MAX if nothing is subscribed
+private:
+	void	_buildIndex();
+	BrokerData	*_objs[CHANNEL_TABLE_SIZE + 1];
+	double	_value[CHANNEL_TABLE_SIZE + 1];
+	double	_min[CHANNEL_TABLE_SIZE + 1];
+	double	_max[CHANNEL_TABLE_SIZE + 1];
+	uint32_t	_sample_ms[CHANNEL_TABLE_SIZE + 1];	// millis() of the last new value
+	Timestamp	_sample_time[CHANNEL_TABLE_SIZE + 1];	// Wall clock time of the last new value. Formatted only for output.
+	uint32_t	_sub_rate_ms[CHANNEL_TABLE_SIZE + 1];	// 0 is not subscribed
+	uint32_t	_sub_max_ms[CHANNEL_TABLE_SIZE + 1];	// Used on change
+	uint32_t	_sub_time_ms[CHANNEL_TABLE_SIZE + 1];	// millis() of the last subscription message
+	uint8_t	_kind[CHANNEL_TABLE_SIZE + 1];
+	uint8_t	_flags[CHANNEL_TABLE_SIZE + 1];
+	uint8_t	_window[CHANNEL_TABLE_SIZE + 1];	// WindowStats slot + 1. 0 is not windowed.
+	uint8_t	_count;
+	uint8_t	_index[CHANNEL_INDEX_SIZE];	// Open addressed name hash of channel number + 1. 0 is empty.
+	uint8_t	_indexed;	// Channels in _index. Rebuilt on the next find() after a channel is added.
+};
+
+extern ChannelTable channels;
+
+#endif
@@ -0,0 +1,50 @@
+// Run time lookups in the current sensor table. See current_sensors.h.
+
+#include <Arduino.h>
+#include "current_sensors.h"
+
+struct SensorRow {
+	const char	*name;
+	int16_t	min_A;
+	int16_t	max_A;
+	uint16_t	mV_per_A;
+	uint16_t	zero_permille;
+	int8_t	funct;
+	uint16_t	vcc_nom_mV;
+	uint16_t	vcc_min_mV;
+	uint16_t	vcc_max_mV;
+};
+
+#define CURRENT_SENSOR_ROW(model, min_A, max_A, mV_per_A, zero_permille, funct, vcc_nom_mV, vcc_min_mV, vcc_max_mV) \
+	{ #model, min_A, max_A, mV_per_A, zero_permille, funct, vcc_nom_mV, vcc_min_mV, vcc_max_mV },
+static const SensorRow SENSOR_ROWS[CURRENT_SENSOR_COUNT] = {
+	CURRENT_SENSOR_TABLE(CURRENT_SENSOR_ROW)
+};
+#undef CURRENT_SENSOR_ROW
+
+bool currentSensorParams(uint8_t model, uint16_t vcc_mV, CurrentSensorParams &params) {
+	// Mirrors CurrentSensor<>, including its static_asserts
+	if (model >= CURRENT_SENSOR_COUNT) return false;
+	const SensorRow &row = SENSOR_ROWS[model];
+	if (vcc_mV < row.vcc_min_mV || vcc_mV > row.vcc_max_mV) return false;
+	const double mV_per_A = (double)row.mV_per_A * vcc_mV / row.vcc_nom_mV;
+	const double zero_mV = (double)vcc_mV * row.zero_permille / 1000.0;
+	if (zero_mV + row.max_A * mV_per_A > ADC_VREF_MV) return false;
+	if (zero_mV + row.min_A * mV_per_A < 0) return false;
+	params.offset_counts = mVToCounts(zero_mV);
+	params.gain_q32 = gainToQ32((double)ADC_VREF_MV / (double)ADC_FULL_SCALE_COUNTS / mV_per_A);
+	params.funct = row.funct;
+	return true;
+}
+
+const char *currentSensorName(uint8_t model) {
+	if (model >= CURRENT_SENSOR_COUNT) return "";
+	return SENSOR_ROWS[model].name;
+}
+
+int8_t findCurrentSensor(const char *name) {
+	for (uint8_t model = 0; model < CURRENT_SENSOR_COUNT; model++) {
+		if (!strcmp(SENSOR_ROWS[model].name, name)) return model;
+	}
+	return -1;
+}
@@ -0,0 +1,100 @@
+// current_sensors.h
+
+#ifndef _CURRENT_SENSORS_h
+#define _CURRENT_SENSORS_h
+
+#include <stdint.h>
+#include "fixed_point.h"
+
+enum SENSOR_FUNCT
+	// What the sensor's extra pin does. Values match the old lookupACSfunction() results.
+{
+	SENSOR_FUNCT_NONE = -1,	// Not connected, or used passively (ACS715 FILTER)
+	SENSOR_FUNCT_FAULT = 0,	// Input. Low = over current fault (ACS711)
+	SENSOR_FUNCT_BW_SEL = 1	// Output. Bandwidth select, driven high for 80 kHz (ACS722)
+};
+
+/*
+One line per supported Hall effect current sensor. Adding a part only needs a new line here.
+	model		Name used in the ACS_MODELS enum
+	min_A, max_A	Measuring range
+	mV_per_A	Sensitivity at vcc_nom_mV. Sensitivity and zero point scale with Vcc (ratiometric).
+	zero_permille	Zero current output as permille of Vcc. 500 for bidirectional parts, 100 for unidirectional.
+	funct		SENSOR_FUNCT of the extra pin
+	vcc_nom_mV, vcc_min_mV, vcc_max_mV	Supply the sensitivity is specified at, and the allowed supply range
+*/
+#define CURRENT_SENSOR_TABLE(X) \
+	X(ACS711_12B, -12, 12, 110, 500, SENSOR_FUNCT_FAULT,  3300, 3000, 5500) \
+	X(ACS711_25B, -25, 25,  55, 500, SENSOR_FUNCT_FAULT,  3300, 3000, 5500) \
+	X(ACS715_20A,   0, 20, 185, 100, SENSOR_FUNCT_NONE,   5000, 4500, 5500) \
+	X(ACS715_30A,   0, 30, 133, 100, SENSOR_FUNCT_NONE,   5000, 4500, 5500) \
+	X(ACS722_05B,  -5,  5, 264, 500, SENSOR_FUNCT_BW_SEL, 3300, 3000, 3600) \
+	X(ACS722_10U,   0, 10, 264, 100, SENSOR_FUNCT_BW_SEL, 3300, 3000, 3600) \
+	X(ACS722_10B, -10, 10, 132, 500, SENSOR_FUNCT_BW_SEL, 3300, 3000, 3600) \
+	X(ACS722_20U,   0, 20, 132, 100, SENSOR_FUNCT_BW_SEL, 3300, 3000, 3600) \
+	X(ACS722_20B, -20, 20,  66, 500, SENSOR_FUNCT_BW_SEL, 3300, 3000, 3600) \
+	X(ACS722_40U,   0, 40,  66, 100, SENSOR_FUNCT_BW_SEL, 3300, 3000, 3600) \
+	X(ACS722_40B, -40, 40,  33, 500, SENSOR_FUNCT_BW_SEL, 3300, 3000, 3600)
+
+#define CURRENT_SENSOR_ENUM(model, min_A, max_A, mV_per_A, zero_permille, funct, vcc_nom_mV, vcc_min_mV, vcc_max_mV) model,
+enum ACS_MODELS
+	// List of supported ACS7xx current sensors.
+{
+	CURRENT_SENSOR_TABLE(CURRENT_SENSOR_ENUM)
+	CURRENT_SENSOR_COUNT
+};
+#undef CURRENT_SENSOR_ENUM
+
+/*
+Everything CurrentData needs to turn counts into amps. Produced at compile time by CurrentSensor<>::params().
+*/
+struct CurrentSensorParams {
+	int32_t	offset_counts;	// ADC count at 0 A
+	int32_t	gain_q32;	// Amps per count * 2^32
+	int8_t	funct;	// SENSOR_FUNCT
+};
+
+template <ACS_MODELS MODEL> struct SensorSpec;	// Only the table entries below exist
+
+#define CURRENT_SENSOR_SPEC(model, min_A_, max_A_, mV_per_A_, zero_permille_, funct_, vcc_nom_mV_, vcc_min_mV_, vcc_max_mV_) \
+template <> struct SensorSpec<model> { \
+	static constexpr int16_t min_A = min_A_; \
+	static constexpr int16_t max_A = max_A_; \
+	static constexpr uint16_t mV_per_A = mV_per_A_; \
+	static constexpr uint16_t zero_permille = zero_permille_; \
+	static constexpr int8_t funct = funct_; \
+	static constexpr uint16_t vcc_nom_mV = vcc_nom_mV_; \
+	static constexpr uint16_t vcc_min_mV = vcc_min_mV_; \
+	static constexpr uint16_t vcc_max_mV = vcc_max_mV_; \
+};
+CURRENT_SENSOR_TABLE(CURRENT_SENSOR_SPEC)
+#undef CURRENT_SENSOR_SPEC
+
+/*
+CurrentSensor<model, Vcc> works out offset and gain for a sensor at a given supply when the sketch is compiled,
+so converting a sample is one subtract and one multiply. A sensor that can't run at Vcc, or whose output would
+leave the ADC's 0 to ADC_VREF_MV range, is a compile error.
+Usage: CurrentData current("Load_Current", adc, pin, CurrentSensor<ACS722_10U, 3300>::params(), f_pin, 6, 3);
+*/
+template <ACS_MODELS MODEL, uint16_t VCC_MV>
+struct CurrentSensor {
+	typedef SensorSpec<MODEL> Spec;
+	static constexpr double mV_per_A = (double)Spec::mV_per_A * VCC_MV / Spec::vcc_nom_mV;
+	static constexpr double zero_mV = (double)VCC_MV * Spec::zero_permille / 1000.0;
+	static constexpr int32_t offset_counts = mVToCounts(zero_mV);
+	static constexpr int32_t gain_q32 = gainToQ32((double)ADC_VREF_MV / (double)ADC_FULL_SCALE_COUNTS / mV_per_A);
+	static_assert(VCC_MV >= Spec::vcc_min_mV && VCC_MV <= Spec::vcc_max_mV, "Current sensor can't run at this Vcc");
+	static_assert(zero_mV + Spec::max_A * mV_per_A <= ADC_VREF_MV, "Current sensor full scale is above the ADC reference");
+	static_assert(zero_mV + Spec::min_A * mV_per_A >= 0, "Current sensor negative full scale is below 0 V");
+	static constexpr CurrentSensorParams params() { return { offset_counts, gain_q32, Spec::funct }; }
+};
+
+/*
+The same calculation at run time, for sensors chosen by a stored configuration instead of the sketch.
+Returns false, leaving params alone, for an unknown model or one that can't be used at vcc_mV.
+*/
+bool	currentSensorParams(uint8_t model, uint16_t vcc_mV, CurrentSensorParams &params);
+const char	*currentSensorName(uint8_t model);	// "ACS722_10U". "" if unknown
+int8_t	findCurrentSensor(const char *name);	// ACS_MODELS value or -1
+
+#endif
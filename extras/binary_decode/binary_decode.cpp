@@ -0,0 +1,73 @@
+/* Reference decoder for the binary subscription updates sent after {"method":"set_protocol","params":{"protocol":"cobs"}}.
+
+Reads the USB serial stream, saved to a file or piped in, and prints each frame as one line of JSON with channel
+ids in place of names. Everything between frames, such as JSON replies, is copied through unchanged. Frame layout
+is in binary_protocol.h.
+
+	g++ -O2 -I../.. binary_decode.cpp ../../binary_protocol.cpp -o binary_decode
+	./binary_decode capture.bin
+	stty -F /dev/ttyACM0 raw && ./binary_decode < /dev/ttyACM0
+
+Capture frames from the "capture" and "event" methods are not COBS encoded and come out as text.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "binary_protocol.h"
+
+static void printFrame(const BinHeader &header, const BinSample *samples) {
+	printf("{\"method\":\"subscription\",\"params\":{");
+	for (uint8_t n = 0; n < header.count; n++) {
+		const BinSample &sample = samples[n];
+		printf("%s\"%u\":{\"value\":", n ? "," : "", sample.channel);
+		if (sample.value == BIN_NO_VALUE) printf("null");
+		else {
+			double scale = 1;
+			for (uint8_t d = 0; d < sample.dec; d++) scale *= 10;
+			printf("%.*f", sample.dec, sample.value / scale);
+		}
+		printf(",\"age_ms\":%u}", sample.age_ms);
+	}
+	printf("},\"message_time\":{\"seconds\":%lu,\"ms\":%u}}\n", (unsigned long)header.seconds, header.ms);
+}
+
+int main(int argc, char *argv[]) {
+	FILE *in = (argc > 1) ? fopen(argv[1], "rb") : stdin;
+	if (!in) {
+		fprintf(stderr, "Can't open %s\n", argv[1]);
+		return 1;
+	}
+	// Bytes since the last zero. Each run is either a frame or text between frames.
+	static uint8_t run[BIN_MAX_FRAME];
+	static uint8_t payload[BIN_MAX_FRAME];
+	BinHeader header;
+	BinSample samples[BIN_MAX_SAMPLES];
+	uint16_t len = 0;
+	uint32_t frames = 0, bad = 0;
+	int c;
+	while ((c = fgetc(in)) != EOF) {
+		if (c != 0) {
+			if (len == sizeof(run)) {
+				// Too long to be a frame
+				fwrite(run, 1, len, stdout);
+				len = 0;
+			}
+			run[len++] = (uint8_t)c;
+			continue;
+		}
+		const uint16_t payload_len = len ? cobsDecode(run, len, payload) : 0;
+		if (payload_len && binaryParse(payload, payload_len, header, samples, BIN_MAX_SAMPLES)) {
+			printFrame(header, samples);
+			frames++;
+		}
+		else {
+			if (len && run[0] != '{' && run[0] != '\r' && run[0] != '\n') bad++; // Likely a damaged frame
+			fwrite(run, 1, len, stdout);
+		}
+		len = 0;
+		fflush(stdout);
+	}
+	fwrite(run, 1, len, stdout);
+	fprintf(stderr, "%lu frames, %lu runs that weren't frames or JSON\n", (unsigned long)frames, (unsigned long)bad);
+	return 0;
+}
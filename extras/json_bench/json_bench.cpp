@@ -0,0 +1,169 @@
+/* Host benchmark of request parsing: JsonMessage against the aJson path it replaced.
+
+Every request in JSON_RPC_examples.json is parsed and walked the way processJson() and the handlers do: method, id
+and each value in params. Reports messages/s and the most heap in use at once while handling one message.
+
+JsonMessage only:
+	g++ -O2 -I../.. json_bench.cpp ../../json_rpc.cpp -o json_bench
+Both, with aJson (https://github.com/ryanneve/aJson) fetched at the revision in aJson.rev and the Arduino stand-ins in shim/:
+	./run_bench.sh
+Run from this folder, or give the examples file and the number of passes:
+	./json_bench ../../JSON_RPC_examples.json 20000
+
+Heap is counted by wrapping glibc's malloc, so this needs Linux.
+*/
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "json_rpc.h"
+#ifdef WITH_AJSON
+#include <aJSON.h>
+#endif
+
+#define BENCH_BUFFER_SIZE	1500	// As MAIN_BUFFER_SIZE
+
+// Heap in use, and the most since the last resetPeak()
+static size_t heap_now = 0;
+static size_t heap_peak = 0;
+static void resetPeak() { heap_peak = heap_now; }
+
+extern "C" {
+	void *__libc_malloc(size_t size);
+	void *__libc_calloc(size_t count, size_t size);
+	void *__libc_realloc(void *ptr, size_t size);
+	void __libc_free(void *ptr);
+
+	static void *counted(void *ptr) {
+		if (ptr) heap_now += malloc_usable_size(ptr);
+		if (heap_now > heap_peak) heap_peak = heap_now;
+		return ptr;
+	}
+	void *malloc(size_t size) { return counted(__libc_malloc(size)); }
+	void *calloc(size_t count, size_t size) { return counted(__libc_calloc(count, size)); }
+	void *realloc(void *ptr, size_t size) {
+		if (ptr) heap_now -= malloc_usable_size(ptr);
+		return counted(__libc_realloc(ptr, size));
+	}
+	void free(void *ptr) {
+		if (ptr) heap_now -= malloc_usable_size(ptr);
+		__libc_free(ptr);
+	}
+}
+
+struct Result {
+	double	per_s;
+	size_t	peak;	// Most heap used for one message
+	uint32_t	failed;	// Messages that didn't parse
+	uint32_t	values;	// Values seen in params, so the walk can't be optimised away
+};
+
+static double seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static std::vector<std::string> loadMessages(const char *path) {
+	std::vector<std::string> messages;
+	FILE *file = fopen(path, "r");
+	if (!file) return messages;
+	char line[BENCH_BUFFER_SIZE];
+	while (fgets(line, sizeof(line), file)) {
+		const char *start = line + strspn(line, " \t");
+		if (*start != '{' || !strstr(start, "\"method\"")) continue; // Prose and replies between the examples
+		std::string message(start);
+		while (!message.empty() && (message.back() == '\n' || message.back() == '\r')) message.pop_back();
+		messages.push_back(message);
+	}
+	fclose(file);
+	return messages;
+}
+
+static Result benchTokenizer(const std::vector<std::string> &messages, uint32_t passes) {
+	Result result = { 0, 0, 0, 0 };
+	static JsonMessage msg;
+	char in_buffer[BENCH_BUFFER_SIZE];
+	const double start = seconds();
+	for (uint32_t pass = 0; pass < passes; pass++) {
+		for (size_t m = 0; m < messages.size(); m++) {
+			memcpy(in_buffer, messages[m].c_str(), messages[m].size() + 1); // Parsing writes to the buffer
+			resetPeak();
+			const size_t base = heap_now;
+			if (!msg.parse(in_buffer, messages[m].size())) {
+				result.failed++;
+				continue;
+			}
+			if (msg.getMethod()) result.values += msg.getId() & 1;
+			const int16_t params = msg.getParams();
+			for (int16_t item = msg.getChild(params); item >= 0; item = msg.getNext(item)) {
+				for (int16_t value = msg.getChild(item); value >= 0; value = msg.getNext(value)) result.values++;
+				result.values++;
+			}
+			if (heap_peak - base > result.peak) result.peak = heap_peak - base;
+		}
+	}
+	result.per_s = (double)passes * messages.size() / (seconds() - start);
+	return result;
+}
+
+#ifdef WITH_AJSON
+static Result benchAJson(const std::vector<std::string> &messages, uint32_t passes) {
+	Result result = { 0, 0, 0, 0 };
+	char in_buffer[BENCH_BUFFER_SIZE];
+	const double start = seconds();
+	for (uint32_t pass = 0; pass < passes; pass++) {
+		for (size_t m = 0; m < messages.size(); m++) {
+			memcpy(in_buffer, messages[m].c_str(), messages[m].size() + 1);
+			resetPeak();
+			const size_t base = heap_now;
+			aJsonObject *serial_msg = aJson.parse(in_buffer);
+			if (!serial_msg) {
+				result.failed++;
+				continue;
+			}
+			// As the old processJson(), which printed each message and threw the text away
+			char *aJsonPtr = aJson.print(serial_msg);
+			free(aJsonPtr);
+			aJsonObject *jsonrpc_method = aJson.getObjectItem(serial_msg, "method");
+			aJsonObject *jsonrpc_id = aJson.getObjectItem(serial_msg, "id");
+			if (jsonrpc_method && jsonrpc_id) result.values += jsonrpc_id->valueint & 1;
+			aJsonObject *jsonrpc_params = aJson.getObjectItem(serial_msg, "params");
+			for (aJsonObject *item = jsonrpc_params ? jsonrpc_params->child : NULL; item; item = item->next) {
+				for (aJsonObject *value = item->child; value; value = value->next) result.values++;
+				result.values++;
+			}
+			aJson.deleteItem(serial_msg);
+			if (heap_peak - base > result.peak) result.peak = heap_peak - base;
+		}
+	}
+	result.per_s = (double)passes * messages.size() / (seconds() - start);
+	return result;
+}
+#endif
+
+static void printResult(const char *name, const Result &result) {
+	printf("%-12s %12.0f msg/s %8lu bytes peak heap %4u failed (%u values)\n", name, result.per_s, (unsigned long)result.peak, result.failed, result.values);
+}
+
+int main(int argc, char *argv[]) {
+	const char *path = (argc > 1) ? argv[1] : "../../JSON_RPC_examples.json";
+	const uint32_t passes = (argc > 2) ? (uint32_t)atol(argv[2]) : 20000;
+	const std::vector<std::string> messages = loadMessages(path);
+	if (messages.empty()) {
+		fprintf(stderr, "No messages in %s\n", path);
+		return 1;
+	}
+	printf("%lu messages x %u passes. JsonMessage is %lu bytes, allocated once.\n", (unsigned long)messages.size(), passes, (unsigned long)sizeof(JsonMessage));
+	printResult("JsonMessage", benchTokenizer(messages, passes));
+#ifdef WITH_AJSON
+	printResult("aJson", benchAJson(messages, passes));
+#else
+	printf("Build with -DWITH_AJSON to compare against aJson.\n");
+#endif
+	return 0;
+}
@@ -0,0 +1,17 @@
+#!/bin/sh
+# Builds json_bench against aJson and runs it, so both columns are reported: JsonMessage and the aJson path it replaced.
+# aJson is cloned once into ./aJson. The revision is pinned by aJson.rev: if it exists that commit is checked out,
+# otherwise the first clone writes the commit it got there. Keep aJson.rev with the results it produced.
+# Arguments go to json_bench: the examples file and the number of passes.
+set -e
+cd "$(dirname "$0")"
+AJSON_URL=https://github.com/ryanneve/aJson.git
+if [ ! -d aJson ]; then
+	git clone --quiet "$AJSON_URL" aJson
+	if [ -f aJson.rev ]; then git -C aJson checkout --quiet "$(cat aJson.rev)"
+	else git -C aJson rev-parse HEAD > aJson.rev
+	fi
+fi
+echo "aJson $(git -C aJson rev-parse HEAD)"
+g++ -O2 -DWITH_AJSON -I../.. -Ishim -IaJson json_bench.cpp ../../json_rpc.cpp aJson/aJSON.cpp aJson/utility/streamhelper.cpp aJson/utility/stringbuffer.cpp -o json_bench
+./json_bench "$@"
@@ -0,0 +1,2 @@
+#include "Print.h"
+#include "pgmspace.h"
@@ -0,0 +1,2 @@
+// aJson includes this but uses nothing from it
+class IPAddress {};
@@ -0,0 +1,47 @@
+// Just enough of the Arduino Print, Stream and Client classes to build aJson on a PC. Output goes nowhere.
+
+#ifndef _SHIM_PRINT_h
+#define _SHIM_PRINT_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEC 10
+#define HEX 16
+
+class Print {
+public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t c) = 0;
+	virtual size_t write(const uint8_t *buf, size_t len) { size_t n = 0; while (len--) n += write(*buf++); return n; }
+	size_t write(const char *str) { return write((const uint8_t *)str, strlen(str)); }
+	size_t print(const char *str) { return write(str); }
+	size_t print(char c) { return write((uint8_t)c); }
+	size_t print(long n, int base = DEC) { char buf[24]; snprintf(buf, sizeof(buf), (base == HEX) ? "%lx" : "%ld", n); return write(buf); }
+	size_t print(int n, int base = DEC) { return print((long)n, base); }
+	size_t print(unsigned long n, int base = DEC) { char buf[24]; snprintf(buf, sizeof(buf), (base == HEX) ? "%lx" : "%lu", n); return write(buf); }
+	size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+	size_t print(double n, int digits = 2) { char buf[32]; snprintf(buf, sizeof(buf), "%.*f", digits, n); return write(buf); }
+	size_t println() { return write((uint8_t)'\n'); }
+	template <typename T> size_t println(T value) { return print(value) + println(); }
+};
+
+class Stream : public Print {
+public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+	virtual void flush() {}
+	size_t readBytes(char *buf, size_t len) { size_t n = 0; int c; while (n < len && (c = read()) >= 0) buf[n++] = (char)c; return n; }
+	void setTimeout(unsigned long) {}
+};
+
+class Client : public Stream {
+public:
+	virtual uint8_t connected() = 0;
+	virtual void stop() = 0;
+};
+
+#endif
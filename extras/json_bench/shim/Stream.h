@@ -0,0 +1 @@
+#include "Print.h"
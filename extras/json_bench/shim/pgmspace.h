@@ -0,0 +1,16 @@
+// Program memory is ordinary memory on a PC
+
+#ifndef _SHIM_PGMSPACE_h
+#define _SHIM_PGMSPACE_h
+
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const unsigned char *)(addr))
+#define strcpy_P strcpy
+#define strcmp_P strcmp
+#define strlen_P strlen
+#define memcpy_P memcpy
+
+#endif
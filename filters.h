@@ -0,0 +1,179 @@
+// filters.h
+
+#ifndef _FILTERS_h
+#define _FILTERS_h
+
+#include <stdint.h>
+
+#define FILTER_FRAC_BITS	4	// Fractional bits added to counts going into a filter chain
+#define FILTER_MAX_MEDIAN	7	// Longest median window
+#define FILTER_CIC_ORDER	2
+#define FILTER_MAX_DECIMATION	32	// CIC register growth is ORDER * log2(R) bits, which must fit 32 bits with the input
+#define FILTER_MAX_IIR_SHIFT	8
+
+/*
+Integer filter stages for blocks of ADC samples. All stages have the same interface:
+	bool process(int32_t in, int32_t &out)	returns true when out holds a new output
+	void reset()
+	bool isActive()	false when configured as a pass through
+and can be stacked with FilterChain. Stage parameters can be changed at run time within the template limits.
+*/
+
+/*
+class MedianFilter outputs the median of the last n inputs. Removes single sample spikes without smearing steps.
+n is odd, 1 (pass through) to MAX_N.
+*/
+template <uint8_t MAX_N>
+class MedianFilter {
+	static_assert(MAX_N & 1, "MedianFilter MAX_N must be odd");
+public:
+	MedianFilter() { _n = 1; reset(); }
+	bool	setWindow(uint8_t n) {
+		if (n < 1 || n > MAX_N || !(n & 1)) return false;
+		_n = n;
+		reset();
+		return true;
+	}
+	uint8_t	getWindow() const { return _n; }
+	bool	isActive() const { return _n > 1; }
+	void	reset() { _idx = 0; _filled = 0; }
+	bool	process(int32_t in, int32_t &out) {
+		if (_n == 1) { out = in; return true; }
+		_hist[_idx] = in;
+		if (++_idx >= _n) _idx = 0;
+		if (_filled < _n) _filled++;
+		// Insertion sort of a copy. n is tiny so this beats anything clever.
+		int32_t sorted[MAX_N];
+		for (uint8_t i = 0; i < _filled; i++) {
+			int32_t value = _hist[i];
+			int8_t j = i - 1;
+			while (j >= 0 && sorted[j] > value) {
+				sorted[j + 1] = sorted[j];
+				j--;
+			}
+			sorted[j + 1] = value;
+		}
+		out = sorted[_filled / 2];
+		return true;
+	}
+private:
+	int32_t	_hist[MAX_N];
+	uint8_t	_n;
+	uint8_t	_idx;
+	uint8_t	_filled;
+};
+
+/*
+class CICDecimator is an ORDER stage cascaded integrator comb decimator. Outputs one sample for every R inputs,
+normalized by R^ORDER so the output stays in input units. Integrators wrap in uint32 on purpose, the combs undo it.
+R = 1 is a pass through.
+*/
+template <uint8_t ORDER>
+class CICDecimator {
+public:
+	CICDecimator() { _decimation = 1; _gain = 1; reset(); }
+	bool	setDecimation(uint8_t r) {
+		if (r < 1 || r > FILTER_MAX_DECIMATION) return false;
+		_decimation = r;
+		_gain = 1;
+		for (uint8_t stage = 0; stage < ORDER; stage++) _gain *= r;
+		reset();
+		return true;
+	}
+	uint8_t	getDecimation() const { return _decimation; }
+	bool	isActive() const { return _decimation > 1; }
+	void	reset() {
+		_phase = 0;
+		for (uint8_t stage = 0; stage < ORDER; stage++) {
+			_integ[stage] = 0;
+			_comb[stage] = 0;
+		}
+	}
+	bool	process(int32_t in, int32_t &out) {
+		if (_decimation == 1) { out = in; return true; }
+		uint32_t x = (uint32_t)in;
+		for (uint8_t stage = 0; stage < ORDER; stage++) {
+			_integ[stage] += x;
+			x = _integ[stage];
+		}
+		if (++_phase < _decimation) return false;
+		_phase = 0;
+		for (uint8_t stage = 0; stage < ORDER; stage++) {
+			const uint32_t delayed = _comb[stage];
+			_comb[stage] = x;
+			x -= delayed;
+		}
+		out = (int32_t)x / (int32_t)_gain;
+		return true;
+	}
+private:
+	uint32_t	_integ[ORDER];
+	uint32_t	_comb[ORDER];
+	uint32_t	_gain;	// R^ORDER
+	uint8_t	_decimation;	// R
+	uint8_t	_phase;
+};
+
+/*
+class IIRLowPass is a single pole low pass, y += (x - y) / 2^k. Corner is about fs / (2 * pi * 2^k).
+The state keeps k extra bits so small steps aren't lost. k = 0 is a pass through.
+*/
+class IIRLowPass {
+public:
+	IIRLowPass() { _shift = 0; reset(); }
+	bool	setShift(uint8_t k) {
+		if (k > FILTER_MAX_IIR_SHIFT) return false;
+		_shift = k;
+		reset();
+		return true;
+	}
+	uint8_t	getShift() const { return _shift; }
+	bool	isActive() const { return _shift > 0; }
+	void	reset() { _primed = false; }
+	bool	process(int32_t in, int32_t &out) {
+		if (_shift == 0) { out = in; return true; }
+		if (!_primed) {
+			_acc = in * (1 << _shift); // Start at the first input instead of ramping up from 0
+			_primed = true;
+		}
+		_acc += in - (_acc >> _shift);
+		out = _acc >> _shift;
+		return true;
+	}
+private:
+	int32_t	_acc;
+	uint8_t	_shift;
+	bool	_primed;
+};
+
+/*
+class FilterChain runs its stages in order. A stage that holds its output back (a decimator) stops the chain for that input.
+*/
+template <typename... STAGES> class FilterChain;
+
+template <>
+class FilterChain<> {
+public:
+	bool	process(int32_t in, int32_t &out) { out = in; return true; }
+	void	reset() {}
+	bool	isActive() const { return false; }
+};
+
+template <typename FIRST, typename... REST>
+class FilterChain<FIRST, REST...> {
+public:
+	bool	process(int32_t in, int32_t &out) {
+		int32_t between;
+		if (!_first.process(in, between)) return false;
+		return _rest.process(between, out);
+	}
+	void	reset() { _first.reset(); _rest.reset(); }
+	bool	isActive() const { return _first.isActive() || _rest.isActive(); }
+	FIRST	&first() { return _first; }
+	FilterChain<REST...>	&rest() { return _rest; }
+private:
+	FIRST	_first;
+	FilterChain<REST...>	_rest;
+};
+
+#endif
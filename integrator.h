@@ -0,0 +1,59 @@
+// integrator.h
+
+#ifndef _INTEGRATOR_h
+#define _INTEGRATOR_h
+
+#include <Arduino.h>
+#include "timebase.h"
+#include "fixed_point.h"
+
+#define US_PER_HR 3600000000.0
+#define INTEGRATOR_UNITS_PER_HR	(2.0 * Q16_ONE * US_PER_HR)	// Accumulator counts per Wh (or Ah). See PairIntegrator.
+
+/*
+struct WideAccumulator is a signed integer total that can't overflow in practice.
+Increments land in lo and every carry out of lo goes into hi, so the total is hi * 2^32 + lo with no bits lost.
+*/
+struct WideAccumulator {
+	int64_t	hi;
+	uint32_t	lo;
+	void	add(int64_t increment) {
+		const int64_t sum = (int64_t)lo + increment;
+		hi += sum >> 32;	// Arithmetic shift, so negative increments borrow correctly
+		lo = (uint32_t)sum;
+	}
+	void	set(double total);
+	double	toDouble() const { return (double)hi * Q32_ONE + (double)lo; }
+};
+
+/*
+class PairIntegrator totalizes energy (Wh) and charge (Ah) one synchronized current/voltage pair at a time.
+Each new pair is integrated with the trapezoidal rule over the exact time since the previous pair, taken from
+the sampler clock, so the totals do not depend on how often loop() reads them or how long the core sleeps.
+All per sample math is integer: Q16.16 amps, volts and watts, microsecond intervals and WideAccumulator totals
+in units of 2^-17 W.us (the trapezoid's divide by 2 is folded into the units).
+addSample() runs in the sampler ISR. Everything else is called from loop() and briefly masks interrupts.
+*/
+class PairIntegrator {
+public:
+	PairIntegrator() {
+		_energy.set(0);
+		_charge.set(0);
+		_last_W = 0;
+		_last_A = 0;
+	}
+	void	addSample(q16_t current_A, q16_t voltage_V, uint32_t cycles);	// ISR only
+	void	restart() { noInterrupts(); _ticker.restart(); interrupts(); }	// Next sample starts a new interval
+	double	getWattHours();
+	double	getAmpHours();
+	void	setWattHours(double energy_Wh);
+	void	setAmpHours(double charge_Ah);
+private:
+	MicroTicker	_ticker;
+	WideAccumulator	_energy;	// 2^-17 W.us
+	WideAccumulator	_charge;	// 2^-17 A.us
+	q16_t	_last_W;	// Power at previous sample
+	q16_t	_last_A;	// Current at previous sample
+};
+
+#endif
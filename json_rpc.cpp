@@ -0,0 +1,260 @@
+// In place JSON tokenizer. See json_rpc.h.
+
+#include "json_rpc.h"
+#include <stdlib.h>
+#include <string.h>
+
+// What feed() will accept next
+#define EXPECT_VALUE	0
+#define EXPECT_KEY	1	// Or the end of an empty object
+#define EXPECT_COLON	2
+#define EXPECT_COMMA	3	// Or the end of the container
+
+static inline bool isLineEnd(char c) { return c == '\r' || c == '\n'; }
+static inline bool isSpace(char c) { return c == ' ' || c == '\t'; }
+
+void JsonMessage::begin(char *buf, uint16_t size) {
+	_buf = buf;
+	_size = size;
+	_skip_line = false;
+	_reset();
+}
+
+void JsonMessage::_reset() {
+	_len = 0;
+	_count = 0;
+	_parent = JSON_NO_TOKEN;
+	_primitive = JSON_NO_TOKEN;
+	_expect = EXPECT_VALUE;
+	_in_string = false;
+	_escape = false;
+	_complete = false;
+}
+
+uint8_t JsonMessage::_fail(char c) {
+	_reset();
+	_skip_line = !isLineEnd(c);
+	return JSON_RX_ERROR;
+}
+
+uint8_t JsonMessage::feed(char c) {
+	if (_complete) _reset();
+	if (_skip_line) {
+		_skip_line = !isLineEnd(c);
+		return JSON_RX_MORE;
+	}
+	if (!c || (_len == 0 && (isSpace(c) || isLineEnd(c)))) return JSON_RX_MORE; // Nothing between requests is kept
+	if (_len + 1 >= _size) return _fail(c); // Room for the terminator of a number that ends at the last byte
+	_buf[_len] = c;
+	return _step(_len++);
+}
+
+bool JsonMessage::parse(char *buf, uint16_t len) {
+	// Feeding a buffer to itself only ever moves bytes back
+	begin(buf, len + 1);
+	for (uint16_t pos = 0; pos < len && buf[pos]; pos++) {
+		const uint8_t state = feed(buf[pos]);
+		if (state == JSON_RX_COMPLETE) return true;
+		if (state == JSON_RX_ERROR) break;
+	}
+	_reset();
+	return false;
+}
+
+int16_t JsonMessage::_add(uint8_t type, uint16_t start) {
+	if (_count >= JSON_MAX_TOKENS) return JSON_NO_TOKEN;
+	Token &token = _tokens[_count];
+	token.type = type;
+	token.parent = (_parent < 0) ? JSON_MAX_TOKENS : _parent;
+	token.start = start;
+	token.end = start;
+	token.after = _count + 1;
+	return _count++;
+}
+
+bool JsonMessage::_endPrimitive(uint16_t pos) {
+	// Only literals are checked here. getNumber() checks numbers.
+	Token &token = _tokens[_primitive];
+	const char *word = _buf + token.start;
+	const uint16_t len = pos - token.start;
+	_primitive = JSON_NO_TOKEN;
+	if (token.type == JSON_LITERAL && !((len == 4 && !strncmp(word, "true", 4)) || (len == 5 && !strncmp(word, "false", 5)) || (len == 4 && !strncmp(word, "null", 4)))) return false;
+	token.end = pos;
+	_expect = EXPECT_COMMA;
+	return true;
+}
+
+uint8_t JsonMessage::_step(uint16_t pos) {
+	const char c = _buf[pos];
+	if (_in_string) {
+		if (_escape) _escape = false;
+		else if (c == '\\') _escape = true;
+		else if (c == '"') {
+			Token &token = _tokens[_count - 1];
+			token.end = pos;
+			_in_string = false;
+			_expect = (token.type == JSON_KEY) ? EXPECT_COLON : EXPECT_COMMA;
+			_terminate(token);
+		}
+		else if (isLineEnd(c)) return _fail(c);
+		return JSON_RX_MORE;
+	}
+	if (_primitive >= 0) {
+		if (!isSpace(c) && !isLineEnd(c) && c != ',' && c != ':' && c != ']' && c != '}') return JSON_RX_MORE;
+		if (!_endPrimitive(pos)) return _fail(c);
+		_terminate(_tokens[_count - 1]); // Overwrites c, which is handled below
+	}
+	if (_count == 0 && c != '{') return _fail(c); // Requests are objects
+	int16_t tok;
+	switch (c) {
+	case ' ': case '\t':
+		break;
+	case '\r': case '\n':
+		return _fail(c); // The line ended before the request did
+	case '{': case '[':
+		if (_expect != EXPECT_VALUE) return _fail(c);
+		tok = _add((c == '{') ? JSON_OBJECT : JSON_ARRAY, pos);
+		if (tok < 0) return _fail(c);
+		_parent = tok;
+		_expect = (c == '{') ? EXPECT_KEY : EXPECT_VALUE;
+		break;
+	case '}': case ']': {
+		if (_parent < 0 || _tokens[_parent].type != ((c == '}') ? JSON_OBJECT : JSON_ARRAY)) return _fail(c);
+		const bool empty = (_count == _parent + 1);
+		if (_expect != EXPECT_COMMA && !empty) return _fail(c); // Trailing comma or missing value
+		Token &container = _tokens[_parent];
+		container.end = pos + 1;
+		container.after = _count;
+		_parent = (container.parent == JSON_MAX_TOKENS) ? JSON_NO_TOKEN : container.parent;
+		_expect = EXPECT_COMMA;
+		if (_parent < 0) {
+			_complete = true;
+			return JSON_RX_COMPLETE;
+		}
+		break;
+	}
+	case '"':
+		if (_expect != EXPECT_VALUE && _expect != EXPECT_KEY) return _fail(c);
+		if (_add((_expect == EXPECT_KEY) ? JSON_KEY : JSON_STRING, pos + 1) < 0) return _fail(c);
+		_in_string = true;
+		break;
+	case ':':
+		if (_expect != EXPECT_COLON) return _fail(c);
+		_expect = EXPECT_VALUE;
+		break;
+	case ',':
+		if (_expect != EXPECT_COMMA || _parent < 0) return _fail(c);
+		_expect = (_tokens[_parent].type == JSON_OBJECT) ? EXPECT_KEY : EXPECT_VALUE;
+		break;
+	default:
+		// Number, true, false or null
+		if (_expect != EXPECT_VALUE || _parent < 0) return _fail(c);
+		if (c != '-' && (c < '0' || c > '9') && c != 't' && c != 'f' && c != 'n') return _fail(c);
+		tok = _add((c == '-' || (c >= '0' && c <= '9')) ? JSON_NUMBER : JSON_LITERAL, pos);
+		if (tok < 0) return _fail(c);
+		_primitive = tok;
+		break;
+	}
+	return JSON_RX_MORE;
+}
+
+static char hexDigit(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return 0;
+}
+
+void JsonMessage::_terminate(Token &token) {
+	if (token.type == JSON_OBJECT || token.type == JSON_ARRAY) return;
+	if (token.type == JSON_NUMBER || token.type == JSON_LITERAL) {
+		_buf[token.end] = '\0';
+		return;
+	}
+	// Strings and keys are unescaped in place. The result is never longer than the original.
+	char *out = _buf + token.start;
+	for (uint16_t pos = token.start; pos < token.end; pos++) {
+		char c = _buf[pos];
+		if (c == '\\' && pos + 1 < token.end) {
+			c = _buf[++pos];
+			switch (c) {
+			case 'b': c = '\b'; break;
+			case 'f': c = '\f'; break;
+			case 'n': c = '\n'; break;
+			case 'r': c = '\r'; break;
+			case 't': c = '\t'; break;
+			case 'u':
+				// Only ASCII is kept. Anything else becomes '?'.
+				if (pos + 4 < token.end) {
+					const uint16_t code = (hexDigit(_buf[pos + 1]) << 12) | (hexDigit(_buf[pos + 2]) << 8) | (hexDigit(_buf[pos + 3]) << 4) | hexDigit(_buf[pos + 4]);
+					c = (code > 0 && code < 0x80) ? (char)code : '?';
+					pos += 4;
+				}
+				break;
+			default: break; // \" \\ and \/ stand for themselves
+			}
+		}
+		*out++ = c;
+	}
+	*out = '\0'; // At or before the closing quote
+	token.end = out - _buf;
+}
+
+int16_t JsonMessage::getItem(int16_t object, const char *key) {
+	if (getType(object) != JSON_OBJECT) return JSON_NO_TOKEN;
+	for (int16_t value = getChild(object); value >= 0; value = getNext(value)) {
+		if (!strcmp(_buf + _tokens[value - 1].start, key)) return value;
+	}
+	return JSON_NO_TOKEN;
+}
+
+int16_t JsonMessage::getChild(int16_t tok) {
+	if (!_valid(tok)) return JSON_NO_TOKEN;
+	const Token &token = _tokens[tok];
+	// An object's first token is a key, with its value after it
+	const int16_t first = tok + ((token.type == JSON_OBJECT) ? 2 : 1);
+	if ((token.type != JSON_OBJECT && token.type != JSON_ARRAY) || first >= token.after) return JSON_NO_TOKEN;
+	return first;
+}
+
+int16_t JsonMessage::getNext(int16_t tok) {
+	if (!_valid(tok) || _tokens[tok].parent == JSON_MAX_TOKENS) return JSON_NO_TOKEN;
+	const Token &parent = _tokens[_tokens[tok].parent];
+	const int16_t next = _tokens[tok].after + ((parent.type == JSON_OBJECT) ? 1 : 0);
+	return (next < parent.after) ? next : JSON_NO_TOKEN;
+}
+
+const char *JsonMessage::getName(int16_t tok) {
+	if (!_valid(tok) || tok == 0 || _tokens[tok - 1].type != JSON_KEY || _tokens[tok - 1].parent != _tokens[tok].parent) return "";
+	return _buf + _tokens[tok - 1].start;
+}
+
+bool JsonMessage::isString(int16_t tok, const char *value) {
+	const char *str = getString(tok);
+	return str && !strcmp(str, value);
+}
+
+bool JsonMessage::isInteger(int16_t tok) {
+	if (getType(tok) != JSON_NUMBER) return false;
+	return strpbrk(_buf + _tokens[tok].start, ".eE") == 0;
+}
+
+double JsonMessage::getNumber(int16_t tok, double fallback) {
+	if (getType(tok) != JSON_NUMBER) return fallback;
+	char *end;
+	const double value = strtod(_buf + _tokens[tok].start, &end);
+	return (*end == '\0') ? value : fallback;
+}
+
+int32_t JsonMessage::getInt(int16_t tok, int32_t fallback) {
+	if (getType(tok) != JSON_NUMBER) return fallback;
+	return isInteger(tok) ? (int32_t)strtol(_buf + _tokens[tok].start, 0, 10) : (int32_t)getNumber(tok, fallback);
+}
+
+bool JsonMessage::getBool(int16_t tok, bool fallback) {
+	if (getType(tok) == JSON_NUMBER) return getNumber(tok, 0) != 0;
+	if (getType(tok) != JSON_LITERAL) return fallback;
+	if (_buf[_tokens[tok].start] == 't') return true;
+	if (_buf[_tokens[tok].start] == 'f') return false;
+	return fallback; // null
+}
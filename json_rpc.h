@@ -0,0 +1,84 @@
+// json_rpc.h
+
+#ifndef _JSON_RPC_h
+#define _JSON_RPC_h
+
+#include <stdint.h>
+
+#define JSON_MAX_TOKENS	96	// Values, keys and containers in one message. A status request naming every channel of a full ChannelTable needs about 75.
+#define JSON_NO_TOKEN	-1
+#define JSON_NOT_A_NUMBER	-999	// getNumber() of a missing or non numeric value
+
+enum JSON_TYPE { JSON_NONE = 0, JSON_OBJECT, JSON_ARRAY, JSON_STRING, JSON_NUMBER, JSON_LITERAL, JSON_KEY };
+enum JSON_RX { JSON_RX_MORE = 0, JSON_RX_COMPLETE, JSON_RX_ERROR };
+
+/*
+class JsonMessage tokenizes one JSON-RPC request where it lies, in the receive buffer, without allocating anything.
+It records a token for each value, key and container: its type, where it starts and, for containers, the index of
+the first token after everything inside it, so siblings can be stepped over without walking their contents. Strings
+are unescaped and null terminated in place as they close, so getString() returns a pointer into the buffer.
+Bytes can be given one at a time with feed() as they arrive. All the tokenizing is done then, and feed() returns
+JSON_RX_COMPLETE as soon as the closing brace of a request is in. The buffer and the token array are fixed, so a
+request that is too long, has too many tokens or isn't JSON gives JSON_RX_ERROR and the rest of its line is dropped.
+A line end ends a request, so a broken request costs one line and never the next one. parse() does the same for a
+request already in a buffer.
+Tokens are int16_t indexes, with JSON_NO_TOKEN for a missing value. Every accessor accepts JSON_NO_TOKEN and returns
+JSON_NO_TOKEN, NULL or the fallback, so lookups can be chained without checking each step.
+*/
+class JsonMessage {
+public:
+	JsonMessage() { begin(0, 0); }
+	JsonMessage(char *buf, uint16_t size) { begin(buf, size); }
+	void	begin(char *buf, uint16_t size);	// Buffer for feed() to fill
+	uint8_t	feed(char c);	// JSON_RX. After JSON_RX_COMPLETE the tokens stay valid until the next feed().
+	bool	parse(char *buf, uint16_t len);	// false if the text isn't a JSON object or has more than JSON_MAX_TOKENS
+	uint16_t	getLength() { return _len; }	// Bytes of the request so far
+	uint8_t	getTokenCount() { return _count; }
+	// JSON-RPC members of the root object
+	const char	*getMethod() { return getString(getItem(0, "method")); }
+	int32_t	getId() { return getInt(getItem(0, "id"), 0); }
+	int16_t	getParams() { return getItem(0, "params"); }
+	// Navigation
+	int16_t	getItem(int16_t object, const char *key);	// Value of a member of an object
+	int16_t	getChild(int16_t tok);	// First value in an object or array
+	int16_t	getNext(int16_t tok);	// Next value in the same object or array
+	const char	*getName(int16_t tok);	// Key of an object member's value, or "" for anything else
+	// Values
+	uint8_t	getType(int16_t tok) { return _valid(tok) ? _tokens[tok].type : (uint8_t)JSON_NONE; }
+	const char	*getString(int16_t tok, const char *fallback = 0) { return (getType(tok) == JSON_STRING) ? _buf + _tokens[tok].start : fallback; }
+	bool	isString(int16_t tok, const char *value);	// tok is a string equal to value
+	bool	isInteger(int16_t tok);	// A number without a fraction or exponent
+	double	getNumber(int16_t tok, double fallback = JSON_NOT_A_NUMBER);
+	int32_t	getInt(int16_t tok, int32_t fallback = JSON_NOT_A_NUMBER);
+	bool	getBool(int16_t tok, bool fallback = false);	// true, false or a number
+private:
+	struct Token {
+		uint8_t	type;	// JSON_TYPE
+		uint8_t	parent;	// Container index, or JSON_MAX_TOKENS for the root
+		uint8_t	after;	// First token after this one and everything inside it
+		uint16_t	start;	// First character, inside the quotes for strings
+		uint16_t	end;	// One past the last character, before the closing quote for strings
+	};
+	bool	_valid(int16_t tok) { return tok >= 0 && tok < _count; }
+	void	_reset();
+	uint8_t	_step(uint16_t pos);	// Tokenizes the byte at pos
+	uint8_t	_fail(char c);
+	bool	_endPrimitive(uint16_t pos);
+	int16_t	_add(uint8_t type, uint16_t start);
+	void	_terminate(Token &token);
+	Token	_tokens[JSON_MAX_TOKENS];
+	char	*_buf;
+	uint16_t	_size;
+	uint16_t	_len;
+	uint8_t	_count;
+	// Where feed() is up to
+	int16_t	_parent;	// Innermost open container
+	int16_t	_primitive;	// Number or literal being read, or JSON_NO_TOKEN
+	uint8_t	_expect;
+	bool	_in_string;
+	bool	_escape;	// Last byte in a string was a backslash
+	bool	_complete;
+	bool	_skip_line;	// After an error, until the line ends
+};
+
+#endif
@@ -0,0 +1,250 @@
+// Bounded, streaming JSON output and integer number formatting. See json_writer.h.
+
+#include "json_writer.h"
+#include "timebase.h"
+
+static const double POW10[FORMAT_MAX_DEC + 1] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+#define FORMAT_INT64_LIMIT	9.2e18	// Just inside INT64_MAX
+
+uint8_t formatScaled(char *out_str, int64_t scaled, uint8_t width, uint8_t dec) {
+	char digits[20];	// Least significant first
+	uint8_t n = 0;
+	const bool negative = scaled < 0;
+	uint64_t magnitude = negative ? -(uint64_t)scaled : (uint64_t)scaled;
+	// 64 bit division is a library call, so it's only used until the rest fits 32 bits, which the M4 divides in hardware
+	while (magnitude > UINT32_MAX) {
+		digits[n++] = '0' + (char)(magnitude % 10);
+		magnitude /= 10;
+	}
+	uint32_t low = (uint32_t)magnitude;
+	do {
+		digits[n++] = '0' + (char)(low % 10);
+		low /= 10;
+	} while (low || n <= dec);	// At least one digit before the point
+	const uint8_t len = n + (dec ? 1 : 0) + (negative ? 1 : 0);
+	if (width > FORMAT_MAX_LEN - 1) width = FORMAT_MAX_LEN - 1;
+	uint8_t idx = 0;
+	while (idx + len < width) out_str[idx++] = ' ';
+	if (negative) out_str[idx++] = '-';
+	while (n > dec) out_str[idx++] = digits[--n];
+	if (dec) {
+		out_str[idx++] = '.';
+		while (n) out_str[idx++] = digits[--n];
+	}
+	out_str[idx] = '\0';
+	return idx;
+}
+
+uint8_t formatFixed(char *out_str, double value, uint8_t width, uint8_t dec) {
+	if (dec > FORMAT_MAX_DEC) dec = FORMAT_MAX_DEC;
+	const double scaled = value * POW10[dec];
+	if (!(scaled > -FORMAT_INT64_LIMIT && scaled < FORMAT_INT64_LIMIT)) {
+		// Also catches NaN, which fails every comparison
+		strcpy(out_str, "null");
+		return 4;
+	}
+	return formatScaled(out_str, (int64_t)(scaled < 0 ? scaled - 0.5 : scaled + 0.5), width, dec);
+}
+
+uint8_t formatQ16(char *out_str, int32_t q16, uint8_t width, uint8_t dec) {
+	if (dec > FORMAT_MAX_DEC) dec = FORMAT_MAX_DEC;
+	int64_t scale = 1;
+	for (uint8_t d = 0; d < dec; d++) scale *= 10;
+	const int64_t scaled = (int64_t)q16 * scale;
+	// Round half away from zero, as formatFixed() does
+	return formatScaled(out_str, (scaled < 0) ? -((-scaled + 0x8000) >> 16) : (scaled + 0x8000) >> 16, width, dec);
+}
+
+void JsonWriter::_flush() {
+	if (!_sink || !_idx) return;
+	_sink->write((const uint8_t *)_buf, _idx);
+	_sent += _idx;
+	_idx = 0;
+}
+
+void JsonWriter::_put(const char *str, uint16_t len) {
+	while (len) {
+		if (_idx + 1 >= _size) {
+			// One byte is kept back for getBuffer()'s terminator
+			if (!_sink) {
+				_truncated = true;
+				return;
+			}
+			_flush();
+		}
+		uint16_t part = _size - 1 - _idx;
+		if (part > len) part = len;
+		memcpy(_buf + _idx, str, part);
+		_idx += part;
+		str += part;
+		len -= part;
+	}
+}
+
+void JsonWriter::_separate() {
+	if (_after_key) {
+		_after_key = false;
+		return;
+	}
+	const uint16_t bit = 1 << (_depth < JSON_WRITER_DEPTH ? _depth : JSON_WRITER_DEPTH - 1);
+	if (!(_first & bit)) _put(',');
+	_first &= ~bit;
+}
+
+JsonWriter &JsonWriter::key(const char *name) {
+	_separate();
+	_putString(name);
+	_put(':');
+	_after_key = true;
+	return *this;
+}
+
+JsonWriter &JsonWriter::beginObject(const char *name) {
+	if (name) key(name);
+	_separate();	// Only clears the key after a name
+	_put('{');
+	_depth++;
+	if (_depth < JSON_WRITER_DEPTH) _first |= 1 << _depth;
+	return *this;
+}
+
+JsonWriter &JsonWriter::endObject() {
+	_put('}');
+	if (_depth) _depth--;
+	return *this;
+}
+
+JsonWriter &JsonWriter::beginArray(const char *name) {
+	if (name) key(name);
+	_separate();	// Only clears the key after a name
+	_put('[');
+	_depth++;
+	if (_depth < JSON_WRITER_DEPTH) _first |= 1 << _depth;
+	return *this;
+}
+
+JsonWriter &JsonWriter::endArray() {
+	_put(']');
+	if (_depth) _depth--;
+	return *this;
+}
+
+void JsonWriter::_putString(const char *str) {
+	static const char HEX_DIGITS[] = "0123456789abcdef";
+	_put('"');
+	for (const char *run = str; ; str++) {
+		// Runs of plain characters are copied at once
+		const char c = *str;
+		if (c && c != '"' && c != '\\' && (uint8_t)c >= 0x20) continue;
+		_put(run, str - run);
+		if (!c) break;
+		char escaped[6] = { '\\', c };
+		uint8_t len = 2;
+		if (c == '\n') escaped[1] = 'n';
+		else if (c == '\r') escaped[1] = 'r';
+		else if (c == '\t') escaped[1] = 't';
+		else if ((uint8_t)c < 0x20) {
+			memcpy(escaped + 1, "u00", 3);
+			escaped[4] = HEX_DIGITS[(uint8_t)c >> 4];
+			escaped[5] = HEX_DIGITS[c & 0x0F];
+			len = 6;
+		}
+		_put(escaped, len);
+		run = str + 1;
+	}
+	_put('"');
+}
+
+JsonWriter &JsonWriter::value(const char *str) {
+	_separate();
+	if (str) _putString(str);
+	else _put("null", 4);
+	return *this;
+}
+
+JsonWriter &JsonWriter::value(long n) {
+	char numStr[12];
+	_separate();
+	_put(numStr, formatScaled(numStr, n, 0, 0));
+	return *this;
+}
+
+JsonWriter &JsonWriter::value(unsigned long n) {
+	char numStr[12];
+	_separate();
+	_put(numStr, formatScaled(numStr, (int64_t)n, 0, 0));
+	return *this;
+}
+
+JsonWriter &JsonWriter::fixed(double value, uint8_t width, uint8_t dec) {
+	char numStr[FORMAT_MAX_LEN];
+	_separate();
+	_put(numStr, formatFixed(numStr, value, width, dec));
+	return *this;
+}
+
+JsonWriter &JsonWriter::rawValue(const char *json) {
+	_separate();
+	_put(json, strlen(json));
+	return *this;
+}
+
+JsonWriter &JsonWriter::raw(const char *text) {
+	_put(text, strlen(text));
+	return *this;
+}
+
+uint16_t JsonWriter::send() {
+	if (_sink) {
+		_put("\r\n", 2); // As println()
+		_flush();
+	}
+	return getLength();
+}
+
+void benchmarkJsonWriter(Print &out) {
+	/* Times the body of a verbose status reply, one field at a time, built the old way with dtostrf and sprintf and
+	then with JsonWriter, both into a RAM buffer so the USB link isn't timed.
+	*/
+	const uint16_t BENCH_FIELDS = 64;
+	const uint8_t WIDTH = 5, DEC = 3;
+	char buf[JSON_WRITER_CHUNK * 4];
+	volatile uint16_t keep = 0;	// So neither loop is optimised away
+	uint32_t old_bytes = 0, new_bytes = 0;
+	uint32_t start = cycleCount();
+	for (uint16_t n = 0; n < BENCH_FIELDS; n++) {
+		char valueStr[20];
+		uint16_t idx = 0;
+		dtostrf(12.345 + n, WIDTH, DEC, valueStr);
+		idx += sprintf(buf + idx, "\"Voltage\":{\"value\":%s", valueStr);
+		dtostrf(11.5 - n, WIDTH, DEC, valueStr);
+		idx += sprintf(buf + idx, ",\"min\":%s", valueStr);
+		dtostrf(14.25 + n, WIDTH, DEC, valueStr);
+		idx += sprintf(buf + idx, ",\"max\":%s,\"sample_ms\":%u}", valueStr, n);
+		old_bytes += idx;
+	}
+	const uint32_t old_cycles = cycleCount() - start;
+	keep += buf[0];
+	start = cycleCount();
+	for (uint16_t n = 0; n < BENCH_FIELDS; n++) {
+		JsonWriter writer(buf, sizeof(buf));
+		writer.beginObject("Voltage");
+		writer.key("value").fixed(12.345 + n, WIDTH, DEC);
+		writer.key("min").fixed(11.5 - n, WIDTH, DEC);
+		writer.key("max").fixed(14.25 + n, WIDTH, DEC);
+		writer.key("sample_ms").value(n);
+		writer.endObject();
+		new_bytes += writer.getLength();
+	}
+	const uint32_t new_cycles = cycleCount() - start;
+	keep += buf[0];
+	// Four numbers a field
+	out.print("Reply formatting, cycles per number: sprintf/dtostrf ");
+	out.print(old_cycles / (BENCH_FIELDS * 4));
+	out.print(", JsonWriter ");
+	out.println(new_cycles / (BENCH_FIELDS * 4));
+	out.print("Reply formatting, bytes/s: sprintf/dtostrf ");
+	out.print((uint32_t)((uint64_t)old_bytes * F_CPU / old_cycles));
+	out.print(", JsonWriter ");
+	out.println((uint32_t)((uint64_t)new_bytes * F_CPU / new_cycles));
+}
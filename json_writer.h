@@ -0,0 +1,73 @@
+// json_writer.h
+
+#ifndef _JSON_WRITER_h
+#define _JSON_WRITER_h
+
+#include <Arduino.h>
+
+#define JSON_WRITER_CHUNK	128	// Bytes buffered before a streaming JsonWriter writes to its sink
+#define JSON_WRITER_DEPTH	16	// Nesting levels that get commas put in for them
+#define FORMAT_MAX_DEC	9	// Decimal places formatFixed() will give
+#define FORMAT_MAX_LEN	24	// Holds any formatted number and its terminator. Wider widths are cut to fit.
+
+/*
+Number formatting without printf or dtostrf, which pull in soft float division loops and newlib's float printing.
+A double is multiplied once by a power of ten and rounded, and the digits of the resulting integer are produced with
+integer division, so the decimal places are exact and there is no repeated float arithmetic. The output matches
+dtostrf(): right justified in width with spaces, rounded to dec places, except that halves always round away from
+zero and a negative value that rounds to zero prints as 0. Anything that doesn't fit an int64 at dec
+places, like NaN or infinity, comes out as null so replies stay valid JSON. Each returns the length written.
+*/
+uint8_t	formatFixed(char *out_str, double value, uint8_t width, uint8_t dec);	// Drop-in for dtostrf(value, width, dec, out_str)
+uint8_t	formatScaled(char *out_str, int64_t scaled, uint8_t width, uint8_t dec);	// scaled is value * 10^dec
+uint8_t	formatQ16(char *out_str, int32_t q16, uint8_t width, uint8_t dec);	// Q16.16 fixed point, without going through double
+
+/*
+class JsonWriter writes a JSON message into a small buffer, putting in commas and checking bounds as it goes.
+With a sink, a full buffer is written to the sink and reused, so a reply of any length goes out through
+JSON_WRITER_CHUNK bytes of stack and is on the wire while the rest of it is still being made. Without one,
+the buffer holds the whole message and anything that doesn't fit is dropped and flagged by isTruncated().
+Values after key() or inside an array get a comma before them when needed, so callers never track "first".
+raw() writes text as is and doesn't count as a value, for wrapping helpers that write their own commas.
+*/
+class JsonWriter {
+public:
+	JsonWriter(char *buf, uint16_t size, Print *sink = 0) { _buf = buf; _size = size; _sink = sink; _idx = 0; _sent = 0; _depth = 0; _first = 1; _after_key = false; _truncated = false; }
+	JsonWriter	&beginObject(const char *name = 0);	// Inside an object name is the key
+	JsonWriter	&endObject();
+	JsonWriter	&beginArray(const char *name = 0);
+	JsonWriter	&endArray();
+	JsonWriter	&key(const char *name);
+	JsonWriter	&value(const char *str);	// Quoted and escaped. NULL gives null.
+	JsonWriter	&value(int n) { return value((long)n); }
+	JsonWriter	&value(unsigned int n) { return value((unsigned long)n); }
+	JsonWriter	&value(long n);
+	JsonWriter	&value(unsigned long n);
+	JsonWriter	&value(bool b) { return rawValue(b ? "true" : "false"); }
+	JsonWriter	&fixed(double value, uint8_t width, uint8_t dec);	// As formatFixed()
+	JsonWriter	&rawValue(const char *json);	// A value already formatted as JSON
+	JsonWriter	&raw(const char *text);
+	uint16_t	send();	// Writes what's left and a line end to the sink. Returns the message length.
+	uint16_t	getLength() { return _sent + _idx; }
+	const char	*getBuffer() { _buf[_idx] = '\0'; return _buf; }	// Without a sink, the whole message
+	bool	isTruncated() { return _truncated; }
+private:
+	void	_separate();	// Comma before a value or key, unless it's the first at this level
+	void	_putString(const char *str);
+	void	_put(const char *str, uint16_t len);
+	void	_put(char c) { _put(&c, 1); }
+	void	_flush();
+	char	*_buf;
+	uint16_t	_size;
+	uint16_t	_idx;
+	uint16_t	_sent;	// Bytes already written to the sink
+	Print	*_sink;
+	uint16_t	_first;	// Bit per nesting level, set until that level has had a value
+	uint8_t	_depth;
+	bool	_after_key;
+	bool	_truncated;
+};
+
+void	benchmarkJsonWriter(Print &out);	// Cycle counts of a status reply built with sprintf and dtostrf, and with JsonWriter
+
+#endif
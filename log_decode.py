@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+"""Turns the binary trace log sent on Serial1 back into text.
+
+Usage:
+	log_decode.py capture.bin		decode a saved capture
+	log_decode.py /dev/ttyUSB1		follow a serial port (needs pyserial)
+
+Message formats are read from log_formats.h next to this script, so it must match the firmware that sent them.
+Record layout, little endian: 0xA5 | id | argument count | millis() uint32 | arguments int32 each
+"""
+
+import os
+import re
+import struct
+import sys
+
+LOG_SYNC = 0xA5
+LOG_BAUD = 57600
+LEVELS = {"LOG_LEVEL_ERROR": "E", "LOG_LEVEL_WARN": "W", "LOG_LEVEL_INFO": "I", "LOG_LEVEL_DEBUG": "D", "LOG_LEVEL_TRACE": "T"}
+CONVERSION = re.compile(r"%([-+ 0#]*\d*(?:\.\d+)?)(l{0,2}|h{0,2})([diuxXfcs%])")
+
+
+def load_formats(path):
+	formats = []
+	with open(path) as header:
+		for line in header:
+			match = re.search(r'X\((\w+),\s*(\w+),\s*"((?:[^"\\]|\\.)*)"\)', line)
+			if match:
+				formats.append((match.group(1), LEVELS.get(match.group(2), "?"), match.group(3)))
+	return formats
+
+
+def render(format_str, args):
+	"""printf style, with each conversion taking one 32 bit argument."""
+	out = []
+	pos = 0
+	arg = 0
+	for match in CONVERSION.finditer(format_str):
+		out.append(format_str[pos:match.start()])
+		pos = match.end()
+		flags, conv = match.group(1), match.group(3)
+		if conv == "%":
+			out.append("%")
+			continue
+		value = args[arg] if arg < len(args) else 0
+		arg += 1
+		if conv == "f":
+			value = struct.unpack("<f", struct.pack("<i", value))[0]
+		elif conv in "uxX":
+			value &= 0xFFFFFFFF
+		elif conv == "c":
+			value = chr(value & 0xFF)
+		elif conv == "s":
+			value = "<str>"
+		out.append(("%" + flags + ("d" if conv in "iu" else conv)) % value)
+	out.append(format_str[pos:])
+	return "".join(out)
+
+
+def decode(stream, formats):
+	buf = b""
+	while True:
+		chunk = stream.read(256)
+		if not chunk:
+			return
+		buf += chunk
+		while True:
+			start = buf.find(bytes([LOG_SYNC]))
+			if start < 0:
+				buf = b""
+				break
+			buf = buf[start:]
+			if len(buf) < 7:
+				break
+			log_id, argc = buf[1], buf[2]
+			if log_id >= len(formats) or argc > 6:
+				buf = buf[1:]  # Not a record. Look for the next sync byte.
+				continue
+			length = 7 + 4 * argc
+			if len(buf) < length:
+				break
+			ms = struct.unpack_from("<I", buf, 3)[0]
+			args = list(struct.unpack_from("<%di" % argc, buf, 7))
+			name, level, format_str = formats[log_id]
+			print("%10.3f %s %s" % (ms / 1000.0, level, render(format_str, args)), flush=True)
+			buf = buf[length:]
+
+
+def main():
+	if len(sys.argv) != 2:
+		print(__doc__)
+		return 1
+	formats = load_formats(os.path.join(os.path.dirname(os.path.abspath(__file__)), "log_formats.h"))
+	source = sys.argv[1]
+	if source.startswith("/dev/") or source.upper().startswith("COM"):
+		import serial
+		stream = serial.Serial(source, LOG_BAUD)
+	else:
+		stream = open(source, "rb")
+	try:
+		decode(stream, formats)
+	except KeyboardInterrupt:
+		pass
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,34 @@
+// log_formats.h
+
+#ifndef _LOG_FORMATS_h
+#define _LOG_FORMATS_h
+
+/*
+Every trace log message, one per line. The firmware only sends the line's position and the arguments, so this file
+is also what log_decode.py reads to turn records back into text. Only append lines, or old captures decode wrongly.
+	id	Name used in LOG()
+	level	LOG_LEVEL_ERROR to LOG_LEVEL_TRACE
+	format	printf format. Each conversion takes one 32 bit argument. %f arguments must be passed through logFloat().
+*/
+#define LOG_FORMAT_TABLE(X) \
+	X(LOG_BOOT,	LOG_LEVEL_INFO,	"UNC-IMS Power Monitor %f") \
+	X(LOG_CHANNELS,	LOG_LEVEL_INFO,	"%u channels, from EEPROM: %u") \
+	X(LOG_CHANNELS_UNSAMPLED,	LOG_LEVEL_ERROR,	"Some channels can't be sampled") \
+	X(LOG_SAMPLER_FAIL,	LOG_LEVEL_ERROR,	"Unable to start ADC sampler") \
+	X(LOG_RTC_UNSYNCED,	LOG_LEVEL_WARN,	"Unable to sync with the RTC") \
+	X(LOG_RTC_TIME,	LOG_LEVEL_INFO,	"RTC has set the system time to %lu %06lu") \
+	X(LOG_SETUP_DONE,	LOG_LEVEL_INFO,	"setup done") \
+	X(LOG_RX,	LOG_LEVEL_DEBUG,	"JSON message, %u bytes") \
+	X(LOG_RX_ERROR,	LOG_LEVEL_WARN,	"Bad JSON request, rest of line dropped") \
+	X(LOG_REQUEST,	LOG_LEVEL_DEBUG,	"JSON request %u, id %d") \
+	X(LOG_BAD_REQUEST,	LOG_LEVEL_WARN,	"Can't process request type %u") \
+	X(LOG_RESPONSE,	LOG_LEVEL_DEBUG,	"Response to id %d, %u bytes") \
+	X(LOG_PUBLISH,	LOG_LEVEL_DEBUG,	"Subscription update, %u bytes") \
+	X(LOG_SUBSCRIBE,	LOG_LEVEL_DEBUG,	"Subscribe, min %lu ms, max %lu ms") \
+	X(LOG_SET,	LOG_LEVEL_DEBUG,	"Setting channel %u to %f") \
+	X(LOG_FREE_RAM,	LOG_LEVEL_DEBUG,	"Free RAM %lu") \
+	X(LOG_RATE_BURST,	LOG_LEVEL_INFO,	"Transient, sample rate %lu Hz") \
+	X(LOG_TRANSIENT,	LOG_LEVEL_INFO,	"Event %lu on pin %u, raw %u") \
+	X(LOG_ADC_BLOCK,	LOG_LEVEL_TRACE,	"pin %u, %u samples, value %f")
+
+#endif
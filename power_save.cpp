@@ -0,0 +1,45 @@
+// Sleep between loop() passes and watchdog service
+
+#include "power_save.h"
+
+
+void WatchdogReset() {
+	static uint32_t last_refresh_ms = 0;
+	const uint32_t now_ms = millis();
+	if ((now_ms - last_refresh_ms) < WDOG_MIN_REFRESH_MS) return; // Too soon. Timeout is far longer than this.
+	last_refresh_ms = now_ms;
+	noInterrupts();
+	WDOG_REFRESH = 0xA602;
+	WDOG_REFRESH = 0xB480;
+	interrupts();
+}
+
+void restartCpu() {
+	// Same as the reset pin, so setup() runs again
+	SCB_AIRCR = 0x05FA0004; // VECTKEY | SYSRESETREQ
+	while (true);
+}
+
+void IdleManager::sleepUntil(uint32_t deadline_ms, bool wake_on_rx) {
+	// Signed difference handles millis() roll over
+	while ((int32_t)(deadline_ms - millis()) > 0 && !(wake_on_rx && Serial.available())) {
+		WatchdogReset();
+		const uint32_t sleep_start_us = micros();
+		asm volatile("wfi");
+		_sleep_us += micros() - sleep_start_us;
+	}
+	const uint32_t window_us = micros() - _start_us;
+	if (window_us >= IDLE_WINDOW_US) {
+		_duty = 1.0 - (double)min(_sleep_us, window_us) / (double)window_us;
+		resetStats();
+	}
+}
+
+void IdleManager::resetStats() {
+	_start_us = micros();
+	_sleep_us = 0;
+}
+
+double IdleManager::getSelfCurrentmA() {
+	return IDLE_FIXED_MA + _duty * IDLE_ACTIVE_MA + (1.0 - _duty) * IDLE_SLEEP_MA;
+}
@@ -0,0 +1,39 @@
+// power_save.h
+
+#ifndef _POWER_SAVE_h
+#define _POWER_SAVE_h
+
+#include <Arduino.h>
+
+#define WDOG_MIN_REFRESH_MS	2	// Refreshing the watchdog faster than its 1 kHz clock can tell apart resets the MCU
+#define IDLE_ACTIVE_MA	30.0	// Board draw with the core running at 72 MHz
+#define IDLE_SLEEP_MA	17.0	// Board draw in WFI with the PDB, ADCs and USB still clocked
+#define IDLE_FIXED_MA	8.5	// Current sensors and voltage divider, drawn all the time
+#define IDLE_WINDOW_US	10000000UL	// Duty cycle is reported over windows this long. Must be well under a micros() wrap.
+
+void	WatchdogReset();	// Refreshes the watchdog. Calls closer than WDOG_MIN_REFRESH_MS apart do nothing.
+void	restartCpu();	// System reset. Does not return.
+
+/*
+class IdleManager sleeps the core whenever no loop() task is due.
+sleepUntil() executes WFI until the deadline passes or, if wake_on_rx, USB data arrives. Any interrupt wakes the core,
+including the sampler ISR and the 1 ms SysTick, so the watchdog is kept serviced while asleep.
+Low leakage stop is not used because it stops the PDB and the USB clock, which would end sampling.
+Sleep time is measured with micros() because the cycle counter halts while the core is gated. Samples are timed by
+ADCSampler's clock, which counts PDB triggers, for the same reason.
+*/
+class IdleManager {
+public:
+	IdleManager() { _duty = 1.0; resetStats(); }
+	void	sleepUntil(uint32_t deadline_ms, bool wake_on_rx = true);	// wake_on_rx false while requests are held back
+	void	resetStats();
+	double	getDutyCycle() { return _duty; }	// Fraction of the last window spent awake, 0 to 1
+	double	getSelfCurrentmA();	// Estimated board draw at the measured duty cycle
+private:
+	uint32_t	_start_us;	// Start of the current window
+	uint32_t	_sleep_us;	// Time asleep in the current window
+	double	_duty;	// Duty cycle of the last complete window
+
+};
+
+#endif
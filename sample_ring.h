@@ -0,0 +1,55 @@
+// sample_ring.h
+
+#ifndef _SAMPLE_RING_h
+#define _SAMPLE_RING_h
+
+#include <stdint.h>
+
+/*
+class SampleRing is a lock free single producer, single consumer ring buffer.
+The producer (usually an ISR) only ever writes _head and the consumer (loop()) only ever writes _tail,
+so no interrupts need to be disabled on either side. SIZE must be a power of two.
+One slot is always left empty so that a full ring can be told apart from an empty one.
+*/
+template <typename T, uint16_t SIZE>
+class SampleRing {
+	static_assert((SIZE & (SIZE - 1)) == 0, "SampleRing SIZE must be a power of two");
+public:
+	SampleRing() {
+		_head = 0;
+		_tail = 0;
+		_overruns = 0;
+	}
+	// Producer side
+	bool	push(const T &item) {
+		const uint16_t next = (_head + 1) & (SIZE - 1);
+		if (next == _tail) {
+			_overruns++; // Consumer is not keeping up. Newest sample is dropped.
+			return false;
+		}
+		_buf[_head] = item;
+		__sync_synchronize(); // item must be in memory before the consumer can see it
+		_head = next;
+		return true;
+	}
+	// Consumer side
+	bool	pop(T &item) {
+		if (_tail == _head) return false; // empty
+		item = _buf[_tail];
+		__sync_synchronize();
+		_tail = (_tail + 1) & (SIZE - 1);
+		return true;
+	}
+	uint16_t	available() const { return (_head - _tail) & (SIZE - 1); }
+	bool	isEmpty() const { return _head == _tail; }
+	void	clear() { _tail = _head; } // Consumer side. Discards everything queued.
+	uint32_t	getOverruns() const { return _overruns; }
+	uint16_t	capacity() const { return SIZE - 1; }
+private:
+	T	_buf[SIZE];
+	volatile uint16_t	_head;	// Next slot to write. Only written by producer.
+	volatile uint16_t	_tail;	// Next slot to read. Only written by consumer.
+	volatile uint32_t	_overruns;	// Samples dropped because ring was full.
+};
+
+#endif
@@ -0,0 +1,80 @@
+// Cooperative scheduler for loop()
+
+#include "scheduler.h"
+
+
+int8_t Scheduler::addTask(const char *name, TaskFunc func, uint32_t period_ms, uint8_t priority) {
+	if (_task_count >= SCHED_MAX_TASKS || func == NULL) return -1;
+	SchedTask &task = _tasks[_task_count];
+	task.name = name;
+	task.func = func;
+	task.period_ms = period_ms;
+	task.priority = priority;
+	task.next_ms = millis();
+	task.wcet_us = 0;
+	task.last_us = 0;
+	task.runs = 0;
+	task.late = 0;
+	return _task_count++;
+}
+
+bool Scheduler::runNext() {
+	const uint32_t now_ms = millis();
+	int8_t pick = -1;
+	for (uint8_t id = 0; id < _task_count; id++) {
+		// Signed difference handles millis() roll over
+		if ((int32_t)(now_ms - _tasks[id].next_ms) < 0) continue; // Not due
+		if (pick < 0 || _tasks[id].priority < _tasks[pick].priority ||
+			(_tasks[id].priority == _tasks[pick].priority && (int32_t)(_tasks[id].next_ms - _tasks[pick].next_ms) < 0)) {
+			pick = id;
+		}
+	}
+	if (pick < 0) return false;
+	SchedTask &task = _tasks[pick];
+	if (task.period_ms && (now_ms - task.next_ms) >= task.period_ms) task.late++;
+	task.next_ms = now_ms + task.period_ms; // Set before running so the task can override it with setNextRun()
+	const uint32_t start_us = micros();
+	task.func();
+	task.last_us = micros() - start_us;
+	if (task.last_us > task.wcet_us) task.wcet_us = task.last_us;
+	task.runs++;
+	return true;
+}
+
+void Scheduler::setNextRun(int8_t id, uint32_t in_ms) {
+	if (id < 0 || id >= _task_count) return;
+	SchedTask &task = _tasks[id];
+	const uint32_t next_ms = millis() + min(in_ms, task.period_ms);
+	if ((int32_t)(next_ms - task.next_ms) < 0) task.next_ms = next_ms;
+}
+
+uint32_t Scheduler::msUntilNext() {
+	const uint32_t now_ms = millis();
+	uint32_t wait_ms = UINT32_MAX;
+	for (uint8_t id = 0; id < _task_count; id++) {
+		const int32_t until_ms = (int32_t)(_tasks[id].next_ms - now_ms);
+		if (until_ms <= 0) return 0;
+		wait_ms = min(wait_ms, (uint32_t)until_ms);
+	}
+	return wait_ms;
+}
+
+void Scheduler::resetStats() {
+	for (uint8_t id = 0; id < _task_count; id++) {
+		_tasks[id].wcet_us = 0;
+		_tasks[id].runs = 0;
+		_tasks[id].late = 0;
+	}
+}
+
+uint16_t Scheduler::tasksToStr(char *out_str, uint16_t idx) {
+	idx += sprintf(out_str + idx, ",\"tasks\":{");
+	for (uint8_t id = 0; id < _task_count; id++) {
+		const SchedTask &task = _tasks[id];
+		if (id) idx += sprintf(out_str + idx, ",");
+		idx += sprintf(out_str + idx, "\"%s\":{\"period_ms\":%lu,\"priority\":%u,\"wcet_us\":%lu,\"last_us\":%lu,\"runs\":%lu,\"late\":%lu}",
+			task.name, task.period_ms, task.priority, task.wcet_us, task.last_us, task.runs, task.late);
+	}
+	idx += sprintf(out_str + idx, "}");
+	return idx;
+}
@@ -0,0 +1,45 @@
+// scheduler.h
+
+#ifndef _SCHEDULER_h
+#define _SCHEDULER_h
+
+#include <Arduino.h>
+
+#define SCHED_MAX_TASKS	8
+
+typedef void (*TaskFunc)();
+
+struct SchedTask {
+	const char	*name;
+	TaskFunc	func;
+	uint32_t	period_ms;
+	uint8_t	priority;	// 0 is most urgent
+	uint32_t	next_ms;	// millis() at which the task is next due
+	uint32_t	wcet_us;	// Longest run seen
+	uint32_t	last_us;	// Most recent run
+	uint32_t	runs;
+	uint32_t	late;	// Runs that started a whole period or more after they were due
+};
+
+/*
+class Scheduler is a cooperative, deadline driven task runner for loop().
+runNext() runs at most one task: the most urgent of those that are due, with the earliest due time breaking ties.
+Tasks run to completion, so the latency of any task is bounded by the longest WCET of the others rather than by the
+whole loop. Each run is timed to track worst case execution time.
+*/
+class Scheduler {
+public:
+	Scheduler() { _task_count = 0; }
+	int8_t	addTask(const char *name, TaskFunc func, uint32_t period_ms, uint8_t priority); // Returns task id or -1
+	bool	runNext();	// Returns false if no task was due
+	void	trigger(int8_t id) { if (id >= 0 && id < _task_count) _tasks[id].next_ms = millis(); }	// Makes a task due now
+	void	setNextRun(int8_t id, uint32_t in_ms);	// Brings the next run forward to in_ms from now, but not later than one period
+	uint32_t	msUntilNext();	// 0 if something is already due
+	void	resetStats();
+	uint16_t	tasksToStr(char *out_str, uint16_t idx);	// Appends ,"tasks":{...}
+private:
+	SchedTask	_tasks[SCHED_MAX_TASKS];
+	uint8_t	_task_count;
+};
+
+#endif
@@ -0,0 +1,100 @@
+// Cycle counter based timebase, and wall clock timestamps disciplined to the RTC
+
+#include "timebase.h"
+
+// Written only by rtcSecondEdge(). Readers retry if _rtc_seq changes under them.
+static volatile uint32_t	_rtc_edge_sec;	// RTC_TSR at the last edge
+static volatile uint32_t	_rtc_edge_us;	// micros() at the last edge
+static volatile uint32_t	_rtc_us_x16 = 1000000UL << RTC_DRIFT_SHIFT;	// Measured micros() per RTC second << RTC_DRIFT_SHIFT
+static volatile uint32_t	_rtc_seq;	// Edges seen. 0 until the first edge after a resync.
+
+
+void timebaseBegin() {
+	ARM_DEMCR |= ARM_DEMCR_TRCENA;	// Enable trace, needed for DWT
+	ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+	NVIC_SET_PRIORITY(IRQ_RTC_SECOND, RTC_EDGE_PRIORITY);
+	RTC_IER |= RTC_IER_TSIE;
+	NVIC_ENABLE_IRQ(IRQ_RTC_SECOND);
+}
+
+void rtcSecondEdge() {
+	const uint32_t now_us = micros();
+	const uint32_t sec = RTC_TSR;
+	if (_rtc_seq && sec == _rtc_edge_sec + 1) {
+		// A whole RTC second in micros(). Averaging tracks the drift without following jitter in interrupt latency.
+		const uint32_t measured_us = now_us - _rtc_edge_us;
+		if (measured_us > 1000000UL - RTC_MAX_DRIFT_US && measured_us < 1000000UL + RTC_MAX_DRIFT_US) {
+			_rtc_us_x16 = _rtc_us_x16 + measured_us - (_rtc_us_x16 >> RTC_DRIFT_SHIFT);
+		}
+	}
+	_rtc_edge_sec = sec;
+	_rtc_edge_us = now_us;
+	_rtc_seq = _rtc_seq + 1;
+	if (_rtc_seq == 0) _rtc_seq = 1; // 0 means no edge yet
+}
+
+void rtcResync() {
+	_rtc_seq = 0;
+}
+
+uint32_t getMicrosPerRtcSecond() {
+	return _rtc_us_x16 >> RTC_DRIFT_SHIFT;
+}
+
+uint32_t MicroTicker::elapsedUs(uint32_t cycles) {
+	if (!_started) {
+		_last_cycles = cycles;
+		_remainder = 0;
+		_started = true;
+		return 0;
+	}
+	// Unsigned subtraction handles counter roll over
+	const uint32_t delta = (cycles - _last_cycles) + _remainder;
+	_last_cycles = cycles;
+	_remainder = delta % CYCLES_PER_US;
+	return delta / CYCLES_PER_US;
+}
+
+Timestamp timestampNow() {
+	Timestamp ts;
+	uint32_t seq, edge_us, us_x16;
+	do {
+		seq = _rtc_seq;
+		ts.sec = _rtc_edge_sec;
+		edge_us = _rtc_edge_us;
+		us_x16 = _rtc_us_x16;
+	} while (seq != _rtc_seq);
+	if (seq == 0) {
+		// No edge since the RTC was set. Whole seconds only.
+		ts.sec = now();
+		ts.ms = 0;
+		return ts;
+	}
+	// A late or missed interrupt just carries into the seconds
+	const uint32_t ms = (uint32_t)(((uint64_t)(micros() - edge_us) * (1000UL << RTC_DRIFT_SHIFT)) / us_x16);
+	ts.sec += ms / 1000;
+	ts.ms = ms % 1000;
+	return ts;
+}
+
+const tmElements_t &calendar(uint32_t sec) {
+	static uint32_t cached_sec = 0;
+	static tmElements_t cached_tm;
+	static bool cached = false;
+	if (!cached || sec != cached_sec) {
+		breakTime(sec, cached_tm);
+		cached_sec = sec;
+		cached = true;
+	}
+	return cached_tm;
+}
+
+void timestampToStr(const Timestamp &ts, char out_str[TIMESTAMP_STR_LEN]) {
+	const tmElements_t &tm = calendar(ts.sec);
+	snprintf(out_str, TIMESTAMP_STR_LEN, "%4u%02u%02u%02u%02u%02u", tmYearToCalendar(tm.Year), tm.Month, tm.Day, tm.Hour, tm.Minute, tm.Second);
+}
+
+void timestampToLongStr(const Timestamp &ts, char out_str[TIMESTAMP_LONG_LEN]) {
+	const tmElements_t &tm = calendar(ts.sec);
+	snprintf(out_str, TIMESTAMP_LONG_LEN, "%4u-%02u-%02u %02u:%02u:%02u.%03u", tmYearToCalendar(tm.Year), tm.Month, tm.Day, tm.Hour, tm.Minute, tm.Second, ts.ms);
+}
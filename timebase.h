@@ -0,0 +1,58 @@
+// timebase.h
+
+#ifndef _TIMEBASE_h
+#define _TIMEBASE_h
+
+#include <Arduino.h>
+#include <TimeLib.h>
+
+#define CYCLES_PER_US	(F_CPU / 1000000)	// 72 or 96 on a Teensy 3.2. Must be a whole number.
+#define TIMESTAMP_STR_LEN	15	// CCYYMMDDHHmmss and the terminator
+#define TIMESTAMP_LONG_LEN	24	// CCYY-MM-DD HH:mm:ss.mmm and the terminator
+#define RTC_EDGE_PRIORITY	64	// Above the default 128 of the ADC interrupt, so a timestamp taken there is never torn
+#define RTC_DRIFT_SHIFT	4	// micros() per RTC second is averaged over about 2^RTC_DRIFT_SHIFT seconds
+#define RTC_MAX_DRIFT_US	2000	// Seconds measured further than this from 1000000 us are ignored
+
+void	timebaseBegin();	// Starts the DWT cycle counter and the RTC seconds interrupt. Call once from setup() before sampling starts.
+void	rtcSecondEdge();	// Must be called from rtc_seconds_isr()
+void	rtcResync();	// Call after setting the RTC. Timestamps fall back to now() until the next second edge.
+uint32_t	getMicrosPerRtcSecond();	// micros() per RTC second, as currently measured
+
+inline uint32_t	cycleCount() { return ARM_DWT_CYCCNT; }	// Wraps every 2^32 / F_CPU seconds (~60 s at 72 MHz)
+
+/*
+class MicroTicker turns cycle counts, from the cycle counter or ADCSampler's clock, into elapsed whole microseconds.
+Cycles left over after the division are carried into the next interval, so summing the results never drifts
+from the count no matter how often it is called. Intervals must be shorter than one counter wrap.
+*/
+class MicroTicker {
+public:
+	MicroTicker() { restart(); }
+	void	restart() { _started = false; _remainder = 0; }
+	bool	isStarted() { return _started; }
+	uint32_t	elapsedUs(uint32_t cycles);	// Returns 0 and starts timing on the first call after restart()
+private:
+	uint32_t	_last_cycles;
+	uint32_t	_remainder;	// Cycles not yet accounted for, always < CYCLES_PER_US
+	bool	_started;
+};
+
+/*
+Sample times are kept as a Timestamp and only turned into text when a message includes them.
+The calendar breakdown is cached for the last second asked for, so formatting the many timestamps that fall in the
+same second costs one breakTime() between them.
+Seconds come from the RTC. Milliseconds are interpolated from micros() since the last RTC seconds interrupt, scaled by
+the measured length of an RTC second, so the core crystal's drift against the RTC is taken out continuously and the
+milliseconds always roll over with the RTC second. timestampNow() can be called from any interrupt.
+*/
+struct Timestamp {
+	uint32_t	sec;	// UTC seconds since 1970
+	uint16_t	ms;	// Milliseconds into sec
+};
+
+Timestamp	timestampNow();
+const tmElements_t	&calendar(uint32_t sec);	// Cached breakdown of sec
+void	timestampToStr(const Timestamp &ts, char out_str[TIMESTAMP_STR_LEN]);	// CCYYMMDDHHmmss. Milliseconds are reported separately.
+void	timestampToLongStr(const Timestamp &ts, char out_str[TIMESTAMP_LONG_LEN]);	// CCYY-MM-DD HH:mm:ss.mmm
+
+#endif
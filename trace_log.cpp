@@ -0,0 +1,43 @@
+// Binary trace log. See trace_log.h.
+
+#include "trace_log.h"
+
+TraceLog traceLog;
+
+void TraceLog::write(uint8_t id, uint8_t argc, const int32_t *args) {
+	uint8_t rec[7 + 4 * LOG_MAX_ARGS];
+	uint8_t len = 0;
+	const uint32_t now_ms = millis();
+	argc = min(argc, (uint8_t)LOG_MAX_ARGS);
+	rec[len++] = LOG_SYNC;
+	rec[len++] = id;
+	rec[len++] = argc;
+	memcpy(rec + len, &now_ms, 4); // Little endian, like the host decoder expects
+	len += 4;
+	memcpy(rec + len, args, 4 * argc);
+	len += 4 * argc;
+	// May be called from an interrupt, so restore the mask rather than enabling interrupts
+	uint32_t primask;
+	__asm__ volatile("mrs %0, primask\n\tcpsid i" : "=r" (primask) :: "memory");
+	const uint16_t used = (_head - _tail) & (LOG_RING_SIZE - 1);
+	if (len > LOG_RING_SIZE - 1 - used) _dropped = _dropped + 1;
+	else {
+		uint16_t head = _head;
+		for (uint8_t i = 0; i < len; i++) {
+			_buf[head] = rec[i];
+			head = (head + 1) & (LOG_RING_SIZE - 1);
+		}
+		_head = head;
+	}
+	__asm__ volatile("msr primask, %0" :: "r" (primask) : "memory");
+}
+
+void TraceLog::drain(Stream &out) {
+	int room = out.availableForWrite();
+	uint16_t tail = _tail;
+	while (room-- > 0 && tail != _head) {
+		out.write(_buf[tail]);
+		tail = (tail + 1) & (LOG_RING_SIZE - 1);
+	}
+	_tail = tail;
+}
@@ -0,0 +1,73 @@
+// trace_log.h
+
+#ifndef _TRACE_LOG_h
+#define _TRACE_LOG_h
+
+#include <Arduino.h>
+
+#define LOG_LEVEL_NONE	0
+#define LOG_LEVEL_ERROR	1
+#define LOG_LEVEL_WARN	2
+#define LOG_LEVEL_INFO	3
+#define LOG_LEVEL_DEBUG	4
+#define LOG_LEVEL_TRACE	5
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL	LOG_LEVEL_DEBUG	// Messages above this level are compiled out. Can be set from the build flags.
+#endif
+#define LOG_RING_SIZE	1024	// Bytes of records waiting to be sent. Must be a power of two.
+#define LOG_MAX_ARGS	6
+#define LOG_SYNC	0xA5	// First byte of every record
+#define LOG_BAUD	57600	// Serial1
+
+#include "log_formats.h"
+
+#define LOG_FORMAT_ID(id, level, format) id,
+enum LOG_ID {
+	LOG_FORMAT_TABLE(LOG_FORMAT_ID)
+	LOG_ID_COUNT
+};
+#undef LOG_FORMAT_ID
+
+#define LOG_FORMAT_LEVEL(id, level, format) level,
+constexpr uint8_t LOG_LEVELS[LOG_ID_COUNT] = { LOG_FORMAT_TABLE(LOG_FORMAT_LEVEL) };
+#undef LOG_FORMAT_LEVEL
+
+/*
+LOG(id, args...) queues a message from log_formats.h if its level is enabled. Otherwise the condition is a compile
+time constant and the call, including working out its arguments, is removed entirely.
+Records are binary and sent little endian:
+	LOG_SYNC | id | argument count | millis() (4 bytes) | arguments (4 bytes each)
+*/
+#define LOG(id, ...)	do { if (LOG_LEVELS[id] <= LOG_LEVEL) traceLog.record(id, ##__VA_ARGS__); } while (0)
+
+inline int32_t	logFloat(float value) { int32_t bits; memcpy(&bits, &value, sizeof(bits)); return bits; }	// For %f arguments
+
+/*
+class TraceLog queues log records in a RAM ring, to be sent by drain() from a low priority loop() task.
+record() can be called from loop() and from interrupts. It masks interrupts only while copying the record in,
+and drops the whole record, counting it, when the ring is full. drain() only writes what the UART can take
+without blocking.
+The log is used by static objects' code, so like the ChannelTable it has no constructor and relies on being zeroed.
+*/
+class TraceLog {
+public:
+	template <typename... Args>
+	void	record(uint8_t id, Args... args) {
+		static_assert(sizeof...(args) <= LOG_MAX_ARGS, "Too many log arguments");
+		const int32_t values[] = { (int32_t)args..., 0 };
+		write(id, sizeof...(args), values);
+	}
+	void	write(uint8_t id, uint8_t argc, const int32_t *args);
+	void	drain(Stream &out);
+	uint32_t	getDropped() { return _dropped; }	// Records lost to a full ring
+private:
+	uint8_t	_buf[LOG_RING_SIZE];
+	volatile uint16_t	_head;	// Next byte to write. Written with interrupts masked.
+	volatile uint16_t	_tail;	// Next byte to send. Only written by drain().
+	volatile uint32_t	_dropped;
+};
+
+extern TraceLog traceLog;
+
+#endif
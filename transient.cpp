@@ -0,0 +1,213 @@
+// Triggered transient recorder
+
+#include "transient.h"
+#include "broker_util.h"
+#include "trace_log.h"
+
+const char *TRIG_MODE_STRINGS[] = { "off","level","slope","window" };
+
+
+bool TransientRecorder::setTrigger(ADCData *channel, uint8_t mode, double high, double low, double slope_per_ms) {
+	if (channel == NULL || mode > TRIG_WINDOW || channel->getGainQ32() <= 0) return false;
+	if (mode == TRIG_WINDOW && low >= high) return false;
+	if (mode == TRIG_SLOPE && slope_per_ms <= 0) return false;
+	noInterrupts();
+	_mode = TRIG_OFF; // Event slots already frozen are kept
+	if (_post_left) {
+		_events[_recording_slot].state = EVENT_EMPTY; // Discard the partial event
+		_post_left = 0;
+	}
+	_channel = channel;
+	_high = high;
+	_low = low;
+	_slope_per_ms = slope_per_ms;
+	_high_counts = _unitsToCounts(high);
+	_low_counts = _unitsToCounts(low);
+	_slope_counts_per_ms = (uint32_t)(fabs(slope_per_ms) * Q32_ONE / channel->getGainQ32());
+	_pre_fill = 0;
+	_mode = mode;
+	interrupts();
+	return true;
+}
+
+int32_t TransientRecorder::_unitsToCounts(double units) {
+	const double counts = _channel->getOffsetCounts() + units * Q32_ONE / _channel->getGainQ32();
+	return (int32_t)constrain(counts, -1.0, (double)ADC_FULL_SCALE_COUNTS + 1.0); // Out of range never triggers
+}
+
+void TransientRecorder::record(ADCData *data, uint16_t raw, uint32_t cycles) {
+	if (data != _channel || _seen || _mode == TRIG_OFF) return;
+	_seen = true; // A channel in two slots, like the battery voltage, counts once per scan
+	if (_post_left) {
+		TransientEvent &event = _events[_recording_slot];
+		event.samples[TRIG_PRE_SAMPLES + TRIG_POST_SAMPLES - _post_left] = raw;
+		if (--_post_left == 0) {
+			event.end_cycles = cycles;
+			event.state = EVENT_NEW;
+			_pre_fill = 0; // Re-arms once the history has filled again
+		}
+		return;
+	}
+	if (_pre_fill >= TRIG_PRE_SAMPLES && _check(raw, cycles)) {
+		_fire(raw, cycles);
+		if (_post_left) return;
+	}
+	_pre[_pre_head] = raw;
+	_span_cycles[_pre_head & (TRIG_SLOPE_SPAN - 1)] = cycles;
+	_pre_head = (_pre_head + 1) & (TRIG_PRE_SAMPLES - 1);
+	if (_pre_fill < TRIG_PRE_SAMPLES) _pre_fill++;
+}
+
+bool TransientRecorder::_check(uint16_t raw, uint32_t cycles) {
+	// Level and window trigger on the edge, so a level that stays out of range doesn't trigger again on re-arm
+	const int32_t counts = raw;
+	const int32_t last = _pre[(_pre_head - 1) & (TRIG_PRE_SAMPLES - 1)];
+	switch (_mode) {
+		case (TRIG_LEVEL):
+			return counts >= _high_counts && last < _high_counts;
+		case (TRIG_WINDOW):
+			return (counts > _high_counts || counts < _low_counts) && last <= _high_counts && last >= _low_counts;
+		case (TRIG_SLOPE): {
+			// The sample TRIG_SLOPE_SPAN back shares its _span_cycles slot with the one about to be written
+			const int32_t old = _pre[(_pre_head - TRIG_SLOPE_SPAN) & (TRIG_PRE_SAMPLES - 1)];
+			const uint32_t span_cycles = cycles - _span_cycles[_pre_head & (TRIG_SLOPE_SPAN - 1)];
+			const uint32_t change = (uint32_t)abs(counts - old);
+			return (uint64_t)change * (CYCLES_PER_US * 1000) >= (uint64_t)_slope_counts_per_ms * span_cycles;
+		}
+		default:
+			return false;
+	}
+}
+
+void TransientRecorder::_fire(uint16_t raw, uint32_t cycles) {
+	// Oldest slot that has already been announced or was never used
+	uint8_t slot = _next_slot;
+	uint8_t tries = 0;
+	while (_events[slot].state == EVENT_NEW || _events[slot].state == EVENT_RECORDING) {
+		slot = (slot + 1) % TRIG_EVENT_SLOTS;
+		if (++tries >= TRIG_EVENT_SLOTS) {
+			_missed++;
+			return;
+		}
+	}
+	TransientEvent &event = _events[slot];
+	event.state = EVENT_RECORDING;
+	for (uint16_t i = 0; i < TRIG_PRE_SAMPLES; i++) {
+		// _pre_head is the oldest sample once the history is full
+		event.samples[i] = _pre[(_pre_head + i) & (TRIG_PRE_SAMPLES - 1)];
+	}
+	event.samples[TRIG_PRE_SAMPLES] = raw;
+	event.id = _next_id++;
+	event.channel = _channel;
+	event.time = timestampNow();
+	event.trigger_ms = millis();
+	event.trigger_cycles = cycles;
+	event.trigger_raw = raw;
+	event.mode = _mode;
+	_recording_slot = slot;
+	_next_slot = (slot + 1) % TRIG_EVENT_SLOTS;
+	_post_left = TRIG_POST_SAMPLES - 1;
+	LOG(LOG_TRANSIENT, event.id, _channel->getChannel(), raw);
+}
+
+void TransientRecorder::service(Print &out) {
+	// Announces new events, oldest first
+	for (uint8_t n = 0; n < TRIG_EVENT_SLOTS; n++) {
+		TransientEvent *oldest = NULL;
+		for (uint8_t slot = 0; slot < TRIG_EVENT_SLOTS; slot++) {
+			if (_events[slot].state == EVENT_NEW && (oldest == NULL || _events[slot].id < oldest->id)) oldest = &_events[slot];
+		}
+		if (oldest == NULL) return;
+		char out_buffer[MAIN_BUFFER_SIZE];
+		uint16_t out_buffer_idx = 0;
+		out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "{\"method\":\"event\",\"params\":{");
+		out_buffer_idx = _eventToStr(out_buffer, out_buffer_idx, *oldest);
+		out_buffer_idx += sprintf(out_buffer + out_buffer_idx, "}}");
+		out.println(out_buffer);
+		oldest->state = EVENT_ANNOUNCED;
+	}
+}
+
+TransientEvent *TransientRecorder::_findEvent(uint32_t id) {
+	for (uint8_t slot = 0; slot < TRIG_EVENT_SLOTS; slot++) {
+		TransientEvent &event = _events[slot];
+		if ((event.state == EVENT_NEW || event.state == EVENT_ANNOUNCED) && event.id == id) return &event;
+	}
+	return NULL;
+}
+
+bool TransientRecorder::sendEventFrames(Print &out, uint32_t id) {
+	TransientEvent *event = _findEvent(id);
+	if (event == NULL) return false;
+	const uint16_t total = TRIG_PRE_SAMPLES + TRIG_POST_SAMPLES;
+	for (uint16_t first = 0, block = 0; first < total; first += CAPTURE_BLOCK_SAMPLES, block++) {
+		sendFrame(out, block, event->samples + first, min((uint16_t)CAPTURE_BLOCK_SAMPLES, (uint16_t)(total - first)));
+	}
+	return true;
+}
+
+uint16_t TransientRecorder::eventToStr(char *out_str, uint16_t idx, uint32_t id) {
+	TransientEvent *event = _findEvent(id);
+	if (event == NULL) return idx;
+	idx += sprintf(out_str + idx, "\"event\":{");
+	idx = _eventToStr(out_str, idx, *event);
+	idx += sprintf(out_str + idx, ",\"gain_q32\":%ld,\"offset_counts\":%ld,\"blocks\":%u}", event->channel->getGainQ32(), event->channel->getOffsetCounts(),
+		(TRIG_PRE_SAMPLES + TRIG_POST_SAMPLES + CAPTURE_BLOCK_SAMPLES - 1) / CAPTURE_BLOCK_SAMPLES);
+	return idx;
+}
+
+uint16_t TransientRecorder::_eventToStr(char *out_str, uint16_t idx, TransientEvent &event) {
+	ADCData *channel = event.channel;
+	char valueStr[FORMAT_MAX_LEN];
+	char timeStr[TIMESTAMP_STR_LEN];
+	timestampToStr(event.time, timeStr);
+	idx += sprintf(out_str + idx, "\"id\":%lu,\"channel\":\"%s\",\"units\":\"%s\",\"trigger\":\"%s\"",
+		event.id, channel->getName(), channel->getUnit(), TRIG_MODE_STRINGS[event.mode]);
+	idx += sprintf(out_str + idx, ",\"time\":%s,\"time_ms\":%u,\"ms\":%lu", timeStr, event.time.ms, event.trigger_ms);
+	// Trigger value and extremes in channel units
+	uint16_t min_raw = event.samples[0];
+	uint16_t max_raw = event.samples[0];
+	for (uint16_t i = 1; i < TRIG_PRE_SAMPLES + TRIG_POST_SAMPLES; i++) {
+		min_raw = min(min_raw, event.samples[i]);
+		max_raw = max(max_raw, event.samples[i]);
+	}
+	formatQ16(valueStr, channel->rawToQ16(event.trigger_raw), 1, 3);
+	idx += sprintf(out_str + idx, ",\"value\":%s", valueStr);
+	formatQ16(valueStr, channel->rawToQ16(min_raw), 1, 3);
+	idx += sprintf(out_str + idx, ",\"min\":%s", valueStr);
+	formatQ16(valueStr, channel->rawToQ16(max_raw), 1, 3);
+	idx += sprintf(out_str + idx, ",\"max\":%s", valueStr);
+	// Rate measured across the post trigger samples
+	formatFixed(valueStr, (double)F_CPU * (TRIG_POST_SAMPLES - 1) / (double)(event.end_cycles - event.trigger_cycles), 1, 1);
+	idx += sprintf(out_str + idx, ",\"rate_hz\":%s,\"pre\":%u,\"post\":%u", valueStr, TRIG_PRE_SAMPLES, TRIG_POST_SAMPLES);
+	return idx;
+}
+
+uint16_t TransientRecorder::triggerToStr(char *out_str, uint16_t idx) {
+	char valueStr[FORMAT_MAX_LEN];
+	idx += sprintf(out_str + idx, "\"trigger\":{\"mode\":\"%s\"", TRIG_MODE_STRINGS[_mode]);
+	if (_channel) idx += sprintf(out_str + idx, ",\"channel\":\"%s\"", _channel->getName());
+	formatFixed(valueStr, _high, 1, 3);
+	idx += sprintf(out_str + idx, ",\"high\":%s", valueStr);
+	formatFixed(valueStr, _low, 1, 3);
+	idx += sprintf(out_str + idx, ",\"low\":%s", valueStr);
+	formatFixed(valueStr, _slope_per_ms, 1, 3);
+	idx += sprintf(out_str + idx, ",\"slope_per_ms\":%s,\"missed\":%lu}", valueStr, _missed);
+	return idx;
+}
+
+uint16_t TransientRecorder::eventsToStr(char *out_str, uint16_t idx) {
+	idx += sprintf(out_str + idx, ",\"events\":[");
+	bool first = true;
+	for (uint8_t slot = 0; slot < TRIG_EVENT_SLOTS; slot++) {
+		TransientEvent &event = _events[slot];
+		if (event.state != EVENT_NEW && event.state != EVENT_ANNOUNCED) continue;
+		if (!first) idx += sprintf(out_str + idx, ",");
+		first = false;
+		idx += sprintf(out_str + idx, "{");
+		idx = _eventToStr(out_str, idx, event);
+		idx += sprintf(out_str + idx, "}");
+	}
+	idx += sprintf(out_str + idx, "]");
+	return idx;
+}
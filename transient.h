@@ -0,0 +1,94 @@
+// transient.h
+
+#ifndef _TRANSIENT_h
+#define _TRANSIENT_h
+
+#include "adc_sampler.h"
+#include "capture.h"
+#include <TimeLib.h>
+
+#define TRIG_PRE_SAMPLES	128	// History kept before the trigger. Must be a power of two.
+#define TRIG_POST_SAMPLES	384	// Recorded after the trigger, including the triggering sample
+#define TRIG_EVENT_SLOTS	4
+#define TRIG_SLOPE_SPAN	4	// Slope is measured across this many samples to ride over noise. Must be a power of two.
+
+enum TRIG_MODE { TRIG_OFF = 0, TRIG_LEVEL = 1, TRIG_SLOPE = 2, TRIG_WINDOW = 3 };
+enum EVENT_STATE { EVENT_EMPTY = 0, EVENT_RECORDING = 1, EVENT_NEW = 2, EVENT_ANNOUNCED = 3 };
+
+extern const char *TRIG_MODE_STRINGS[];	// Indexed by TRIG_MODE
+
+struct TransientEvent {
+	uint16_t	samples[TRIG_PRE_SAMPLES + TRIG_POST_SAMPLES];	// Raw counts, oldest first
+	uint32_t	id;	// Counts up from 1
+	ADCData	*channel;
+	Timestamp	time;	// Wall clock time of the trigger
+	uint32_t	trigger_ms;	// millis() at the trigger
+	uint32_t	trigger_cycles;
+	uint32_t	end_cycles;
+	uint16_t	trigger_raw;
+	uint8_t	mode;
+	volatile uint8_t	state;
+};
+
+/*
+class TransientRecorder watches one sampler channel for a level, slope or window trigger and freezes the samples
+around it into one of TRIG_EVENT_SLOTS event slots.
+The check runs in the sampler ISR on every sample, so an event is caught within one sample period.
+The ADC hardware compare isn't used because ADC_0 scans several channels and the compare would apply to all of them.
+A slot that has not been announced yet is never overwritten. Triggers that find no free slot are counted as missed.
+service() runs from a loop() task and announces each new event with an "event" notification.
+*/
+class TransientRecorder : public SampleTap {
+public:
+	TransientRecorder() {
+		_channel = NULL;
+		_mode = TRIG_OFF;
+		_high = 0;
+		_low = 0;
+		_slope_per_ms = 0;
+		_next_id = 1;
+		_next_slot = 0;
+		_missed = 0;
+		_post_left = 0;
+		_pre_fill = 0;
+		_pre_head = 0;
+		for (uint8_t slot = 0; slot < TRIG_EVENT_SLOTS; slot++) _events[slot].state = EVENT_EMPTY;
+	}
+	bool	setTrigger(ADCData *channel, uint8_t mode, double high, double low, double slope_per_ms);
+	void	beginScan(uint32_t cycles) { _seen = false; }
+	void	record(ADCData *data, uint16_t raw, uint32_t cycles);
+	void	service(Print &out);
+	bool	hasEvent(uint32_t id) { return _findEvent(id) != NULL; }
+	bool	sendEventFrames(Print &out, uint32_t id);	// Binary frames as in capture.h, TRIG_PRE_SAMPLES + TRIG_POST_SAMPLES samples
+	uint16_t	eventToStr(char *out_str, uint16_t idx, uint32_t id);	// Appends "event":{...}
+	uint16_t	triggerToStr(char *out_str, uint16_t idx);	// Appends "trigger":{...}
+	uint16_t	eventsToStr(char *out_str, uint16_t idx);	// Appends ,"events":[...] listing the stored events
+	uint32_t	getMissed() { return _missed; }
+private:
+	bool	_check(uint16_t raw, uint32_t cycles);
+	void	_fire(uint16_t raw, uint32_t cycles);
+	TransientEvent	*_findEvent(uint32_t id);
+	uint16_t	_eventToStr(char *out_str, uint16_t idx, TransientEvent &event);
+	int32_t	_unitsToCounts(double units);
+	ADCData	*_channel;
+	volatile uint8_t	_mode;
+	int32_t	_high_counts;
+	int32_t	_low_counts;
+	uint32_t	_slope_counts_per_ms;
+	double	_high;	// As set, in channel units
+	double	_low;
+	double	_slope_per_ms;
+	uint16_t	_pre[TRIG_PRE_SAMPLES];
+	uint32_t	_span_cycles[TRIG_SLOPE_SPAN];	// Sample times for the slope check
+	uint16_t	_pre_head;	// Next _pre slot to write
+	uint16_t	_pre_fill;	// Samples in _pre since the last re-arm
+	uint16_t	_post_left;	// Samples still to record into the current event
+	TransientEvent	_events[TRIG_EVENT_SLOTS];
+	uint8_t	_next_slot;
+	uint8_t	_recording_slot;
+	uint32_t	_next_id;
+	volatile uint32_t	_missed;
+	bool	_seen;	// Channel already recorded this scan
+};
+
+#endif
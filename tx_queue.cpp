@@ -0,0 +1,181 @@
+// Non-blocking output queue for the USB serial port. See tx_queue.h.
+
+#include "tx_queue.h"
+
+TxQueue::TxQueue(uint16_t publish_reserve) {
+	for (uint8_t c = 0; c < TX_CHUNKS; c++) _chunks[c].next = c + 1;
+	_chunks[TX_CHUNKS - 1].next = TX_NO_CHUNK;
+	_free = 0;
+	_free_count = TX_CHUNKS;
+	_msg_count = 0;
+	_sent = 0;
+	_started = false;
+	_is_open = false;
+	_open_failed = false;
+	_dropped = false;
+	_open_len = 0;
+	_publish_reserve = publish_reserve;
+	_used_peak = 0;
+	_messages = 0;
+	_replies_dropped = 0;
+	_publishes_dropped = 0;
+	_publishes_deferred = 0;
+	_flush_us = 0;
+	_flush_max_us = 0;
+}
+
+bool TxQueue::begin(uint8_t kind) {
+	if (_is_open) return false;
+	_dropped = true;
+	if (kind == TX_PUBLISH) {
+		// Deferred while an earlier one waits, so only one stale set of values is ever queued
+		bool waiting = false;
+		for (uint8_t m = 0; m < _msg_count; m++) waiting = waiting || _isDroppable(m);
+		if (waiting || _msg_count >= TX_MESSAGES || (uint16_t)_free_count * TX_CHUNK_SIZE < _publish_reserve) {
+			_publishes_deferred++;
+			return false;
+		}
+	}
+	else if (_msg_count >= TX_MESSAGES && !_dropPublish()) {
+		_replies_dropped++;
+		return false;
+	}
+	_open.first = TX_NO_CHUNK;
+	_open.last = TX_NO_CHUNK;
+	_open.chunks = 0;
+	_open.kind = kind;
+	_open_len = 0;
+	_open_failed = false;
+	_dropped = false;
+	_is_open = true;
+	return true;
+}
+
+uint16_t TxQueue::end() {
+	if (!_is_open) return 0;
+	_is_open = false;
+	if (_open_failed) {
+		_dropped = true;
+		if (_open.kind == TX_PUBLISH) _publishes_dropped++;
+		else _replies_dropped++;
+		return 0;
+	}
+	if (_open_len == 0) return 0;
+	_open.queued_us = micros();
+	_msgs[_msg_count++] = _open;
+	return _open_len;
+}
+
+size_t TxQueue::write(const uint8_t *buffer, size_t size) {
+	if (!_is_open || _open_failed) return 0;
+	size_t left = size;
+	while (left) {
+		if (_open.last == TX_NO_CHUNK || _chunks[_open.last].len == TX_CHUNK_SIZE) {
+			const uint8_t c = _alloc();
+			if (c == TX_NO_CHUNK) {
+				// Dropped whole. A partial message would corrupt the stream.
+				_freeChunks(_open.first);
+				_open.first = TX_NO_CHUNK;
+				_open_failed = true;
+				return 0;
+			}
+			if (_open.first == TX_NO_CHUNK) _open.first = c;
+			else _chunks[_open.last].next = c;
+			_open.last = c;
+			_open.chunks++;
+		}
+		Chunk &chunk = _chunks[_open.last];
+		const uint8_t part = min(left, (size_t)(TX_CHUNK_SIZE - chunk.len));
+		memcpy(chunk.data + chunk.len, buffer, part);
+		chunk.len += part;
+		buffer += part;
+		left -= part;
+	}
+	_open_len += size;
+	return size;
+}
+
+void TxQueue::drain(Stream &out) {
+	// Keeps going while the port takes more. Teensy's USB serial queues several packets.
+	while (_msg_count) {
+		const int room = out.availableForWrite();
+		if (room <= 0) return;
+		Message &msg = _msgs[0];
+		Chunk &chunk = _chunks[msg.first];
+		const uint8_t part = min(room, chunk.len - _sent);
+		out.write((const uint8_t *)chunk.data + _sent, part);
+		_started = true;
+		_sent += part;
+		if (_sent < chunk.len) continue;
+		_sent = 0;
+		const uint8_t next = chunk.next;
+		chunk.next = _free;
+		_free = msg.first;
+		_free_count++;
+		msg.first = next;
+		msg.chunks--;
+		if (next != TX_NO_CHUNK) continue;
+		_flush_us = micros() - msg.queued_us;
+		_flush_max_us = max(_flush_max_us, _flush_us);
+		_messages++;
+		_removeMessage(0);
+		_started = false;
+	}
+}
+
+void TxQueue::flush(Stream &out, uint32_t timeout_ms) {
+	const uint32_t start_ms = millis();
+	while (_msg_count && millis() - start_ms < timeout_ms) drain(out);
+}
+
+bool TxQueue::hasRoom(uint16_t bytes) {
+	uint16_t chunks = _free_count;
+	for (uint8_t m = 0; m < _msg_count; m++) {
+		if (_isDroppable(m)) chunks += _msgs[m].chunks;
+	}
+	return (uint32_t)chunks * TX_CHUNK_SIZE >= bytes;
+}
+
+uint8_t TxQueue::_alloc() {
+	if (_free_count == 0 && (_open.kind != TX_RESPONSE || !_dropPublish())) return TX_NO_CHUNK;
+	const uint8_t c = _free;
+	_free = _chunks[c].next;
+	_free_count--;
+	_chunks[c].next = TX_NO_CHUNK;
+	_chunks[c].len = 0;
+	if (TX_CHUNKS - _free_count > _used_peak) _used_peak = TX_CHUNKS - _free_count;
+	return c;
+}
+
+void TxQueue::_freeChunks(uint8_t first) {
+	while (first != TX_NO_CHUNK) {
+		const uint8_t next = _chunks[first].next;
+		_chunks[first].next = _free;
+		_free = first;
+		_free_count++;
+		first = next;
+	}
+}
+
+bool TxQueue::_dropPublish() {
+	for (uint8_t m = 0; m < _msg_count; m++) {
+		if (!_isDroppable(m)) continue;
+		_freeChunks(_msgs[m].first);
+		_removeMessage(m);
+		_publishes_dropped++;
+		return true;
+	}
+	return false;
+}
+
+void TxQueue::_removeMessage(uint8_t m) {
+	_msg_count--;
+	memmove(_msgs + m, _msgs + m + 1, (_msg_count - m) * sizeof(Message));
+}
+
+uint16_t TxQueue::statusToStr(char *out_str, uint16_t idx) {
+	idx += sprintf(out_str + idx, ",\"tx\":{\"depth\":%u,\"chunks\":%u,\"chunks_peak\":%u,\"messages\":%lu", _msg_count, TX_CHUNKS - _free_count, _used_peak, _messages);
+	idx += sprintf(out_str + idx, ",\"replies_dropped\":%lu,\"publishes_dropped\":%lu,\"publishes_deferred\":%lu", _replies_dropped, _publishes_dropped, _publishes_deferred);
+	idx += sprintf(out_str + idx, ",\"flush_us\":%lu,\"flush_max_us\":%lu}", _flush_us, _flush_max_us);
+	return idx;
+}
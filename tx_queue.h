@@ -0,0 +1,83 @@
+// tx_queue.h
+
+#ifndef _TX_QUEUE_h
+#define _TX_QUEUE_h
+
+#include <Arduino.h>
+
+#define TX_CHUNK_SIZE	64	// One USB full speed packet
+#define TX_CHUNKS	88	// 5.5 kB. Room for the largest reply (TX_REPLY_ROOM in the sketch) and a capture frame.
+#define TX_MESSAGES	16	// Messages waiting at once
+#define TX_NO_CHUNK	0xFF
+
+enum TX_KIND { TX_RESPONSE = 0, TX_PUBLISH };
+
+/*
+class TxQueue holds outgoing messages in a pool of fixed size chunks until drain() hands them to the USB serial
+port, so a slow host never blocks loop(). It is a Print: begin() opens a message, everything printed goes into it,
+and end() queues it whole. A message that runs out of chunks is dropped whole, never sent in part.
+drain() only writes what the port will take without blocking, and is called on every pass of loop().
+Backpressure: callers ask hasRoom() before taking on work that will need to reply, so requests wait in the USB
+receive buffer rather than have their replies dropped. TX_PUBLISH messages (subscriptions) are stale once a newer
+one could be made, so:
+- begin(TX_PUBLISH) refuses while an earlier one is still waiting, or while room is short of the reserve kept for
+  replies. The subscription is deferred, and channels that come due meanwhile go out together in the next one.
+- When a reply needs room, publishes that haven't started to go out are dropped, oldest first.
+Each message is timed from end() until its last byte is written to the port.
+*/
+class TxQueue : public Print {
+public:
+	TxQueue(uint16_t publish_reserve);	// Room publishes must leave for replies, in bytes
+	bool	begin(uint8_t kind);	// TX_KIND. false if the message can't be taken, in which case nothing printed is kept.
+	uint16_t	end();	// Queues the open message. Returns its length, or 0 if it was empty or dropped.
+	bool	wasDropped() { return _dropped; }	// The last message begun was refused or dropped by end()
+	size_t	write(uint8_t c) { return write(&c, 1); }
+	size_t	write(const uint8_t *buffer, size_t size);
+	using	Print::write;
+	void	drain(Stream &out);
+	void	flush(Stream &out, uint32_t timeout_ms);	// Blocks until empty. Only for just before a reset.
+	bool	hasRoom(uint16_t bytes);	// Free, or held by publishes that would be dropped for a reply
+	bool	isEmpty() { return _msg_count == 0; }
+	uint16_t	statusToStr(char *out_str, uint16_t idx);	// Appends ,"tx":{...}
+private:
+	struct Chunk {
+		uint8_t	next;
+		uint8_t	len;
+		char	data[TX_CHUNK_SIZE];
+	};
+	struct Message {
+		uint8_t	first;
+		uint8_t	last;
+		uint8_t	chunks;
+		uint8_t	kind;
+		uint32_t	queued_us;
+	};
+	uint8_t	_alloc();	// A free chunk, dropping publishes if there are none. TX_NO_CHUNK if that fails.
+	void	_freeChunks(uint8_t first);
+	bool	_dropPublish();	// Oldest publish that hasn't started to go out
+	void	_removeMessage(uint8_t m);
+	bool	_isDroppable(uint8_t m) { return _msgs[m].kind == TX_PUBLISH && (m > 0 || !_started); }
+	Chunk	_chunks[TX_CHUNKS];
+	Message	_msgs[TX_MESSAGES];	// Oldest first
+	Message	_open;
+	uint8_t	_msg_count;
+	uint8_t	_free;	// Head of the free list
+	uint8_t	_free_count;
+	uint8_t	_sent;	// Bytes of the oldest message's first chunk already written
+	bool	_started;	// The oldest message has started to go out, so it can't be dropped
+	bool	_is_open;
+	bool	_open_failed;	// Ran out of room. The rest of the message is ignored.
+	bool	_dropped;
+	uint16_t	_open_len;
+	uint16_t	_publish_reserve;
+	// Counters for broker_status
+	uint8_t	_used_peak;	// Most chunks in use at once
+	uint32_t	_messages;	// Sent in full
+	uint32_t	_replies_dropped;
+	uint32_t	_publishes_dropped;	// Dropped to make room for a reply
+	uint32_t	_publishes_deferred;	// Held back by begin()
+	uint32_t	_flush_us;	// Queue to last byte written, for the last message
+	uint32_t	_flush_max_us;
+};
+
+#endif
@@ -0,0 +1,109 @@
+// Rolling window aggregates. See window_stats.h.
+
+#include "window_stats.h"
+
+WindowStats windows;
+
+static const uint32_t DEFAULT_WINDOWS_S[WINDOW_COUNT] = WINDOW_DEFAULT_S;
+
+WindowStats::WindowStats() {
+	_slots = 0;
+	for (uint8_t w = 0; w < WINDOW_COUNT; w++) setWindow(w, DEFAULT_WINDOWS_S[w]);
+}
+
+int8_t WindowStats::attach() {
+	if (_slots >= WINDOW_SLOTS) return -1;
+	for (uint8_t w = 0; w < WINDOW_COUNT; w++) _clear(_slots, w);
+	return _slots++;
+}
+
+void WindowStats::_clear(uint8_t slot, uint8_t w) {
+	for (uint8_t b = 0; b < WINDOW_BUCKETS; b++) _buckets[slot][w][b].count = 0;
+	_epoch[slot][w] = millis() / _bucket_ms[w];
+}
+
+void WindowStats::add(uint8_t slot, double value) {
+	if (slot >= _slots || isnan(value)) return;
+	const uint32_t now_ms = millis();
+	const float value_f = (float)value;
+	for (uint8_t w = 0; w < WINDOW_COUNT; w++) {
+		const uint32_t epoch = now_ms / _bucket_ms[w];
+		uint32_t skipped = epoch - _epoch[slot][w];
+		if (skipped) {
+			// Buckets with nothing added since they last came round are emptied now. A millis() wrap empties them all.
+			if (skipped > WINDOW_BUCKETS) skipped = WINDOW_BUCKETS;
+			for (uint32_t i = 0; i < skipped; i++) _buckets[slot][w][(epoch - i) % WINDOW_BUCKETS].count = 0;
+			_epoch[slot][w] = epoch;
+		}
+		Bucket &bucket = _buckets[slot][w][epoch % WINDOW_BUCKETS];
+		if (bucket.count == 0) {
+			bucket.min = value_f;
+			bucket.max = value_f;
+			bucket.sum = 0;
+		}
+		else {
+			if (value_f < bucket.min) bucket.min = value_f;
+			if (value_f > bucket.max) bucket.max = value_f;
+		}
+		bucket.sum += value_f;
+		bucket.count++;
+	}
+}
+
+bool WindowStats::get(uint8_t slot, uint8_t w, WindowSnapshot &snapshot) {
+	if (slot >= _slots || w >= WINDOW_COUNT) return false;
+	const uint32_t now_ms = millis();
+	const uint32_t now_epoch = now_ms / _bucket_ms[w];
+	double sum = 0;
+	uint32_t oldest = now_epoch;
+	snapshot.window_s = _window_s[w];
+	snapshot.count = 0;
+	for (uint8_t k = 0; k < WINDOW_BUCKETS; k++) {
+		// Newest first. Buckets that have slid out of the window haven't been cleared yet, so skip them.
+		if (k > _epoch[slot][w]) break; // Before millis() started
+		const uint32_t epoch = _epoch[slot][w] - k;
+		if (now_epoch - epoch >= WINDOW_BUCKETS) break;
+		const Bucket &bucket = _buckets[slot][w][epoch % WINDOW_BUCKETS];
+		if (bucket.count == 0) continue;
+		if (snapshot.count == 0 || bucket.min < snapshot.min) snapshot.min = bucket.min;
+		if (snapshot.count == 0 || bucket.max > snapshot.max) snapshot.max = bucket.max;
+		sum += bucket.sum;
+		snapshot.count += bucket.count;
+		oldest = epoch;
+	}
+	if (snapshot.count == 0) return false;
+	snapshot.mean = (float)(sum / snapshot.count);
+	snapshot.span_ms = now_ms - oldest * _bucket_ms[w];
+	return true;
+}
+
+uint8_t WindowStats::findWindow(uint32_t window_s) {
+	uint8_t best = 0;
+	for (uint8_t w = 1; w < WINDOW_COUNT; w++) {
+		const bool fits = _window_s[w] >= window_s;
+		const bool best_fits = _window_s[best] >= window_s;
+		if (fits ? (!best_fits || _window_s[w] < _window_s[best]) : (!best_fits && _window_s[w] > _window_s[best])) best = w;
+	}
+	return best;
+}
+
+bool WindowStats::setWindow(uint8_t w, uint32_t window_s) {
+	if (w >= WINDOW_COUNT || window_s < WINDOW_MIN_S || window_s > WINDOW_MAX_S) return false;
+	_window_s[w] = window_s;
+	_bucket_ms[w] = window_s * 1000UL / WINDOW_BUCKETS;
+	for (uint8_t slot = 0; slot < _slots; slot++) _clear(slot, w); // Old buckets are the wrong length
+	return true;
+}
+
+uint16_t WindowStats::windowsToStr(char *out_str, uint16_t idx) {
+	idx += sprintf(out_str + idx, ",\"windows_s\":[");
+	for (uint8_t w = 0; w < WINDOW_COUNT; w++) idx += sprintf(out_str + idx, w ? ",%lu" : "%lu", _window_s[w]);
+	idx += sprintf(out_str + idx, "]");
+	return idx;
+}
+
+void WindowStats::windowsToJson(JsonWriter &out) {
+	out.beginArray("windows_s");
+	for (uint8_t w = 0; w < WINDOW_COUNT; w++) out.value(_window_s[w]);
+	out.endArray();
+}
@@ -0,0 +1,66 @@
+// window_stats.h
+
+#ifndef _WINDOW_STATS_h
+#define _WINDOW_STATS_h
+
+#include <Arduino.h>
+#include "json_writer.h"
+
+#define WINDOW_COUNT	3	// Window lengths kept for every tracked channel
+#define WINDOW_BUCKETS	12	// Buckets per window. A window covers between one bucket less than its length and its full length.
+#define WINDOW_SLOTS	8	// Channels that can be tracked: every voltage, current and power a config can hold. Each takes WINDOW_COUNT * WINDOW_BUCKETS * 16 bytes.
+#define WINDOW_MIN_S	WINDOW_BUCKETS	// One second buckets
+#define WINDOW_MAX_S	604800UL	// A week. Longer would overflow the bucket length in ms.
+#define WINDOW_DEFAULT_S	{ 60, 3600, 86400 }	// Last minute, hour and day
+
+/*
+Aggregates of one channel over a window, in channel units.
+*/
+struct WindowSnapshot {
+	uint32_t	window_s;	// Configured length
+	uint32_t	span_ms;	// Time actually covered, shorter until the window has filled
+	uint32_t	count;	// Values in the window
+	float	min;
+	float	max;
+	float	mean;
+};
+
+/*
+class WindowStats keeps rolling min, max and mean of the tracked channels over WINDOW_COUNT window lengths.
+Each window is a ring of WINDOW_BUCKETS buckets, each covering window_s / WINDOW_BUCKETS of millis(). add() folds a
+value into the current bucket of every window and, when time has moved on, clears the buckets it skipped. Every bucket is
+cleared once per pass round the ring, so add() is O(1) whatever the window lengths. get() combines one window's buckets,
+so the cost of a query depends on WINDOW_BUCKETS, not on the number of values.
+Windows slide a bucket at a time and are unaffected by resetting a channel's all-time min and max.
+Values are only added from loop(), after every constructor has run.
+*/
+class WindowStats {
+public:
+	WindowStats();
+	int8_t	attach();	// A free slot, or -1 if all are taken
+	void	add(uint8_t slot, double value);
+	bool	get(uint8_t slot, uint8_t w, WindowSnapshot &snapshot);	// false if the window holds no values
+	uint8_t	findWindow(uint32_t window_s);	// Shortest window at least window_s long, or the longest
+	uint32_t	getWindow(uint8_t w) { return _window_s[w]; }
+	bool	setWindow(uint8_t w, uint32_t window_s);	// Clears window w on every channel
+	uint8_t	getSlotCount() { return _slots; }
+	uint16_t	windowsToStr(char *out_str, uint16_t idx);	// Appends ,"windows_s":[...]
+	void	windowsToJson(JsonWriter &out);
+private:
+	struct Bucket {
+		float	min;
+		float	max;
+		float	sum;
+		uint32_t	count;
+	};
+	void	_clear(uint8_t slot, uint8_t w);
+	uint32_t	_window_s[WINDOW_COUNT];
+	uint32_t	_bucket_ms[WINDOW_COUNT];
+	Bucket	_buckets[WINDOW_SLOTS][WINDOW_COUNT][WINDOW_BUCKETS];
+	uint32_t	_epoch[WINDOW_SLOTS][WINDOW_COUNT];	// millis() / _bucket_ms of the newest bucket
+	uint8_t	_slots;
+};
+
+extern WindowStats windows;
+
+#endif